@@ -0,0 +1,34 @@
+//
+// clock_sync.h
+//
+// Host - device clock synchronization (NTP style).
+// Host sends "timesync -t1 <host time>" and notes the time it receives the answer (t4). Device answers
+// TIMESYNC:<t1>:<t2>:<t3> (t2 receive, t3 transmit, device timestamps). Host passes t4 with the next
+// exchange ("timesync -t1 <new t1> -t4 <previous t4>"), so the device can complete the previous exchange itself:
+//   offset = ((t2 - t1) + (t3 - t4)) / 2, round trip delay = (t4 - t1) - (t3 - t2)
+// Completed exchanges are kept as samples (device time, host time) and a line is fitted through them
+// (least squares): host time = device time + offset + drift * (device time - ref). Exchanges with long round trip
+// are rejected, asymmetric delay is what limits the precision.
+// Device time used here is time since boot, so the model survives resettimestamp and scheduler start.
+// Host times are in us, any epoch (e.g. unix time in us). With a model, cmds can be scheduled with
+// -hsched <host time> and gettimestamp -host reports host time.
+
+#ifndef LIGHTSOAKFW_STM_CLOCK_SYNC_H
+#define LIGHTSOAKFW_STM_CLOCK_SYNC_H
+
+#include <stdint.h>
+
+#define CLKSYNC_NUM_SAMPLES 16
+//exchanges with longer round trip are not used
+#define CLKSYNC_MAX_DELAY_US 20000
+//drift is estimated only when samples span at least this long, before that only offset is used
+#define CLKSYNC_MIN_DRIFT_SPAN_US 60000000ULL
+
+void clksync_exchange(uint64_t t1, uint8_t has_t4, uint64_t t4);
+void clksync_reset(void);
+uint8_t clksync_is_synced(void);
+uint64_t clksync_dev_to_host(uint64_t dev_timestamp);
+uint64_t clksync_host_to_dev(uint64_t host_time);
+void clksync_print_status(void);
+
+#endif //LIGHTSOAKFW_STM_CLOCK_SYNC_H
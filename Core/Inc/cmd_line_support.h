@@ -15,18 +15,54 @@
 #include "lwshell/lwshell.h"
 #include "main_serial.h"
 #include <string.h>
+#include <stddef.h>
 #include "measurements.h"
 #include "ds18b20.h"
 #include "cmd_scheduler.h"
+#include "cmd_trace.h"
 #include "main.h"
 
 #define MIN_TIME_TO_CMD_TO_REQ_CMDS_US 50000
+//separates cmds sent in one line
+#define CMDSPRT_CMD_SEPARATOR ';'
+
+//option schema. Each cmd lists its options in a table, cmdsprt_parse_opts() parses argv into the cmd's param
+//struct in one pass. -sched and -tag are parsed for every cmd.
+typedef enum {
+    cmdsprt_opt_flag,   //no value, uint8_t field is set to 1 if present
+    cmdsprt_opt_u8,     //uint8_t field (channel...), values > 255 are rejected
+    cmdsprt_opt_u32,
+    cmdsprt_opt_float,
+} cmdsprt_opt_type_t;
+
+typedef struct {
+    const char *name;
+    uint8_t type;       //cmdsprt_opt_type_t
+    uint8_t required;
+    uint8_t offset;     //offset of field in output struct
+} cmdsprt_opt_t;
+
+#define CMDSPRT_REQUIRED 1
+#define CMDSPRT_OPTIONAL 0
+#define CMDSPRT_OPT_SIZE(type) (((type) == cmdsprt_opt_u32 || (type) == cmdsprt_opt_float) ? 4 : 1)
+//option that is written to field of struct_t. Fails to compile if field size doesn't match type
+#define CMDSPRT_OPT(name, type, required, struct_t, field) \
+    {name, type, required, offsetof(struct_t, field) + \
+    0 * sizeof(char[(sizeof(((struct_t *)0)->field) == CMDSPRT_OPT_SIZE(type)) ? 1 : -1])}
+#define CMDSPRT_NUM_OPTS(opts) (sizeof(opts) / sizeof((opts)[0]))
+
+typedef struct {
+    uint8_t sched;        //-sched present
+    uint64_t sched_time;
+    uint32_t tag;         //CMDSCHED_NO_TAG if -tag not present or invalid
+} cmdsprt_sched_opts_t;
 
 
 void cmdsprt_setup_cli(void);
 
 //request new cmds
 void cmdsprt_request_new_cmds(void);
+void cmdsprt_input(char c);
 
 
 // cmd callback functions (callback for every command)
@@ -81,6 +117,37 @@ int32_t cli_cmd_getdutsettle_fn(int32_t argc, char** argv);
 
 int32_t cli_cmd_getnoise_fn(int32_t argc, char** argv);
 
+int32_t cli_cmd_schedjitter_fn(int32_t argc, char** argv);
+
+int32_t cli_cmd_schedbin_fn(int32_t argc, char** argv);
+
+int32_t cli_cmd_schedcancel_fn(int32_t argc, char** argv);
+
+int32_t cli_cmd_schedstat_fn(int32_t argc, char** argv);
+
+int32_t cli_cmd_schedtrace_fn(int32_t argc, char** argv);
+int32_t cli_cmd_seqload_fn(int32_t argc, char** argv);
+int32_t cli_cmd_seqrun_fn(int32_t argc, char** argv);
+int32_t cli_cmd_seqstop_fn(int32_t argc, char** argv);
+int32_t cli_cmd_seqstat_fn(int32_t argc, char** argv);
+int32_t cli_cmd_taskstat_fn(int32_t argc, char** argv);
+int32_t cli_cmd_timesync_fn(int32_t argc, char** argv);
+int32_t cli_cmd_timesyncstat_fn(int32_t argc, char** argv);
+int32_t cli_cmd_waveclear_fn(int32_t argc, char** argv);
+int32_t cli_cmd_wavestep_fn(int32_t argc, char** argv);
+int32_t cli_cmd_waveflash_fn(int32_t argc, char** argv);
+int32_t cli_cmd_waveramp_fn(int32_t argc, char** argv);
+int32_t cli_cmd_wavesine_fn(int32_t argc, char** argv);
+int32_t cli_cmd_wavepwm_fn(int32_t argc, char** argv);
+int32_t cli_cmd_waveplay_fn(int32_t argc, char** argv);
+int32_t cli_cmd_wavestop_fn(int32_t argc, char** argv);
+int32_t cli_cmd_wavestat_fn(int32_t argc, char** argv);
+int32_t cli_cmd_sunsvoc_fn(int32_t argc, char** argv);
+int32_t cli_cmd_lockin_fn(int32_t argc, char** argv);
+int32_t cli_cmd_leddroopcal_fn(int32_t argc, char** argv);
+int32_t cli_cmd_setleddroop_fn(int32_t argc, char** argv);
+int32_t cli_cmd_getleddroop_fn(int32_t argc, char** argv);
+
 
 
 
@@ -90,6 +157,8 @@ int8_t cmdsprt_parse_uint32(const char* arg_str, uint32_t* uint_out, int32_t arg
 int8_t cmdsprt_parse_uint64(const char* arg_str, uint64_t* uint_out, int32_t argc, char** argv);
 uint8_t cmdsprt_check_argnum( int32_t argnum, int32_t argc);
 uint8_t cmdsprt_is_arg(const char* arg_str, int32_t argc, char** argv);
+int8_t cmdsprt_parse_opts(const cmdsprt_opt_t *opts, uint8_t num_opts, void *out, cmdsprt_sched_opts_t *sched,
+                          int32_t argc, char** argv);
 
 
 //lwshell out callback
@@ -3,8 +3,33 @@
 //
 // How to add scheduling to a command:
 // - Add parsing for -sched option in cmd function (see other cmd functions for examples)
-// - add a structure for parameters and a function ID (currently in measurements.h)
-// add a case in cmdsched_handler to parse and call the function at the right time. (see other cases for examples)
+// - add a structure for parameters and a function ID (currently in measurements.h, before meas_funct_id_count)
+// - add hook functions and an entry in prv_cmdsched_cmd_table in cmd_scheduler.c (see other entries for examples)
+//   exec hook runs in main loop at exec time. If part of the cmd has to happen at exact time (register write),
+//   put it in trigger hook. Triggers run from timer compare interrupt, so they must be short and must not print.
+//
+// Binary batch upload (schedbin cmd):
+// Instead of one text line per cmd, host can send many cmds in one binary block. After "schedbin" cmd
+// FW answers SCHEDBIN_READY and reads the block (all little endian):
+//   0xA5 0x5A | uint16 payload length | payload | uint32 CRC-32 (zlib crc32) of length field + payload
+// payload is a sequence of entries:
+//   uint8 cmd id (meas_funct_id) | uint64 exec time [us] | uint32 tag (0 = none)
+//   | params (raw param struct, exactly params_len bytes)
+// Whole block is checked before anything is added. Answer is SCHEDBIN_OK:<num cmds>:<free queue spaces>:<free bytes>
+// or SCHEDBIN_FAIL:<reason> (nothing added). After that, FW is back in text mode.
+// The same block format is used for other binary uploads (seqload), see cmdsched_batch_receive().
+//
+// Queue is ordered by exec time, so cmds can be added in any order. Cmds with equal exec time run in the
+// order they were added. A cmd can be given a tag (-tag #n# / batch tag field). Adding a cmd with a tag that
+// is already queued replaces the queued cmd(s). schedcancel removes cmds by tag.
+//
+// Overlap check: each cmd has an estimated runtime (duration hook, calibrated from measured runtimes).
+// A new cmd is checked when it is added: it overlaps if the cmd before it (queued or armed) would still run at its
+// exec time, or if it would still run at exec time of the next queued cmd. Neighbours are found by binary search
+// in the sorted queue index, O(log n). By default this is only a debug warning. With CMDSCHED_OVERLAP_REJECT
+// (opt-in) the new cmd is rejected with SCHED_FAIL:OVERLAP (SCHEDBIN_FAIL:OVERLAP rejects the whole batch,
+// seqvm stops with SEQ_FAIL:OVERLAP), so violations are found when a sequence is uploaded.
+// Estimates use numavg/settling time/baud rate valid at the time of scheduling.
 
 #ifndef LIGHTSOAKFW_STM_CMD_SCHEDULER_H
 #define LIGHTSOAKFW_STM_CMD_SCHEDULER_H
@@ -14,32 +39,109 @@
 
 //todo: determine size
 #define CMDSCHED_PARAM_BUFF_LEN 32
-#define CMDSCHED_QUEUE_SIZE 512UL
+#define CMDSCHED_QUEUE_SIZE 2048UL  //max number of queued cmds
+//queued cmds are stored as variable length records (about 4-10 bytes + params), see cmd_scheduler.c
+#define CMDSCHED_ARENA_SIZE 20480UL
 //cmds are poped from the queue and parsed some time before execution.
-//When this happens, code waits in blocking until the time of execution.
+//When this happens, stage hook runs (precompute DAC/PWM values, arm DMA) and usec timer compare is armed
+//for the time of execution (no blocking wait).
 #define CMDSCHED_POP_BEFORE_EXEC_US 500
 #define CMDSCHED_TIME_BETWEEN_REQUESTS_US 100000  //0.1s
 
-//todo: implement a check so that cmds are scheduled after now and cronologically one after the other
+//overlap check of scheduled cmds
+#define CMDSCHED_OVERLAP_OFF 0
+#define CMDSCHED_OVERLAP_WARN 1     //only debug warning
+#define CMDSCHED_OVERLAP_REJECT 2   //SCHED_FAIL:OVERLAP
+#define CMDSCHED_OVERLAP_CHECK CMDSCHED_OVERLAP_WARN
+#define CMDSCHED_OVERLAP_TOLERANCE_US 1000
+#define CMDSCHED_DUR_DEFAULT_US 200   //cmds without duration hook (reports, settings). Serial output is DMA buffered, not busy time
+#define CMDSCHED_DUR_SCALE_MIN 0.25f  //limits of calibrated correction of duration estimate
+#define CMDSCHED_DUR_SCALE_MAX 8.0f
+
+//binary batch upload
+#define CMDSCHED_BATCH_MAGIC0 0xA5
+#define CMDSCHED_BATCH_MAGIC1 0x5A
+#define CMDSCHED_BATCH_BUFF_LEN 2048  //max payload length
+#define CMDSCHED_BATCH_TIMEOUT_MS 1000
+#define CMDSCHED_BATCH_ENTRY_HEADER_LEN 13  //cmd id + exec time + tag
+
+#define CMDSCHED_NO_TAG 0
+#define CMDSCHED_NO_REQ_ID MAINSER_NO_RESP_ID
+
+//cmdsched_add() return values
+#define CMDSCHED_ADD_OK 0
+#define CMDSCHED_ADD_UNKNOWN -1
+#define CMDSCHED_ADD_OVERLAP -2
+#define CMDSCHED_ADD_FULL -3
 
 typedef struct {
     meas_funct_id cmd_id;
     uint64_t exec_time;
+    uint32_t tag;   //host assigned, for cancel/replace
+    uint32_t req_id;  //host request id (-id), prefixed to output of cmd
     uint8_t params_buff[CMDSCHED_PARAM_BUFF_LEN];
 } cmd_sched_t;
 
+typedef void (*cmdsched_hook_fn)(const void *params);
+typedef uint32_t (*cmdsched_duration_fn)(const void *params);
+//processes received binary block. Prints its own OK answer, returns NULL on success or fail reason (static string)
+typedef const char* (*cmdsched_batch_fn)(const uint8_t *payload, uint32_t len);
+
+/**
+ * @brief scheduled cmd descriptor (one per cmd id). See prv_cmdsched_cmd_table
+ */
+typedef struct {
+    uint8_t params_len;
+    cmdsched_hook_fn stage;
+    cmdsched_hook_fn trigger;
+    cmdsched_hook_fn exec;
+    cmdsched_duration_fn duration;
+} cmdsched_cmd_desc_t;
+
+//param size for descriptor table. Fails to compile if param struct does not fit in params_buff
+#define CMDSCHED_PARAMS(type) (sizeof(type) + 0 * sizeof(char[(sizeof(type) <= CMDSCHED_PARAM_BUFF_LEN) ? 1 : -1]))
+#define CMDSCHED_NO_PARAMS 0
+
+//lateness statistics of scheduled cmds
+typedef struct {
+    uint32_t num;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+} cmdsched_jitter_t;
 
-//scheduled cmd queue functions
+//scheduled cmd queue functions (sorted by exec_time)
 uint32_t cmdsched_q_count();
 cmd_sched_t cmdsched_q_pop();
-void cmdsched_q_push(cmd_sched_t item);
+int8_t cmdsched_q_push(cmd_sched_t item);
 uint32_t cmdsched_q_free_spaces();
+uint32_t cmdsched_q_free_bytes();
+void cmdsched_print_stats(void);
+void cmdsched_print_duration_scales(void);
+uint32_t cmdsched_estimate_duration(meas_funct_id cmd_id, const void *params);
 // ------
 
+void cmdsched_set_next_tag(uint32_t tag);
+void cmdsched_set_next_req_id(uint32_t req_id);
+uint32_t cmdsched_cancel(uint32_t tag);
+
 int8_t cmdsched_encode_and_add(uint64_t exec_time, meas_funct_id cmd_id, void *params, uint8_t params_len);
+int8_t cmdsched_add(uint64_t exec_time, meas_funct_id cmd_id, uint32_t tag, const void *params);
+int16_t cmdsched_get_params_len(meas_funct_id cmd_id);
+uint64_t cmdsched_next_exec_time(void);
 
 void cmdsched_decode(cmd_sched_t cmd, void *params, uint8_t params_len);
 
+void cmdsched_batch_start(void);
+void cmdsched_batch_receive(const char *name, cmdsched_batch_fn process);
+uint8_t cmdsched_batch_is_receiving(void);
+void cmdsched_batch_handler(void);
+
+void cmdsched_start();
 uint64_t cmdsched_handler(void);
+uint8_t cmdsched_is_armed(void);
+
+void cmdsched_print_jitter(void);
+void cmdsched_reset_jitter(void);
 
 #endif //LIGHTSOAKFW_STM_CMD_SCHEDULER_H
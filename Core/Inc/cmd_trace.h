@@ -0,0 +1,38 @@
+//
+// cmd_trace.h
+//
+// Timing trace of executed cmds.
+// Every executed scheduled cmd (and every cmd line executed from CLI) is recorded into a RAM ring:
+// planned start time, how late it actually started and how long it took.
+// Lateness histogram and per cmd id statistics are kept since boot (or last reset), the ring keeps last
+// CMDTRACE_RING_SIZE records for detailed dump.
+// Start of scheduled cmd is the compare interrupt (if cmd has a trigger hook) or start of exec hook.
+
+#ifndef LIGHTSOAKFW_STM_CMD_TRACE_H
+#define LIGHTSOAKFW_STM_CMD_TRACE_H
+
+#include <stdint.h>
+#include "measurements.h"
+
+#define CMDTRACE_RING_SIZE 256  //must be power of 2
+//lateness histogram bins: 0us, then [2^(i-1), 2^i) us, last bin is everything above
+#define CMDTRACE_HIST_BINS 16
+//id used for cmds executed immediately from CLI (no planned time, only duration is meaningful)
+#define CMDTRACE_ID_CLI meas_funct_id_count
+#define CMDTRACE_NUM_IDS (meas_funct_id_count + 1)
+
+typedef struct {
+    uint64_t planned;       //exec_time of scheduled cmd, time cmd line was received for CLI cmds
+    uint32_t start_late_us;
+    uint32_t exec_late_us;  //start of main loop part
+    uint32_t duration_us;   //main loop part
+    uint8_t cmd_id;
+} cmdtrace_record_t;
+
+void cmdtrace_record(uint8_t cmd_id, uint64_t planned, uint64_t start, uint64_t exec_start, uint64_t end);
+void cmdtrace_print_hist(void);
+void cmdtrace_print_worst(void);
+void cmdtrace_dump(void);
+void cmdtrace_reset(void);
+
+#endif //LIGHTSOAKFW_STM_CMD_TRACE_H
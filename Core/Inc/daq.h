@@ -33,6 +33,10 @@
 #define DAQ_SAMPLE_TIMER_HANDLE &htim20
 #define DAQ_SAMPLE_TIMER_PERIOD_100KSPS 1699
 #define DAQ_SAMPLE_TIME_100KSPS 10 //us
+//max sample time divider (16 bit repetition counter)
+#define DAQ_SAMPLE_DIV_MAX 65536
+//sampling timer can be started by hardware: internal trigger ITR1 of TIM20 is TIM2 TRGO (LED pulse edges)
+#define DAQ_SAMPLE_TIMER_TRIGGER TIM_TS_ITR1
 #define DAQ_VOLT_ADC ADC1
 #define DAQ_CURR_ADC ADC3
 #define DAQ_VOLT_ADC_HANDLE &hadc1
@@ -121,6 +125,14 @@ extern volatile uint64_t daq_sampling_curr_done_timestamp;
 void daq_init(void);
 void daq_prepare_for_sampling(uint32_t num_samples);
 void daq_start_sampling(void);
+void daq_start_sampling_on_trigger(void);
+void daq_release_trigger(void);
+void daq_set_start_delay(uint32_t delay_ticks);
+void daq_start_sampling_running(uint32_t num_samples);
+void daq_set_sample_divider(uint32_t div);
+uint32_t daq_get_sample_time_us(void);
+uint32_t daq_get_num_samples_taken(void);
+void daq_stop_sampling(void);
 uint8_t daq_is_sampling_done(void);
 void daq_calibrate_adcs(void);
 
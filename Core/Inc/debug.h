@@ -9,11 +9,21 @@
 // 4. Call dbg() function with message level and message (use like printf)
 //      example: dbg(Error, "This is an error message. Value: %d\n", 404);
 //      level can be: Error, Warning, Debug
+// 5. Call dbg_handler() from the main loop when there is time to spare.
 //
 //
-// Note: debug messages are sent out using DMA, so they don't block the CPU. However,
-// if dbg() is called again before the previous message is fully transferred, dbg() waits
-// (blocking mode) for the previous message to finish transferring before sending the new one.
+// Note: dbg() does not format or transmit anything. It only stores a small record (format string
+// pointer, timestamp and raw arguments) into a ring buffer, which takes a few us. dbg_handler()
+// formats the stored records and sends them out using DMA, but only if the UART is free (never blocks).
+// If the ring is full, new records are dropped and counted. The count is reported with the next message.
+// Levels above DEBUG_LEVEL are removed at compile time (arguments are not even evaluated).
+//
+// Limitations of deferred formatting:
+// - %s (and %p) arguments are stored as pointers, so they must point to strings that are still valid
+//   when dbg_handler() runs (string literals, static buffers). Don't pass stack buffers.
+// - at most DEBUG_MAX_ARG_WORDS 32bit words of arguments per message (64bit ints and floats take 2).
+//   Conversions that don't fit are printed as "?".
+// - dbg_flush() sends everything out in blocking mode. Use it before reset/hang (assert, fault...).
 
 //
 #ifndef DEBUG_H
@@ -21,6 +31,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 
 // Define the debug levels
 #define DBG_NONE    0
@@ -35,6 +46,12 @@
 #define DEBUG_UART_HANDLE &hlpuart1
 //set the buffer size here
 #define DEBUG_BUFFER_SIZE 256
+//number of records in deferred ring (must be power of 2)
+#define DEBUG_RING_SIZE 32
+//max number of 32bit argument words per record
+#define DEBUG_MAX_ARG_WORDS 8
+//main loop runs dbg_handler() (as background task) only if next scheduled cmd is at least this far away
+#define DEBUG_HANDLER_MIN_IDLE_US 2000
 // ############################ END USER PARAMETERS ###########################
 
 
@@ -51,6 +68,30 @@ typedef enum {
     Debug
 } DebugLevel;
 
-void dbg(DebugLevel level, const char* format, ...);
+//compile time level filtering. Filtered levels keep the call in a branch that is never taken: nothing is evaluated
+//or emitted, but arguments still count as used (no unused variable warnings)
+#if DEBUG_LEVEL >= DBG_ERROR
+#define DBG_IF_Error(x) x
+#else
+#define DBG_IF_Error(x) ((void)(0 ? (x) : (void)0))
+#endif
+#if DEBUG_LEVEL >= DBG_WARNING
+#define DBG_IF_Warning(x) x
+#else
+#define DBG_IF_Warning(x) ((void)(0 ? (x) : (void)0))
+#endif
+#if DEBUG_LEVEL >= DBG_ALL
+#define DBG_IF_Debug(x) x
+#else
+#define DBG_IF_Debug(x) ((void)(0 ? (x) : (void)0))
+#endif
+
+#define dbg(level, ...) DBG_IF_##level(dbg_push(level, __VA_ARGS__))
+
+extern volatile uint32_t g_dbg_dropped_count;
+
+void dbg_push(DebugLevel level, const char* format, ...);
+void dbg_handler(void);
+void dbg_flush(void);
 
 #endif //DEBUG_H
@@ -89,6 +89,8 @@ void fec_set_shunt_1000x(uint8_t channel);
 void fec_enable_current(uint8_t channel);
 void fec_disable_current(uint8_t channel);
 void fec_set_force_voltage(uint8_t channel, float voltage);
+int8_t fec_stage_force_voltage(uint8_t channel, float voltage);
+void fec_apply_staged_force_voltage(void);
 float fec_get_shunt_resistance(uint8_t channel);
 
 void fec_report_shunt_ranges_dbg(void);
@@ -14,6 +14,7 @@
 #include "tim.h"
 #include "micro_sec.h"
 #include "daq.h"
+#include "led_control.h"
 
 
 //void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim);
@@ -29,14 +29,72 @@
 #define LED_PER_DEG_TEMP_COEFF (-0.0028f)
 //#define LED_PER_DEG_TEMP_COEFF (-0.0f)
 
+//Illumination to DAC lookup table, built from calibration. Illumination grid is quadratic (index ~ sqrt(illum)),
+//so it is dense at low light where the low range polynomial is used. LED temperature is interpolated between
+//temperature points (compensation is linear in temperature). Entries are DAC codes << LEDCTRL_LUT_CODE_FRAC_BITS,
+//not clamped to max current (interpolation stays linear near it), result is clamped.
+#define LEDCTRL_LUT_NUM_ILLUM 257
+#define LEDCTRL_LUT_NUM_TEMP 5
+#define LEDCTRL_LUT_TEMP_MIN 0.0f
+#define LEDCTRL_LUT_TEMP_STEP 20.0f
+#define LEDCTRL_LUT_FRAC_BITS 8
+#define LEDCTRL_LUT_CODE_FRAC_BITS 3
+//table covers illumination up to this x illumination at max current (linear estimate), higher is clamped
+#define LEDCTRL_LUT_ILLUM_MARGIN 1.25f
+
+//Intra-pulse droop: LED junction heats during a flash and light output drops faster than the temperature sensor
+//can follow. First order thermal model, t from LED on:
+//  light(t) / light(0) = 1 - droop * illum * (1 - exp(-t / tau))
+//droop is the settled relative drop per sun (heating ~ LED current ~ illum). Pre-emphasized flashes (LED waveform)
+//set illum / that, so light stays flat. Model is measured with leddroopcal, droop 0 disables pre-emphasis.
+#define LEDCTRL_DROOP_DEF_TAU_US 1000.0f
+//pre-emphasis is at most this x illumination
+#define LEDCTRL_DROOP_MAX_GAIN 1.5f
+
 #define LEDCTRL_PERIODIC_TEMP_REPORT_MAINSER 0
 #define LEDCTRL_TEMP_READ_TIME_US 100000
 
+//Timer driven LED pulses (flash measurements). Edges are compare matches of usec timer (TIM2) CH2.
+//OC2REF goes high on match and is TIM2 TRGO, which loads DAC value (DAC trigger T2_TRGO) and can start
+//ADC sampling timer (TIM20 trigger mode). Edge timing does not depend on interrupt latency or CPU,
+//interrupt of each edge only prepares the next one.
+#define LEDCTRL_PULSE_TIM_HANDLE &MICRO_SEC_TIM_HANDLE
+#define LEDCTRL_PULSE_CHANNEL TIM_CHANNEL_2
+#define LEDCTRL_PULSE_ACTIVE_CHANNEL HAL_TIM_ACTIVE_CHANNEL_2
+#define LEDCTRL_PULSE_IT TIM_IT_CC2
+#define LEDCTRL_PULSE_FLAG TIM_FLAG_CC2
+#define LEDCTRL_PULSE_MAX_EDGES 4
+//first edge is this long after ledctrl_pulse_start()
+#define LEDCTRL_PULSE_LEAD_US 3
+//next edge is prepared in interrupt of previous one, so they can't be closer
+#define LEDCTRL_PULSE_MIN_GAP_US 5
+
+typedef struct {
+    uint32_t offset_us;   //from first edge
+    uint32_t dac_raw;     //DAC value from this edge on
+    uint8_t adc_start;    //start DAQ sampling at this edge (daq_prepare_for_sampling() before)
+} ledctrl_pulse_edge_t;
+
 void ledctrl_init(void);
 void ledctrl_set_dac_raw(uint32_t dac_value);
 uint32_t ledctrl_get_raw_from_current(float current);
+uint32_t ledctrl_get_raw_from_illum(float illum);
 void ledctrl_set_current_tempcomp(float current);
 void ledctrl_set_illum(float illum);
+void ledctrl_set_illum_noprint(float illum);
+void ledctrl_print_illum(float illum, uint64_t timestamp);
+void ledctrl_stage_current(float current);
+void ledctrl_stage_illum(float illum);
+void ledctrl_apply_staged(void);
+
+void ledctrl_pulse_stage(const ledctrl_pulse_edge_t *edges, uint8_t num_edges);
+void ledctrl_pulse_start(void);
+void ledctrl_pulse_start_at(uint32_t t0);
+uint8_t ledctrl_pulse_is_done(void);
+uint32_t ledctrl_pulse_get_start(void);
+void ledctrl_pulse_finish(void);
+uint32_t ledctrl_pulse_end_now(void);
+void prv_ledctrl_pulse_callback(void);
 
 float ledctrl_get_temperature(void);
 void ledctrl_print_temperature_mainser(void);
@@ -46,6 +104,12 @@ float ledctrl_compensate_current_for_temp(float current);
 void ledctrl_calibrate_illum_curr(float illum, float current, float a, float b, float c);
 void ledctrl_calibrate_illum_curr_low(float a, float b, float c);
 
+void ledctrl_set_droop_model(float droop_per_sun, float tau_us);
+float ledctrl_get_droop_per_sun(void);
+float ledctrl_get_droop_tau_us(void);
+float ledctrl_droop_precomp(float illum, float t_us);
+void ledctrl_print_droop_model(void);
+
 void ledctrl_handler(void);
 
 
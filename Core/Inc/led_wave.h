@@ -0,0 +1,45 @@
+//
+// led_wave.h
+//
+// LED illumination waveforms (ramps, staircases, modulated light).
+// A table of DAC codes is built on device from segments (step, droop compensated flash, ramp, sine, PWM train), each appended to the end
+// of the table. It is played by DMA: every update of the DAQ sample timer (TIM20) requests one DMA transfer that
+// writes the next code to the DAC data register. The same update triggers ADC conversion, so point n is set
+// exactly when sample n is taken, with no CPU load during playback.
+// One point per sample time (LEDWAVE_POINT_TIME_US, longer with daq_set_sample_divider()). Table fits DAQ buffer, so a whole pass can be sampled.
+// DAC codes are computed when a segment is added (LED calibration and temperature at that time).
+// While playing, DAC belongs to the waveform: temperature compensation is paused and other LED cmds are
+// overwritten by the next point. When playback ends (or is stopped) LED is set to illumination of the last point.
+
+#ifndef LIGHTSOAKFW_STM_LED_WAVE_H
+#define LIGHTSOAKFW_STM_LED_WAVE_H
+
+#include <stdint.h>
+#include "daq.h"
+
+#define LEDWAVE_MAX_POINTS (DAQ_BUFF_SIZE / DAQ_NUM_CH)
+#define LEDWAVE_POINT_TIME_US DAQ_SAMPLE_TIME_100KSPS
+//DMA channel linked to sample timer update request (tim.c)
+#define LEDWAVE_DMA_HANDLE ((DAQ_SAMPLE_TIMER_HANDLE)->hdma[TIM_DMA_ID_UPDATE])
+#define LEDWAVE_DAC_REG (&DAC1->DHR12R1)
+//droop compensated flash: model is evaluated every this many points, codes in between are interpolated
+#define LEDWAVE_FLASH_KNOT_POINTS 10
+
+void ledwave_clear(void);
+int8_t ledwave_add_step(float illum, uint32_t dur_us);
+int8_t ledwave_add_flash(float illum, uint32_t dur_us);
+int8_t ledwave_add_ramp(float illum, uint32_t dur_us);
+int8_t ledwave_add_sine(float offset, float amplitude, float freq_hz, uint32_t dur_us);
+int8_t ledwave_add_sine_cycles(float offset, float amplitude, uint32_t num_points, uint32_t num_cycles);
+int8_t ledwave_add_pwm(float illum_high, float illum_low, uint32_t period_us, float duty, uint32_t dur_us);
+uint32_t ledwave_get_num_points(void);
+uint32_t ledwave_get_next_point(void);
+int8_t ledwave_arm(uint8_t loop);
+void ledwave_start(void);
+uint64_t ledwave_get_start_timestamp(void);
+uint8_t ledwave_is_playing(void);
+void ledwave_stop(void);
+void ledwave_handler(void);
+void ledwave_print_status(void);
+
+#endif //LIGHTSOAKFW_STM_LED_WAVE_H
@@ -105,6 +105,7 @@ typedef struct lwshell {
     size_t buff_ptr;                          /*!< Buffer pointer for input */
     int32_t argc;                             /*!< Number of arguments parsed in command */
     char* argv[LWSHELL_CFG_MAX_CMD_ARGS];     /*!< Array of pointers to all arguments */
+    int32_t cmd_result;                       /*!< Return value of last command, `-1` if command is unknown */
 
 #if LWSHELL_CFG_USE_DYNAMIC_COMMANDS || __DOXYGEN__
     lwshell_cmd_t dynamic_cmds[LWSHELL_CFG_MAX_DYNAMIC_CMDS]; /*!< Shell registered dynamic commands */
@@ -114,6 +115,8 @@ typedef struct lwshell {
 #if LWSHELL_CFG_USE_STATIC_COMMANDS || __DOXYGEN__
     const lwshell_cmd_t* static_cmds; /*!< Pointer to an array of static commands */
     size_t static_cmds_cnt;           /*!< Length of status commands array */
+    uint8_t static_cmds_hash[LWSHELL_CFG_STATIC_CMDS_HASH_SIZE]; /*!< Index+1 of command by name hash, 0 if empty */
+    uint8_t static_cmds_hashed;       /*!< `1` if all commands are in hash index */
 #endif                                /* LWSHELL_CFG_USE_STATIC_COMMANDS || __DOXYGEN__ */
 } lwshell_t;
 
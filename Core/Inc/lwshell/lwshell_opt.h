@@ -77,6 +77,18 @@ extern "C" {
 #define LWSHELL_CFG_USE_STATIC_COMMANDS 0
 #endif
 
+/**
+ * \brief           Size of hash index of static commands (power of `2`, max `256`).
+ *
+ * Commands are looked up by hash of their name instead of comparing with every command.
+ * Should be at least twice the number of static commands. If it's too small, linear search is used.
+ *
+ * \note            Used only when \ref LWSHELL_CFG_USE_STATIC_COMMANDS is enabled
+ */
+#ifndef LWSHELL_CFG_STATIC_CMDS_HASH_SIZE
+#define LWSHELL_CFG_STATIC_CMDS_HASH_SIZE 128
+#endif
+
 /**
  * \brief           Maximum number of different dynamic registered commands
  * 
@@ -49,6 +49,9 @@
 
 #define LWSHELL_CFG_USE_LIST_CMD 1
 #define LWSHELL_CFG_MAX_CMD_ARGS 16
-#define LWSHELL_CFG_MAX_CMDS 32
+//cmds are registered as one static table (cmd_line_support.c) and looked up by name hash
+#define LWSHELL_CFG_USE_DYNAMIC_COMMANDS 0
+#define LWSHELL_CFG_USE_STATIC_COMMANDS 1
+#define LWSHELL_CFG_STATIC_CMDS_HASH_SIZE 128
 
 #endif /* LWSHELL_OPTS_HDR_H */
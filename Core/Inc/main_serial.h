@@ -16,6 +16,9 @@
 
 #define MAINSER_DEFAULT_BAUD 230400
 
+//while a response id is set, every line sent to main serial starts with "#<id>:" (host request id, see -id)
+#define MAINSER_NO_RESP_ID 0
+
 
 extern volatile uint8_t mainser_rx_buffer[RX_BUFFER_SIZE];
 extern volatile uint8_t mainser_tx_buffer[TX_BUFFER_SIZE];
@@ -33,5 +36,8 @@ uint32_t mainser_available(void);
 uint32_t mainser_tx_space(void);
 void mainser_send_string(const char* str);
 void mainser_set_baudrate(uint32_t baudrate);
+uint32_t mainser_get_baudrate(void);
+void mainser_set_resp_id(uint32_t id);
+uint32_t mainser_get_resp_id(void);
 
 #endif //LIGHTSOAKFW_STM_MAIN_SERIAL_H
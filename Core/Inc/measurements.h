@@ -29,6 +29,38 @@
 #define MEAS_FORCE_VOLT_ITER_MAX 10
 //sampling for MEAS_FLASH_DUMP_SAMPLEBORDER_US before and after led is turned on and off
 #define MEAS_FLASH_DUMP_SAMPLEBORDER_US 2000
+//flash burst: sum of dumps of all flashes (one channel or all 6). Length of one flash dump x channels must fit
+#define MEAS_FLASH_BURST_BUFF_SIZE 3000
+//dark time after flash window is at least this (accumulating and preparing next flash)
+#define MEAS_FLASH_BURST_MIN_DARK_US 1000
+//equivalent-time capture: sampling before LED on and after LED off, max phases (sample time / phases is the resolution)
+#define MEAS_FLASH_ETS_BORDER_US 50
+#define MEAS_FLASH_ETS_MAX_PHASES 100
+//adaptive flash: Voc is averaged over windows of this many samples, settled when two windows differ less than tolerance
+#define MEAS_FLASH_ADAPT_WINDOW_SAMPLES 10
+#define MEAS_FLASH_ADAPT_DEF_TOL_V 0.001f
+//lock-in sweep: max frequency is sample rate / min points per period. Channels are converted in turn after the
+//sample trigger (4x oversampled), each takes MEAS_LOCKIN_CH_CONV_TIME_US (phase correction). Counters are read
+//after the ADC scan, at this sample timer value
+#define MEAS_LOCKIN_MIN_POINTS_PER_PERIOD 10
+#define MEAS_LOCKIN_MAX_FREQS 200
+#define MEAS_LOCKIN_DEF_SETTLE_PERIODS 5
+#define MEAS_LOCKIN_CH_CONV_TIME_US 1.41f
+#define MEAS_LOCKIN_SNAPSHOT_TICKS (DAQ_SAMPLE_TIMER_PERIOD_100KSPS * 9 / 10)
+//Suns-Voc: max steps, min samples per step (settled Voc is the second half). Ideality is for DUT at this temperature
+#define MEAS_SUNSVOC_MAX_STEPS 100
+#define MEAS_SUNSVOC_MIN_STEP_POINTS 4
+#define MEAS_SUNSVOC_DEF_STEPS 10
+#define MEAS_SUNSVOC_DEF_STEP_US 1000
+#define MEAS_SUNSVOC_DUT_TEMP_C 25.0f
+#define MEAS_SUNSVOC_BOLTZMANN_EV 8.617333e-5f //k/q in V/K
+//LED droop calibration: DUT Isc during a plain flash, sampled from MEAS_LEDDROOP_BORDER_US before to after it.
+//LED and DUT response (MEAS_LEDDROOP_SKIP_US) is skipped before fitting
+#define MEAS_LEDDROOP_BORDER_US 500
+#define MEAS_LEDDROOP_SKIP_US 100
+#define MEAS_LEDDROOP_MIN_WINDOW_SAMPLES 4
+#define MEAS_LEDDROOP_DEF_ILLUM 1.0f
+#define MEAS_LEDDROOP_DEF_DUR_US 15000
 
 #define NOISE_MEASURE_NUMSAMPLES 2000
 
@@ -104,6 +136,44 @@ void meas_get_iv_characteristic(uint8_t channel, float start_volt, float end_vol
 //call with 0 for all channels
 void meas_flashmeasure_singlesample(uint8_t channel, float illum, uint32_t flash_dur_us, uint32_t measure_at_us, uint32_t numavg);
 void meas_flashmeasure_dumpbuffer(uint8_t channel, float illum, uint32_t flash_dur_us);
+//split flash measurement for exact-time scheduling: stage ahead of time, trigger at exec time (from interrupt), then finish
+//LED edges and sampling start are timer driven (ledctrl_pulse_*), staged with the flash timing
+void meas_flashmeasure_singlesample_stage(float illum, uint32_t flash_dur_us, uint32_t measure_at_us, uint32_t numavg);
+void meas_flashmeasure_singlesample_trigger(void);
+void meas_flashmeasure_singlesample_finish(uint8_t channel, uint32_t numavg);
+void meas_flashmeasure_dumpbuffer_stage(float illum, uint32_t flash_dur_us);
+void meas_flashmeasure_dumpbuffer_trigger(void);
+void meas_flashmeasure_dumpbuffer_finish(uint8_t channel);
+//N flashes, voltage dumps summed on device, one averaged dump at the end
+int8_t meas_flashmeasure_burst(uint8_t channel, float illum, uint32_t flash_dur_us, uint32_t num_flashes, uint32_t period_us);
+int8_t meas_flashmeasure_burst_stage(uint8_t channel, float illum, uint32_t flash_dur_us, uint32_t num_flashes, uint32_t period_us);
+void meas_flashmeasure_burst_finish(void);
+//equivalent-time capture: burst with sampling phase shifted by a fraction of sample time, interleaved dump
+int8_t meas_flashmeasure_ets(uint8_t channel, float illum, uint32_t flash_dur_us, uint32_t num_phases, uint32_t num_flashes, uint32_t period_us);
+int8_t meas_flashmeasure_ets_stage(uint8_t channel, float illum, uint32_t flash_dur_us, uint32_t num_phases, uint32_t num_flashes, uint32_t period_us);
+//adaptive flash: LED is switched off as soon as Voc settles (max. flash_dur_us)
+int8_t meas_flashmeasure_adaptive(uint8_t channel, float illum, uint32_t max_dur_us, float tol_v);
+int8_t meas_flashmeasure_adaptive_stage(float illum, uint32_t max_dur_us);
+void meas_flashmeasure_adaptive_finish(uint8_t channel, float illum, float tol_v);
+//LED waveform playback (waveform is built with led_wave.h)
+int8_t meas_wave_play(uint8_t channel, uint8_t loop, uint8_t dump);
+int8_t meas_wave_play_stage(uint8_t loop, uint8_t dump);
+void meas_wave_play_trigger(uint8_t dump);
+void meas_wave_play_finish(uint8_t channel, uint8_t loop, uint8_t dump);
+//lock-in (IMVS/IMPS) frequency sweep, demodulated on device
+int8_t meas_lockin_sweep(uint8_t channel, uint8_t curr, float bias, float amp, float f_start, float f_stop,
+                         uint32_t num_freq, uint32_t settle_periods, uint32_t num_avg);
+//Suns-Voc: log spaced illumination staircase, settled Voc per step, slope and ideality
+int8_t meas_sunsvoc(uint8_t channel, float illum_min, float illum_max, uint32_t num_steps, uint32_t step_us);
+int8_t meas_sunsvoc_stage(float illum_min, float illum_max, uint32_t num_steps, uint32_t step_us);
+void meas_sunsvoc_trigger(void);
+void meas_sunsvoc_finish(uint8_t channel, float illum_min, float illum_max, uint32_t num_steps);
+//flat flash: dump of flash pre-emphasized for LED droop (LED waveform), and calibration of the droop model
+int8_t meas_flashmeasure_flat(uint8_t channel, float illum, uint32_t flash_dur_us);
+int8_t meas_flashmeasure_flat_stage(float illum, uint32_t flash_dur_us);
+void meas_flashmeasure_flat_trigger(void);
+void meas_flashmeasure_flat_finish(uint8_t channel);
+int8_t meas_led_droop_calibrate(uint8_t channel, float illum, uint32_t flash_dur_us);
 
 
 //checks sample for over/under range, reports to main serial
@@ -133,6 +203,13 @@ void prv_meas_print_data_ident_IV_characteristic(void);
 void prv_meas_print_data_ident_MPP(void);
 void prv_meas_print_data_ident_flashmeasure_single(void);
 void prv_meas_print_data_ident_flashmeasure_dump(void);
+void prv_meas_print_data_ident_flashmeasure_burst(void);
+void prv_meas_print_data_ident_flashmeasure_ets(void);
+void prv_meas_print_data_ident_flashmeasure_adaptive(void);
+void prv_meas_print_data_ident_sunsvoc(void);
+void prv_meas_print_data_ident_flashmeasure_flat(void);
+void prv_meas_print_data_ident_led_droop_cal(void);
+void prv_meas_print_data_ident_wave(void);
 void prv_meas_print_dump_end(void);
 void prv_meas_print_sample(t_daq_sample_convd sample, uint8_t channel);
 void prv_meas_print_IV_point_ts(t_daq_sample_convd sample_volt, t_daq_sample_convd sample_curr, uint8_t channel, uint8_t channel_mask);
@@ -211,6 +288,62 @@ typedef struct{
     uint32_t numavg;
 } meas_flashmeasure_singlesample_param_t;
 
+//meas_flashmeasure_burst
+typedef struct{
+    uint8_t channel;
+    float illum;
+    uint32_t flash_dur_us;
+    uint32_t num_flashes;
+    uint32_t period_us;
+} meas_flashmeasure_burst_param_t;
+
+//meas_flashmeasure_ets
+typedef struct{
+    uint8_t channel;
+    float illum;
+    uint32_t flash_dur_us;
+    uint32_t num_phases;
+    uint32_t num_flashes;
+    uint32_t period_us;
+} meas_flashmeasure_ets_param_t;
+
+//meas_flashmeasure_adaptive
+typedef struct{
+    uint8_t channel;
+    float illum;
+    uint32_t max_dur_us;
+    float tol_v;
+} meas_flashmeasure_adaptive_param_t;
+
+//meas_wave_play
+typedef struct{
+    uint8_t channel;
+    uint8_t loop;
+    uint8_t dump;
+} meas_wave_play_param_t;
+
+//meas_lockin_sweep
+typedef struct{
+    uint8_t channel;
+    uint8_t curr;
+    float bias;
+    float amp;
+    float f_start;
+    float f_stop;
+    uint32_t num_freq;
+    uint32_t settle_periods;
+    uint32_t num_avg;
+} meas_lockin_sweep_param_t;
+
+//meas_sunsvoc
+typedef struct{
+    uint8_t channel;
+    float illum_min;
+    float illum_max;
+    uint32_t num_steps;
+    uint32_t step_us;
+} meas_sunsvoc_param_t;
+
 //fec_enable/disable_current
 typedef struct{
     uint8_t channel;
@@ -292,7 +425,15 @@ typedef enum {
     meas_get_numavg_id,
     meas_set_settle_time_id,
     meas_get_settle_time_id,
-    meas_get_noise_id
+    meas_get_noise_id,
+    meas_flashmeasure_burst_id,
+    meas_flashmeasure_ets_id,
+    meas_flashmeasure_adaptive_id,
+    meas_wave_play_id,
+    meas_lockin_sweep_id,
+    meas_sunsvoc_id,
+    meas_flashmeasure_flat_id,
+    meas_funct_id_count   //keep last
 } meas_funct_id;
 
 
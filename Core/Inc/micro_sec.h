@@ -7,6 +7,7 @@
  * such as: delay, get timestamp, schedule interrupt...
  * Uses a 32bit timer at 170Mhz clock with 169 divider -> 1 tick per 1us. Overflows in 1.2ish hours.
  * Some overflow-corrected functions are provided (to generate absoulute 64bit timestamps). Warning: use wisely.
+ * 64bit timestamp is read without disabling interrupts, so it can be polled in busy loops.
  * 64bit timestamp is good for 584942 years of on-time. Good enough
  */
 
@@ -15,8 +16,16 @@
 
 #include "stm32g4xx_hal.h"
 #include "tim.h"
+#include "micro_sec_ts64.h"
 
 #define MICRO_SEC_TIM_HANDLE htim2
+//compare channel used to call a function at exact timestamp (from interrupt)
+#define USEC_COMPARE_CHANNEL TIM_CHANNEL_1
+#define USEC_COMPARE_ACTIVE_CHANNEL HAL_TIM_ACTIVE_CHANNEL_1
+#define USEC_COMPARE_IT TIM_IT_CC1
+#define USEC_COMPARE_FLAG TIM_FLAG_CC1
+//compare uses 32bit counter match, so it can only be armed this far ahead
+#define USEC_COMPARE_MAX_AHEAD_US 0x7FFFFFFFUL
 
 extern volatile uint32_t g_usec_overflow_count;
 
@@ -27,8 +36,12 @@ void usec_reset_timestamp(void);
 
 uint64_t usec_get_timestamp_64(void);
 uint32_t usec_get_overflow_count(void);
+uint64_t usec_get_reset_offset(void);
+
+int8_t usec_compare_arm(uint64_t timestamp, void (*callback)(void));
 
 void prv_usec_overflow_callback(void);
+void prv_usec_compare_callback(void);
 
 
 
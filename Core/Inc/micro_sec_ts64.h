@@ -0,0 +1,40 @@
+//
+// micro_sec_ts64.h
+//
+// 64bit timestamp from 32bit usec counter and overflow count. No HAL dependency, so the lock-free read can be
+// tested on host (Tests/test_micro_sec.c).
+//
+
+#ifndef LIGHTSOAKFW_STM_MICRO_SEC_TS64_H
+#define LIGHTSOAKFW_STM_MICRO_SEC_TS64_H
+
+#include <stdint.h>
+
+/**
+ * @brief reads 64bit timestamp without disabling interrupts. Retries if overflow interrupt ran in between.
+ * Overflow that is not counted yet (interrupt pending or interrupts disabled) is detected from update flag.
+ * @param ovf_count overflow counter incremented by update interrupt
+ * @param get_counter returns 32bit timer counter
+ * @param get_pending returns nonzero if update (overflow) flag is set
+ */
+static inline uint64_t usec_ts64_read(volatile uint32_t *ovf_count, uint32_t (*get_counter)(void),
+                                      uint32_t (*get_pending)(void)){
+  uint32_t ovf_cnt;
+  uint32_t timestamp_32;
+  uint32_t pending;
+  do{
+    ovf_cnt = *ovf_count;
+    timestamp_32 = get_counter();
+    pending = get_pending();
+  } while(ovf_cnt != *ovf_count);
+
+  //counter wrapped but interrupt didn't count it yet. Counter read after the wrap is small,
+  //read just before it is close to max (flag may have been set between the two reads)
+  if(pending && timestamp_32 < 0x80000000UL){
+    ovf_cnt++;
+  }
+
+  return ((uint64_t)ovf_cnt << 32) | (uint64_t)timestamp_32;
+}
+
+#endif //LIGHTSOAKFW_STM_MICRO_SEC_TS64_H
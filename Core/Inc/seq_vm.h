@@ -0,0 +1,78 @@
+//
+// seq_vm.h
+//
+// On-device measurement sequences.
+// A sequence is a small bytecode program that is uploaded once (seqload) and then runs on its own
+// (seqrun), without host traffic. It has its own time cursor: WAIT moves it forward, CMD schedules a cmd
+// (same cmds and params as -sched / schedbin) at the current sequence time. Cmds are put in the scheduler
+// queue SEQVM_LEAD_US before their time, so they run with the same timing as host scheduled cmds.
+// MEASV/MEASI measure into a variable at the current sequence time (after all cmds scheduled before it ran),
+// jumps and conditionals use variables.
+//
+// Upload: "seqload", FW answers SEQLOAD_READY, then the program is sent as a binary block in the same format
+// as schedbin (see cmd_scheduler.h). Program is checked before it is accepted: SEQLOAD_OK:<len> or
+// SEQLOAD_FAIL:<reason>.
+// While running, FW prints SEQ_VAR:<n>:<value> for PRINT and SEQ_END or SEQ_FAIL:<reason>:<pc> when done.
+// REQ_SCHED_CMD is not sent while a sequence runs.
+//
+// Instructions (opcode byte, then operands, all little endian, float is IEEE754 single, addr is byte offset):
+//   END                       stop
+//   CMD   u8 id, params       schedule cmd (meas_funct_id) at sequence time, params exactly as in schedbin
+//   WAIT  u32 us              sequence time += us
+//   SYNC                      sequence time = now (if now is later)
+//   SET   u8 v, f32 x         v = x
+//   ADD   u8 v, f32 x         v += x
+//   MOV   u8 v, u8 w          v = w
+//   SUB   u8 v, u8 w          v -= w
+//   ABS   u8 v                v = |v|
+//   MEASV u8 v, u8 ch         v = voltage of ch (1-6), current numavg. Sequence time is not moved.
+//   MEASI u8 v, u8 ch         v = current of ch (1-6)
+//   JMP   u16 addr
+//   JLT   u8 v, f32 x, u16 addr   jump if v < x
+//   JGT   u8 v, f32 x, u16 addr   jump if v > x
+//   LOOP  u8 v, u16 addr      v -= 1, jump if v > 0 (v = N before the body runs it N times)
+//   PRINT u8 v                print variable to main serial
+
+#ifndef LIGHTSOAKFW_STM_SEQ_VM_H
+#define LIGHTSOAKFW_STM_SEQ_VM_H
+
+#include <stdint.h>
+#include "cmd_scheduler.h"
+
+#define SEQVM_PROG_SIZE CMDSCHED_BATCH_BUFF_LEN
+#define SEQVM_NUM_VARS 16
+//cmds are put in scheduler queue this long before their time
+#define SEQVM_LEAD_US 5000
+//first instruction runs this long after seqrun
+#define SEQVM_START_DELAY_US 10000
+//max instructions per seqvm_handler() call, so a tight loop can't stall the main loop
+#define SEQVM_MAX_STEPS 32
+
+typedef enum {
+    seqvm_op_end = 0x00,
+    seqvm_op_cmd,
+    seqvm_op_wait,
+    seqvm_op_sync,
+    seqvm_op_set,
+    seqvm_op_add,
+    seqvm_op_mov,
+    seqvm_op_sub,
+    seqvm_op_abs,
+    seqvm_op_measv,
+    seqvm_op_measi,
+    seqvm_op_jmp,
+    seqvm_op_jlt,
+    seqvm_op_jgt,
+    seqvm_op_loop,
+    seqvm_op_print,
+    seqvm_op_count
+} seqvm_op_t;
+
+const char* seqvm_load(const uint8_t *prog, uint32_t len);
+int8_t seqvm_run(void);
+void seqvm_stop(void);
+uint8_t seqvm_is_running(void);
+uint64_t seqvm_handler(void);
+void seqvm_print_status(void);
+
+#endif //LIGHTSOAKFW_STM_SEQ_VM_H
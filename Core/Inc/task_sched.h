@@ -0,0 +1,41 @@
+//
+// task_sched.h
+//
+// Cooperative scheduler for background work in the main loop (temperature, MPPT, debug output...).
+// Each task declares a period and a worst case runtime (budget). tasksch_run() gets the time left until the
+// next hard deadline (next scheduled cmd or sequence step) and only starts a due task if its budget fits
+// before it, so background work never delays a scheduled cmd. Tasks are not preempted, so budget must really
+// be the worst case. Runtime statistics (taskstat cmd) show if a task ran over budget or had to wait.
+//
+// How to add a task: write a void fn(void) that returns quickly if it has nothing to do and register it
+// with tasksch_register() before the main loop. Tasks run in the order they were registered.
+
+#ifndef LIGHTSOAKFW_STM_TASK_SCHED_H
+#define LIGHTSOAKFW_STM_TASK_SCHED_H
+
+#include <stdint.h>
+
+#define TASKSCH_MAX_TASKS 8
+
+typedef void (*tasksch_fn)(void);
+
+typedef struct {
+    const char *name;
+    tasksch_fn fn;
+    uint32_t period_us;     //0: whenever there is time
+    uint32_t budget_us;     //worst case runtime
+    uint64_t last_run;
+    //statistics
+    uint32_t runs;
+    uint32_t over_budget;   //runs that took longer than budget
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t max_delay_us;  //how long after its period a task could start
+} tasksch_task_t;
+
+int8_t tasksch_register(const char *name, tasksch_fn fn, uint32_t period_us, uint32_t budget_us);
+void tasksch_run(uint64_t time_to_deadline);
+void tasksch_print_stats(void);
+void tasksch_reset_stats(void);
+
+#endif //LIGHTSOAKFW_STM_TASK_SCHED_H
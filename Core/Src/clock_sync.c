@@ -0,0 +1,153 @@
+//
+// clock_sync.c
+//
+// See clock_sync.h for the exchange and the model.
+
+#include "clock_sync.h"
+#include "micro_sec.h"
+#include "main_serial.h"
+#include "debug.h"
+
+typedef struct {
+    uint64_t dev;     //device time since boot, middle of exchange
+    int64_t offset;   //host time - device time
+} prv_clksync_sample_t;
+
+static prv_clksync_sample_t prv_clksync_samples[CLKSYNC_NUM_SAMPLES];
+static uint32_t prv_clksync_num = 0;     //samples since reset, ring index
+static uint32_t prv_clksync_rejected = 0;
+
+//previous exchange, completed when host sends its t4
+static uint8_t prv_clksync_pending = 0;
+static uint64_t prv_clksync_t1, prv_clksync_t2, prv_clksync_t3;
+static int64_t prv_clksync_last_delay = 0;
+
+//model: host = dev + offset + drift * (dev - ref)
+static uint64_t prv_clksync_ref = 0;
+static int64_t prv_clksync_offset = 0;
+static double prv_clksync_drift = 0;
+
+
+static uint64_t prv_clksync_dev_now(void){
+  return usec_get_timestamp_64() + usec_get_reset_offset();
+}
+
+/**
+ * @brief fits model through samples. Offset at ref is the fitted value at the oldest sample.
+ */
+static void prv_clksync_fit(void){
+  uint32_t n = (prv_clksync_num < CLKSYNC_NUM_SAMPLES) ? prv_clksync_num : CLKSYNC_NUM_SAMPLES;
+  uint32_t oldest = (prv_clksync_num < CLKSYNC_NUM_SAMPLES) ? 0 : prv_clksync_num % CLKSYNC_NUM_SAMPLES;
+  const prv_clksync_sample_t *ref = &prv_clksync_samples[oldest];
+  uint64_t span = 0;
+  //relative values, so doubles keep us precision
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for(uint32_t i = 0; i < n; i++){
+    const prv_clksync_sample_t *smp = &prv_clksync_samples[i];
+    double x = (double)(int64_t)(smp->dev - ref->dev);
+    double y = (double)(smp->offset - ref->offset);
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+    if(smp->dev - ref->dev > span) span = smp->dev - ref->dev;
+  }
+
+  prv_clksync_ref = ref->dev;
+  if(n < 2 || span < CLKSYNC_MIN_DRIFT_SPAN_US){
+    //offset only, average of samples
+    prv_clksync_drift = 0;
+    prv_clksync_offset = ref->offset + (int64_t)(sy / n);
+    return;
+  }
+  double drift = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+  prv_clksync_drift = drift;
+  prv_clksync_offset = ref->offset + (int64_t)((sy - drift * sx) / n);
+}
+
+/**
+ * @brief one sync exchange. Answers TIMESYNC:<t1>:<t2>:<t3>.
+ * @param t1 host time when host sent this request
+ * @param has_t4 t4 of previous exchange is given
+ * @param t4 host time when host received answer of previous exchange
+ */
+void clksync_exchange(uint64_t t1, uint8_t has_t4, uint64_t t4){
+  uint64_t t2 = prv_clksync_dev_now();
+
+  if(has_t4 && prv_clksync_pending){
+    int64_t delay = (int64_t)(t4 - prv_clksync_t1) - (int64_t)(prv_clksync_t3 - prv_clksync_t2);
+    prv_clksync_last_delay = delay;
+    if(delay < 0 || delay > CLKSYNC_MAX_DELAY_US){
+      prv_clksync_rejected++;
+      dbg(Warning, "timesync rejected, delay %ld us\n", (int32_t)delay);
+    }
+    else{
+      //host time at the middle of exchange - device time at the middle
+      prv_clksync_sample_t *smp = &prv_clksync_samples[prv_clksync_num % CLKSYNC_NUM_SAMPLES];
+      smp->dev = prv_clksync_t2 + (prv_clksync_t3 - prv_clksync_t2) / 2;
+      smp->offset = (int64_t)(prv_clksync_t1 + (t4 - prv_clksync_t1) / 2) - (int64_t)smp->dev;
+      prv_clksync_num++;
+      prv_clksync_fit();
+    }
+  }
+
+  prv_clksync_t1 = t1;
+  prv_clksync_t2 = t2;
+  prv_clksync_pending = 1;
+  //answer must be the last thing, t3 is as late as possible
+  prv_clksync_t3 = prv_clksync_dev_now();
+  mainser_printf("TIMESYNC:%llu:%llu:%llu\r\n", t1, t2, prv_clksync_t3);
+}
+
+void clksync_reset(void){
+  prv_clksync_num = 0;
+  prv_clksync_rejected = 0;
+  prv_clksync_pending = 0;
+  prv_clksync_last_delay = 0;
+  prv_clksync_offset = 0;
+  prv_clksync_drift = 0;
+}
+
+uint8_t clksync_is_synced(void){
+  return prv_clksync_num > 0;
+}
+
+/**
+ * @brief converts device timestamp (usec_get_timestamp_64) to host time. Only valid if synced.
+ */
+uint64_t clksync_dev_to_host(uint64_t dev_timestamp){
+  uint64_t dev = dev_timestamp + usec_get_reset_offset();
+  double corr = prv_clksync_drift * (double)(int64_t)(dev - prv_clksync_ref);
+  return dev + prv_clksync_offset + (int64_t)corr;
+}
+
+/**
+ * @brief converts host time to device timestamp (usec_get_timestamp_64). Only valid if synced.
+ * Time before the last timestamp reset returns 0.
+ */
+uint64_t clksync_host_to_dev(uint64_t host_time){
+  //host = dev + offset + drift * (dev - ref). Drift is tiny, two fixed point steps are enough
+  uint64_t dev = host_time - prv_clksync_offset;
+  for(uint8_t i = 0; i < 2; i++){
+    dev = host_time - prv_clksync_offset - (int64_t)(prv_clksync_drift * (double)(int64_t)(dev - prv_clksync_ref));
+  }
+  uint64_t reset_offset = usec_get_reset_offset();
+  return (dev > reset_offset) ? dev - reset_offset : 0;
+}
+
+/**
+ * @brief prints sync state and model to main serial
+ */
+void clksync_print_status(void){
+  mainser_printf("TIMESYNC_STATE:%s\r\n", clksync_is_synced() ? "SYNCED" : "NONE");
+  mainser_printf("TIMESYNC_SAMPLES:%lu\r\n", prv_clksync_num);
+  mainser_printf("TIMESYNC_REJECTED:%lu\r\n", prv_clksync_rejected);
+  mainser_printf("TIMESYNC_LAST_DELAY_US:%ld\r\n", (int32_t)prv_clksync_last_delay);
+  if(clksync_is_synced()){
+    uint64_t now = usec_get_timestamp_64();
+    mainser_printf("TIMESYNC_OFFSET_US:%lld\r\n", (int64_t)(clksync_dev_to_host(now) - now));
+    mainser_printf("TIMESYNC_DRIFT_PPM:%f\r\n", prv_clksync_drift * 1e6);
+    mainser_printf("TIMESTAMP:%llu\r\n", now);
+    mainser_printf("HOST_TIMESTAMP:%llu\r\n", clksync_dev_to_host(now));
+  }
+}
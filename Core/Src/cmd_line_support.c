@@ -3,12 +3,89 @@
 //
 #include "cmd_line_support.h"
 #include "lwshell/lwshell.h"
+#include "seq_vm.h"
+#include "task_sched.h"
+#include "clock_sync.h"
+#include "led_wave.h"
+
+//request id (-id) of the cmd being executed
+static uint32_t prv_cmdsprt_req_id = CMDSCHED_NO_REQ_ID;
 
 //this is the callback function for the lwshell when it wants to output stuff to cli
 void cmdsprt_lwshell_out_callback(const char* str, struct lwshell* lwobj){
+  //prompt is printed when cmd is done. It ends the response of a cmd with request id
+  if(prv_cmdsprt_req_id != CMDSCHED_NO_REQ_ID && strcmp(str, LWSHELL_PROMPT) == 0){
+    if(lwobj->cmd_result != 0){
+      mainser_printf("CMD_FAIL\r\n");
+    }
+    prv_cmdsprt_req_id = CMDSCHED_NO_REQ_ID;
+    mainser_set_resp_id(MAINSER_NO_RESP_ID);
+  }
   mainser_send_string(str);
 }
 
+//all cmds. lwshell looks them up by name hash, so the table can grow freely
+static const lwshell_cmd_t prv_cmdsprt_cmds[] = {
+    {.name = "getvolt", .fn = cli_cmd_getvolt_fn, .desc = "Measures voltage. -c #ch# to select channel. No param for all channels"},
+    {.name = "getcurr", .fn = cli_cmd_getcurr_fn, .desc = "Measures current. -c #ch# to select channel. No param for all channels"},
+    {.name = "getivpoint", .fn = cli_cmd_getiv_point_fn, .desc = "Measures IV point. -c #ch# to select channel. -v #volt# to set voltage"},
+    {.name = "getivchar", .fn = cli_cmd_getiv_char_fn, .desc = "Measures IV characteristic. -c #ch# to select channel. -vs #volt# start volt, -ve #volt# end volt, -s #volt# step"},
+    {.name = "measuredump", .fn = cli_cmd_dump_fn, .desc = "Measure and dump buffer. -c #ch# to select channel. No param for all channels. -n #num# to set number of samples. -VOLT/-CURR/-IV to select what to dump"},
+    {.name = "setledcurr", .fn = cli_cmd_setledcurr_fn, .desc = "Set LED current. -i #current[A]# to set current. Temperature compensated"},
+    {.name = "setledillum", .fn = cli_cmd_setledillum_fn, .desc = "Set LED illumination. -illum #illumination[sun]# to set led. Temperature compensated"},
+    {.name = "blinkled", .fn = cli_cmd_blinkled_fn, .desc = "Blink LED. -i #current[A]# to set current. -t #time[us]# to set time. -n to set number of blinks. No scheduling."},
+    {.name = "resettimestamp", .fn = cli_cmd_reset_timestamp_fn, .desc = "Reset internal 64bit microseconds timer to 0. No scheduling."},
+    {.name = "gettimestamp", .fn = cli_cmd_get_timestamp_fn, .desc = "Get internal 64bit microseconds timer value. -host to also get it in host time (needs timesync). No scheduling."},
+    {.name = "flashmeasure", .fn = cli_cmd_flash_measure_fn, .desc = "Flash voltage measurement. -c #ch# to select channel. -illum #illum[sun]# to set illumination. -t #time[us]# to set flash duration. <<-m #time[us]# to set measurement time. -n #num# to set number of averages>> or <<-DUMP to dump buffer, -flat to compensate LED droop, -burst #N# -p #period[us]# to average N flashes, -ets #M# for M sampling phases per sample time (equivalent-time)>> or <<-adapt #tol[V]# to end flash when Voc settles, -t is max duration>>."},
+    {.name = "enablecurrent", .fn = cli_cmd_enable_current_fn, .desc = "Enable current. -c #ch# to select channel. No param for all channels."},
+    {.name = "disablecurrent", .fn = cli_cmd_disable_current_fn, .desc = "Disable current. -c #ch# to select channel. No param for all channels."},
+    {.name = "setshunt", .fn = cli_cmd_set_shunt_fn, .desc = "Set current shunt range. -c #ch# to select channel. No param for all channels. -1x/-10x/-100x/-100x to set range."},
+    {.name = "setforcevolt", .fn = cli_cmd_setforcevolt_fn, .desc = "Set force voltage. -c #ch# to select channel. No param for all channels. -v #volt# to set voltage."},
+    {.name = "autorange", .fn = cli_cmd_autorange_fn, .desc = "Autorange current shunts on all channels. No scheduling."},
+    {.name = "reboot", .fn = cli_cmd_reboot_fn, .desc = "Reboot the device. No scheduling."},
+    {.name = "getledtemp", .fn = cli_cmd_getledtemp_fn, .desc = "Get LED temperature."},
+    {.name = "calibillum", .fn = cli_cmd_calib_illum_fn, .desc = "Callibrate illumination-current coefficient for LED. Specify a calibrated point with -i #current[A]# -illum #illum[sun]# and non-linearity coefficients -pa #a# -pb #b# -pc #c#"},
+    {.name = "calibillumLow", .fn = cli_cmd_calib_illum_low_fn, .desc = "Callibrate Low part (1st percent) of the illumination-current coefficient for LED. -pa #a# -pb #b# -pc #c#"},
+    {.name = "yeet", .fn = cli_cmd_yeet_fn, .desc = "Y E E E E E T"},
+    {.name = "setbaud", .fn = cli_cmd_setbaud_fn, .desc = "sets baud rate. -b #baud# to set baud rate. No scheduling."},
+    {.name = "ready?", .fn = cli_cmd_ready_fn, .desc = "Call to check if ready."},
+    {.name = "ENDSEQUENCE", .fn = cli_cmd_endseq_fn, .desc = "End of sequence signal. prints out END_OF_SEQUENCE and reboots after one second."},
+    {.name = "getnumavg", .fn = cli_cmd_getnumavg_fn, .desc = "Get number of samples to average for getvolt/getcurr."},
+    {.name = "setnumavg", .fn = cli_cmd_setnumavg_fn, .desc = "Set number of samples to average for getvolt/getcurr. -n #num# to set number of samples."},
+    {.name = "setdutsettle", .fn = cli_cmd_setdutsettle_fn, .desc = "Set settling time of DUT for measuring IV points and IV characteristics. -t #settle_time[ms]# to set. In ms."},
+    {.name = "getdutsettle", .fn = cli_cmd_getdutsettle_fn, .desc = "Get settling time of DUT for measuring IV points and IV characteristics In ms."},
+    {.name = "getnoise", .fn = cli_cmd_getnoise_fn, .desc = "Measures noise (RMSmV and SNR) on channels. -c #ch# to select channel. No param for all channels. -VOLT or/and -CURR to measure noise on voltage or/and current channels."},
+    {.name = "mpptstart", .fn = cli_cmd_mpptstart_fn, .desc = "Start MPPT. -c #ch# to select channel. No param for all channels. -t settling time in us (100ms default, 1/10 of the setting will be used to find the first MPP)"},
+    {.name = "mpptresume", .fn = cli_cmd_mpptresume_fn, .desc = "Resume MPPT - doesn't determine current range and doesn't use the faster algorithm to find the first MPPT. Uses previous settings."},
+    {.name = "mpptstop", .fn = cli_cmd_mpptstop_fn, .desc = "Stop MPPT - Stops MPPT. Once stopped it can be resumed."},
+    {.name = "schedjitter", .fn = cli_cmd_schedjitter_fn, .desc = "Report how late scheduled cmds started (min/max/avg in us). -reset to clear statistics. No scheduling."},
+    {.name = "schedbin", .fn = cli_cmd_schedbin_fn, .desc = "Receive a binary block of scheduled cmds (see cmd_scheduler.h). No scheduling."},
+    {.name = "schedtrace", .fn = cli_cmd_schedtrace_fn, .desc = "Report lateness histogram and worst cmds by id. -dump to print last executed cmds, -reset to clear. No scheduling."},
+    {.name = "schedstat", .fn = cli_cmd_schedstat_fn, .desc = "Report scheduler queue occupancy (cmds, bytes, peaks) and calibration of cmd duration estimates. No scheduling."},
+    {.name = "schedcancel", .fn = cli_cmd_schedcancel_fn, .desc = "Remove scheduled cmds. -tag #tag# to remove cmds with tag, -all to remove all. No scheduling."},
+    {.name = "seqload", .fn = cli_cmd_seqload_fn, .desc = "Receive a sequence program as binary block (see seq_vm.h). No scheduling."},
+    {.name = "seqrun", .fn = cli_cmd_seqrun_fn, .desc = "Run loaded sequence program from the beginning. No scheduling."},
+    {.name = "seqstop", .fn = cli_cmd_seqstop_fn, .desc = "Stop running sequence program. Already scheduled cmds are not removed. No scheduling."},
+    {.name = "seqstat", .fn = cli_cmd_seqstat_fn, .desc = "Report sequence state, position, time and variables. No scheduling."},
+    {.name = "timesync", .fn = cli_cmd_timesync_fn, .desc = "Clock sync exchange. -t1 #host time[us]# when sent, -t4 #host time[us]# when previous answer was received. -reset to clear sync. No scheduling."},
+    {.name = "timesyncstat", .fn = cli_cmd_timesyncstat_fn, .desc = "Report clock sync state, offset and drift to host time. No scheduling."},
+    {.name = "taskstat", .fn = cli_cmd_taskstat_fn, .desc = "Report runtime statistics of background tasks (temperature, mppt, debug output). -reset to clear. No scheduling."},
+    {.name = "waveclear", .fn = cli_cmd_waveclear_fn, .desc = "Clear LED waveform. No scheduling."},
+    {.name = "wavestep", .fn = cli_cmd_wavestep_fn, .desc = "Append constant illumination to LED waveform. -illum #illum[sun]# -t #time[us]#. No scheduling."},
+    {.name = "waveflash", .fn = cli_cmd_waveflash_fn, .desc = "Append flash pre-emphasized for LED droop (flat light output, see leddroopcal) to LED waveform. -illum #illum[sun]# -t #time[us]#. No scheduling."},
+    {.name = "waveramp", .fn = cli_cmd_waveramp_fn, .desc = "Append linear ramp from end of LED waveform to -illum #illum[sun]# in -t #time[us]#. No scheduling."},
+    {.name = "wavesine", .fn = cli_cmd_wavesine_fn, .desc = "Append sine to LED waveform. -off #illum[sun]# -amp #illum[sun]# -f #freq[Hz]# -t #time[us]#. No scheduling."},
+    {.name = "wavepwm", .fn = cli_cmd_wavepwm_fn, .desc = "Append PWM train to LED waveform. -illum #illum[sun]# -low #illum[sun]# (default 0) -p #period[us]# -d #duty[%]# -t #time[us]#. No scheduling."},
+    {.name = "waveplay", .fn = cli_cmd_waveplay_fn, .desc = "Play LED waveform (10 us per point). -loop to repeat until wavestop. -DUMP to sample and dump one pass, -c #ch# to select channel."},
+    {.name = "wavestop", .fn = cli_cmd_wavestop_fn, .desc = "Stop LED waveform, LED stays at illumination of last point. No scheduling."},
+    {.name = "wavestat", .fn = cli_cmd_wavestat_fn, .desc = "Report LED waveform length and playback state. No scheduling."},
+    {.name = "sunsvoc", .fn = cli_cmd_sunsvoc_fn, .desc = "Suns-Voc: LED steps through log spaced illuminations, settled Voc per step, slope and ideality. -imin #illum[sun]# -imax #illum[sun]# -n #steps# (default 10) -t #step time[us]# (default 1000), -c #ch#."},
+    {.name = "lockin", .fn = cli_cmd_lockin_fn, .desc = "Lock-in (IMVS/IMPS) sweep, LED modulated and response demodulated on device. -bias #illum[sun]# -amp #illum[sun]# -fstart #f[Hz]# -fstop #f[Hz]# -n #freqs# (log spaced, default 1). -settle #periods# (default 5), -avg #captures# (default 1), -c #ch#, -CURR for current (default voltage)."},
+    {.name = "leddroopcal", .fn = cli_cmd_leddroopcal_fn, .desc = "Calibrate LED droop model from DUT short circuit current during a flash (enable current and force 0 V first). -c #ch# (1-6), -illum #illum[sun]# (default 1), -t #time[us]# (default 15000). No scheduling."},
+    {.name = "setleddroop", .fn = cli_cmd_setleddroop_fn, .desc = "Set LED droop model. -k #droop[1/sun]# (0 disables droop compensation), -tau #time[us]#. No scheduling."},
+    {.name = "getleddroop", .fn = cli_cmd_getleddroop_fn, .desc = "Report LED droop model. No scheduling."},
+};
+
 //sets up cli interface. inits lwshell and registers commands
 void cmdsprt_setup_cli(void){
   //welcome message
@@ -19,6 +96,9 @@ void cmdsprt_setup_cli(void){
   mainser_printf("Type help to list all commands.\r\n");
   mainser_printf("Type <cmd> -h to get help for a specific command.\r\n");
   mainser_printf("Add -sched ### argument to schedule command at specific time\r\n");
+  mainser_printf("Or -hsched ### to schedule it at host time (after timesync)\r\n");
+  mainser_printf("Add -tag ### to scheduled command to replace/cancel it later (schedcancel)\r\n");
+  mainser_printf("Add -id ### to get it in front of every response line (#id:). Separate cmds in one line with ;\r\n");
   mainser_printf("See https://github.com/mrmp17/LightSoakFW-STM for more info.\r\n");
   mainser_printf("See https://github.com/mrmp17/LightSoakFW-Python for data logging python interface.\r\n");
   mainser_printf("-----------------------------\r\n");
@@ -30,494 +110,261 @@ void cmdsprt_setup_cli(void){
   lwshell_set_output_fn(cmdsprt_lwshell_out_callback);
 
   //register commands
-  lwshell_register_cmd("getvolt", cli_cmd_getvolt_fn, "Measures voltage. -c #ch# to select channel. No param for all channels");
-  lwshell_register_cmd("getcurr", cli_cmd_getcurr_fn, "Measures current. -c #ch# to select channel. No param for all channels");
-  lwshell_register_cmd("getivpoint", cli_cmd_getiv_point_fn, "Measures IV point. -c #ch# to select channel. -v #volt# to set voltage");
-  lwshell_register_cmd("getivchar", cli_cmd_getiv_char_fn, "Measures IV characteristic. -c #ch# to select channel. -vs #volt# start volt, -ve #volt# end volt, -s #volt# step");
-  lwshell_register_cmd("measuredump", cli_cmd_dump_fn, "Measure and dump buffer. -c #ch# to select channel. No param for all channels. -n #num# to set number of samples. -VOLT/-CURR/-IV to select what to dump");
-  lwshell_register_cmd("setledcurr", cli_cmd_setledcurr_fn, "Set LED current. -i #current[A]# to set current. Temperature compensated");
-  lwshell_register_cmd("setledillum", cli_cmd_setledillum_fn, "Set LED illumination. -illum #illumination[sun]# to set led. Temperature compensated");
-  lwshell_register_cmd("blinkled", cli_cmd_blinkled_fn, "Blink LED. -i #current[A]# to set current. -t #time[us]# to set time. -n to set number of blinks. No scheduling.");
-  lwshell_register_cmd("resettimestamp", cli_cmd_reset_timestamp_fn, "Reset internal 64bit microseconds timer to 0. No scheduling.");
-  lwshell_register_cmd("gettimestamp", cli_cmd_get_timestamp_fn, "Get internal 64bit microseconds timer value. No scheduling.");
-  lwshell_register_cmd("flashmeasure", cli_cmd_flash_measure_fn, "Flash voltage measurement. -c #ch# to select channel. -illum #illum[sun]# to set illumination. -t #time[us]# to set flash duration. <<-m #time[us]# to set measurement time. -n #num# to set number of averages>> or <<-DUMP to dump buffer>>.");
-  lwshell_register_cmd("enablecurrent", cli_cmd_enable_current_fn, "Enable current. -c #ch# to select channel. No param for all channels.");
-  lwshell_register_cmd("disablecurrent", cli_cmd_disable_current_fn, "Disable current. -c #ch# to select channel. No param for all channels.");
-  lwshell_register_cmd("setshunt", cli_cmd_set_shunt_fn, "Set current shunt range. -c #ch# to select channel. No param for all channels. -1x/-10x/-100x/-100x to set range.");
-  lwshell_register_cmd("setforcevolt", cli_cmd_setforcevolt_fn, "Set force voltage. -c #ch# to select channel. No param for all channels. -v #volt# to set voltage.");
-  lwshell_register_cmd("autorange", cli_cmd_autorange_fn, "Autorange current shunts on all channels. No scheduling.");
-  lwshell_register_cmd("reboot", cli_cmd_reboot_fn, "Reboot the device. No scheduling.");
-  lwshell_register_cmd("getledtemp", cli_cmd_getledtemp_fn, "Get LED temperature.");
-  lwshell_register_cmd("calibillum", cli_cmd_calib_illum_fn, "Callibrate illumination-current coefficient for LED. Specify a calibrated point with -i #current[A]# -illum #illum[sun]# and non-linearity coefficients -pa #a# -pb #b# -pc #c#");
-  lwshell_register_cmd("calibillumLow", cli_cmd_calib_illum_low_fn, "Callibrate Low part (1st percent) of the illumination-current coefficient for LED. -pa #a# -pb #b# -pc #c#");
-  lwshell_register_cmd("yeet", cli_cmd_yeet_fn, "Y E E E E E T");
-  lwshell_register_cmd("setbaud", cli_cmd_setbaud_fn, "sets baud rate. -b #baud# to set baud rate. No scheduling.");
-  lwshell_register_cmd("ready?", cli_cmd_ready_fn, "Call to check if ready.");
-  lwshell_register_cmd("ENDSEQUENCE", cli_cmd_endseq_fn, "End of sequence signal. prints out END_OF_SEQUENCE and reboots after one second.");
-  lwshell_register_cmd("getnumavg", cli_cmd_getnumavg_fn, "Get number of samples to average for getvolt/getcurr.");
-  lwshell_register_cmd("setnumavg", cli_cmd_setnumavg_fn, "Set number of samples to average for getvolt/getcurr. -n #num# to set number of samples.");
-  lwshell_register_cmd("setdutsettle", cli_cmd_setdutsettle_fn, "Set settling time of DUT for measuring IV points and IV characteristics. -t #settle_time[ms]# to set. In ms.");
-  lwshell_register_cmd("getdutsettle", cli_cmd_getdutsettle_fn, "Get settling time of DUT for measuring IV points and IV characteristics In ms.");
-  lwshell_register_cmd("getnoise", cli_cmd_getnoise_fn, "Measures noise (RMSmV and SNR) on channels. -c #ch# to select channel. No param for all channels. -VOLT or/and -CURR to measure noise on voltage or/and current channels.");
-  lwshell_register_cmd("mpptstart", cli_cmd_mpptstart_fn, "Start MPPT. -c #ch# to select channel. No param for all channels. -t settling time in us (100ms default, 1/10 of the setting will be used to find the first MPP)");
-  lwshell_register_cmd("mpptresume", cli_cmd_mpptresume_fn, "Resume MPPT - doesn't determine current range and doesn't use the faster algorithm to find the first MPPT. Uses previous settings.");
-  lwshell_register_cmd("mpptstop", cli_cmd_mpptstop_fn, "Stop MPPT - Stops MPPT. Once stopped it can be resumed.");
+  lwshell_register_static_cmds(prv_cmdsprt_cmds, LWSHELL_ARRAYSIZE(prv_cmdsprt_cmds));
 }
 
-int32_t cli_cmd_mpptstart_fn(int32_t argc, char** argv){
-  uint32_t ch = 0;
-  uint32_t settling_time = MPPT_SETTLING_TIME_DEFAULT;
-  uint32_t report_every_xth_point = 0;
-
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
+//schedules cmd parsed by cmdsprt_parse_opts()
+static void prv_cmdsprt_schedule(const cmdsprt_sched_opts_t *sched, meas_funct_id id, void *param, uint8_t len){
+  cmdsched_set_next_tag(sched->tag);
+  cmdsched_set_next_req_id(prv_cmdsprt_req_id);
+  cmdsched_encode_and_add(sched->sched_time, id, param, len);
+}
 
-  if(cmdsprt_is_arg("-t", argc, argv)){
-    //settling time argument present, parse
-    cmdsprt_parse_uint32("-t", &settling_time, argc, argv);
-  }
+static const cmdsprt_opt_t prv_cmdsprt_mppt_opts[] = {
+    CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, mppt_param_t, channel),
+    CMDSPRT_OPT("-t", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, mppt_param_t, settling_time),
+    CMDSPRT_OPT("-r", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, mppt_param_t, report_every_xth_point),
+};
 
-  if(cmdsprt_is_arg("-r", argc, argv)){
-    //settling time argument present, parse
-    cmdsprt_parse_uint32("-r", &report_every_xth_point, argc, argv);
+int32_t cli_cmd_mpptstart_fn(int32_t argc, char** argv){
+  cmdsprt_sched_opts_t sched;
+  mppt_param_t param = {.channel = 0, .settling_time = MPPT_SETTLING_TIME_DEFAULT, .report_every_xth_point = 0};
+  if(cmdsprt_parse_opts(prv_cmdsprt_mppt_opts, CMDSPRT_NUM_OPTS(prv_cmdsprt_mppt_opts), &param, &sched, argc, argv) != 0){
+    return -1;
   }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-
-    // schedule command ##########
-    mppt_param_t param;
-    param.channel = ch;
-    param.settling_time = settling_time;
-    param.report_every_xth_point = report_every_xth_point;
-    cmdsched_encode_and_add(sched_time, mppt_start_id, &param, sizeof(mppt_param_t));
-    // END schedule command ##########
-
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, mppt_start_id, &param, sizeof(mppt_param_t));
   }
   else{
-    //immediate command
-    mppt_start(ch,settling_time,report_every_xth_point);
+    mppt_start(param.channel, param.settling_time, param.report_every_xth_point);
   }
   return 0;
 }
 
 int32_t cli_cmd_mpptresume_fn(int32_t argc, char** argv){
-  uint32_t ch = 0;
-  uint32_t settling_time = UINT32_MAX;
-  uint32_t report_every_xth_point = UINT32_MAX;
-
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
-
-  if(cmdsprt_is_arg("-t", argc, argv)){
-    //settling time argument present, parse
-    cmdsprt_parse_uint32("-t", &settling_time, argc, argv);
-  }
-
-  if(cmdsprt_is_arg("-r", argc, argv)){
-    //settling time argument present, parse
-    cmdsprt_parse_uint32("-r", &report_every_xth_point, argc, argv);
+  cmdsprt_sched_opts_t sched;
+  //UINT32_MAX keeps settings of stopped tracker
+  mppt_param_t param = {.channel = 0, .settling_time = UINT32_MAX, .report_every_xth_point = UINT32_MAX};
+  if(cmdsprt_parse_opts(prv_cmdsprt_mppt_opts, CMDSPRT_NUM_OPTS(prv_cmdsprt_mppt_opts), &param, &sched, argc, argv) != 0){
+    return -1;
   }
 
   //scheduled or immediate
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-
-    // schedule command ##########
-    mppt_param_t param;
-    param.channel = ch;
-    param.settling_time = settling_time;
-    param.report_every_xth_point = report_every_xth_point;
-    cmdsched_encode_and_add(sched_time, mppt_resume_id, &param, sizeof(mppt_param_t));
-    // END schedule command ##########
-
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, mppt_resume_id, &param, sizeof(mppt_param_t));
   }
   else{
-    //immediate command
-    mppt_resume(ch,settling_time,report_every_xth_point);
+    mppt_resume(param.channel, param.settling_time, param.report_every_xth_point);
   }
   return 0;
 }
 
 int32_t cli_cmd_mpptstop_fn(int32_t argc, char** argv){
-  //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-
-    // schedule command ##########
-    cmdsched_encode_and_add(sched_time, mppt_stop_id, NULL, 0);
-    // END schedule command ##########
+  cmdsprt_sched_opts_t sched;
+  if(cmdsprt_parse_opts(NULL, 0, NULL, &sched, argc, argv) != 0){
+    return -1;
+  }
 
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, mppt_stop_id, NULL, 0);
   }
   else{
-    //immediate command
     mppt_stop();
   }
   return 0;
 }
 
 int32_t cli_cmd_getvolt_fn(int32_t argc, char** argv){
-  uint32_t ch;
-
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
-  else{
-    ch = 0;
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, meas_get_voltage_param_t, channel),
+  };
+  cmdsprt_sched_opts_t sched;
+  meas_get_voltage_param_t param = {.channel = 0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
+    return -1;
   }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-
-    // schedule command ##########
-    meas_get_voltage_param_t param;
-    param.channel = ch;
-    cmdsched_encode_and_add(sched_time, meas_get_voltage_id, &param, sizeof(meas_get_voltage_param_t));
-    // END schedule command ##########
-
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_get_voltage_id, &param, sizeof(meas_get_voltage_param_t));
   }
   else{
-    //immediate command
-    meas_get_voltage(ch);
+    meas_get_voltage(param.channel);
   }
   return 0;
 }
 
 int32_t cli_cmd_getcurr_fn(int32_t argc, char** argv){
-  uint32_t ch;
-
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
-  else{
-    ch = 0;
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, meas_get_current_param_t, channel),
+  };
+  cmdsprt_sched_opts_t sched;
+  meas_get_current_param_t param = {.channel = 0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
+    return -1;
   }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    meas_get_current_param_t param;
-    param.channel = ch;
-    cmdsched_encode_and_add(sched_time, meas_get_current_id, &param, sizeof(meas_get_current_param_t));
-    // END schedule command ##########
-
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_get_current_id, &param, sizeof(meas_get_current_param_t));
   }
   else{
-    //immediate command
-    meas_get_current(ch);
+    meas_get_current(param.channel);
   }
   return 0;
 }
 
 int32_t cli_cmd_getiv_point_fn(int32_t argc, char** argv){
-  uint32_t ch;
-  uint32_t disable_current_when_finished;
-  float cmdvolt;
-
-  //parse ch
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_REQUIRED, meas_get_IV_point_param_t, channel),
+      CMDSPRT_OPT("-v", cmdsprt_opt_float, CMDSPRT_REQUIRED, meas_get_IV_point_param_t, voltage),
+      //disable current measurement when finished
+      CMDSPRT_OPT("-d", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, meas_get_IV_point_param_t, disable_current_when_finished),
+  };
+  cmdsprt_sched_opts_t sched;
+  meas_get_IV_point_param_t param = {.disable_current_when_finished = 0, .noident = 0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
     return -1;
   }
-  //parse voltage setpoint
-  if(cmdsprt_is_arg("-v", argc, argv)){
-    //voltage argument present, parse
-    cmdsprt_parse_float("-v", &cmdvolt, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
-    return -1;
-  }
-
-  //parse disable current measurement when finished
-  disable_current_when_finished = 0;
-  if(cmdsprt_is_arg("-d", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-d", &disable_current_when_finished, argc, argv);
-  }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    meas_get_IV_point_param_t param;
-    param.channel = ch;
-    param.voltage = cmdvolt;
-    param.disable_current_when_finished = disable_current_when_finished;
-    param.noident = 0;
-    cmdsched_encode_and_add(sched_time, meas_get_IV_point_id, &param, sizeof(meas_get_IV_point_param_t));
-    // END schedule command ##########
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_get_IV_point_id, &param, sizeof(meas_get_IV_point_param_t));
   }
   else{
-    //immediate command
-    meas_get_exact_IV_point(ch, cmdvolt, disable_current_when_finished, 0);
+    meas_get_exact_IV_point(param.channel, param.voltage, param.disable_current_when_finished, 0);
   }
   return 0;
 }
 
 int32_t cli_cmd_getiv_char_fn(int32_t argc, char** argv){
-  uint32_t ch, Dt=10, N=1;
-  float start, end, step;
-  //parse ch
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
-    return -1;
-  }
-
-  //parse v_start
-  if(cmdsprt_is_arg("-vs", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-vs", &start, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
-    return -1;
-  }
-
-  //parse v_end
-  if(cmdsprt_is_arg("-ve", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-ve", &end, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_REQUIRED, meas_get_iv_characteristic_param_t, channel),
+      CMDSPRT_OPT("-vs", cmdsprt_opt_float, CMDSPRT_REQUIRED, meas_get_iv_characteristic_param_t, start_volt),
+      CMDSPRT_OPT("-ve", cmdsprt_opt_float, CMDSPRT_REQUIRED, meas_get_iv_characteristic_param_t, end_volt),
+      CMDSPRT_OPT("-s", cmdsprt_opt_float, CMDSPRT_REQUIRED, meas_get_iv_characteristic_param_t, step_volt),
+      CMDSPRT_OPT("-st", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, meas_get_iv_characteristic_param_t, step_time),
+      CMDSPRT_OPT("-sn", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, meas_get_iv_characteristic_param_t, Npoints_per_step),
+  };
+  cmdsprt_sched_opts_t sched;
+  meas_get_iv_characteristic_param_t param = {.step_time = 10, .Npoints_per_step = 1};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
     return -1;
   }
-
-  //parse v_step
-  if(cmdsprt_is_arg("-s", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-s", &step, argc, argv);
+  if((param.step_time < 1) || (param.step_time > 65535)){
+    dbg(Warning, "CLI CMD Error: invalid -st value\r\n");
   }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
-    return -1;
-  }
-
-  //parse Dt
-  if(cmdsprt_is_arg("-st", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-st", &Dt, argc, argv);
-    if ((Dt<1) || (Dt>65535) ) {
-    	dbg(Warning, "CLI CMD Error: invalid -st value\r\n");
-    }
-  }
-
-  //parse N
-  if(cmdsprt_is_arg("-sn", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-sn", &N, argc, argv);
-    if ((N<1) || (N>Dt) ) {
-    	dbg(Warning, "CLI CMD Error: invalid -sn value\r\n");
-    }
+  if((param.Npoints_per_step < 1) || (param.Npoints_per_step > param.step_time)){
+    dbg(Warning, "CLI CMD Error: invalid -sn value\r\n");
   }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    meas_get_iv_characteristic_param_t param;
-    param.channel = ch;
-    param.start_volt = start;
-    param.end_volt = end;
-    param.step_volt = step;
-    param.step_time = Dt;
-    param.Npoints_per_step = N;
-    cmdsched_encode_and_add(sched_time, meas_get_iv_characteristic_id, &param, sizeof(meas_get_iv_characteristic_param_t));
-    // END schedule command ##########
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_get_iv_characteristic_id, &param, sizeof(meas_get_iv_characteristic_param_t));
   }
   else{
-    //immediate command
-    meas_get_iv_characteristic(ch, start, end, step, Dt, N);
+    meas_get_iv_characteristic(param.channel, param.start_volt, param.end_volt, param.step_volt,
+                               param.step_time, param.Npoints_per_step);
   }
   return 0;
 }
 
+//measuredump options: dump params and what to dump
+typedef struct {
+    meas_sample_and_dump_param_t param;
+    uint8_t volt;
+    uint8_t curr;
+    uint8_t iv;
+} prv_cmdsprt_dump_opts_t;
+
 int32_t cli_cmd_dump_fn(int32_t argc, char** argv){
-  uint32_t ch;
-  uint32_t num_samples;
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, prv_cmdsprt_dump_opts_t, param.channel),
+      CMDSPRT_OPT("-n", cmdsprt_opt_u32, CMDSPRT_REQUIRED, prv_cmdsprt_dump_opts_t, param.num_samples),
+      CMDSPRT_OPT("-VOLT", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, prv_cmdsprt_dump_opts_t, volt),
+      CMDSPRT_OPT("-CURR", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, prv_cmdsprt_dump_opts_t, curr),
+      CMDSPRT_OPT("-IV", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, prv_cmdsprt_dump_opts_t, iv),
+  };
+  cmdsprt_sched_opts_t sched;
+  prv_cmdsprt_dump_opts_t o = {.param = {.channel = 0}, .volt = 0, .curr = 0, .iv = 0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &o, &sched, argc, argv) != 0){
+    return -1;
+  }
 
-  //parse ch
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
+  meas_funct_id id;
+  void (*dump_fn)(uint8_t, uint32_t);
+  //-VOLT/-CURR/-IV, first one wins
+  if(o.volt){
+    id = meas_volt_sample_and_dump_id;
+    dump_fn = meas_volt_sample_and_dump;
   }
-  else{
-    ch = 0;
+  else if(o.curr){
+    id = meas_curr_sample_and_dump_id;
+    dump_fn = meas_curr_sample_and_dump;
   }
-
-  //parse num samples
-  if(cmdsprt_is_arg("-n", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-n", &num_samples, argc, argv);
+  else if(o.iv){
+    id = meas_iv_sample_and_dump_id;
+    dump_fn = meas_iv_sample_and_dump;
   }
   else{
     dbg(Warning, "CLI CMD Error\r\n");
     return -1;
   }
 
-  //parse -VOLT/-CURR/-IV
-  if(cmdsprt_is_arg("-VOLT", argc, argv)){
-    //scheduled or immediate
-    if(cmdsprt_is_arg("-sched", argc, argv)){
-      //scheduled command
-      uint64_t sched_time;
-      cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-      // schedule command ##########
-      meas_sample_and_dump_param_t param;
-      param.channel = ch;
-      param.num_samples = num_samples;
-      cmdsched_encode_and_add(sched_time, meas_volt_sample_and_dump_id, &param, sizeof(meas_sample_and_dump_param_t));
-      // END schedule command ##########
-    }
-    else{
-      //immediate command
-      meas_volt_sample_and_dump(ch, num_samples);
-    }
-  }
-  else if(cmdsprt_is_arg("-CURR", argc, argv)){
-    //scheduled or immediate
-    if(cmdsprt_is_arg("-sched", argc, argv)){
-      //scheduled command
-      uint64_t sched_time;
-      cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-      // schedule command ##########
-      meas_sample_and_dump_param_t param;
-      param.channel = ch;
-      param.num_samples = num_samples;
-      cmdsched_encode_and_add(sched_time, meas_curr_sample_and_dump_id, &param, sizeof(meas_sample_and_dump_param_t));
-      // END schedule command ##########
-    }
-    else{
-      //immediate command
-      meas_curr_sample_and_dump(ch, num_samples);
-    }
-  }
-  else if(cmdsprt_is_arg("-IV", argc, argv)){
-    //scheduled or immediate
-    if(cmdsprt_is_arg("-sched", argc, argv)){
-      //scheduled command
-      uint64_t sched_time;
-      cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-      // schedule command ##########
-      meas_sample_and_dump_param_t param;
-      param.channel = ch;
-      param.num_samples = num_samples;
-      cmdsched_encode_and_add(sched_time, meas_iv_sample_and_dump_id, &param, sizeof(meas_sample_and_dump_param_t));
-      // END schedule command ##########
-    }
-    else{
-      //immediate command
-      meas_iv_sample_and_dump(ch, num_samples);
-    }
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, id, &o.param, sizeof(meas_sample_and_dump_param_t));
   }
   else{
-    dbg(Warning, "CLI CMD Error\r\n");
-    return -1;
+    dump_fn(o.param.channel, o.param.num_samples);
   }
   return 0;
 }
 
 int32_t cli_cmd_setledcurr_fn(int32_t argc, char** argv){
-  float current;
-
-  //parse current
-  if(cmdsprt_is_arg("-i", argc, argv)){
-    cmdsprt_parse_float("-i", &current, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-i", cmdsprt_opt_float, CMDSPRT_REQUIRED, ledctrl_set_current_param_t, current),
+  };
+  cmdsprt_sched_opts_t sched;
+  ledctrl_set_current_param_t param;
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
     return -1;
   }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    ledctrl_set_current_param_t param;
-    param.current = current;
-    cmdsched_encode_and_add(sched_time, ledctrl_set_current_id, &param, sizeof(ledctrl_set_current_param_t));
-    // END schedule command ##########
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, ledctrl_set_current_id, &param, sizeof(ledctrl_set_current_param_t));
   }
   else{
-    //immediate command
-    ledctrl_set_current_tempcomp(current);
+    ledctrl_set_current_tempcomp(param.current);
   }
   return 0;
 }
 
 int32_t cli_cmd_setledillum_fn(int32_t argc, char** argv){
-  float illum;
-
-  //parse current
-  if(cmdsprt_is_arg("-illum", argc, argv)){
-    cmdsprt_parse_float("-illum", &illum, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-illum", cmdsprt_opt_float, CMDSPRT_REQUIRED, ledctrl_set_illum_param_t, illum),
+  };
+  cmdsprt_sched_opts_t sched;
+  ledctrl_set_illum_param_t param;
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
     return -1;
   }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    ledctrl_set_illum_param_t param;
-    param.illum = illum;
-    cmdsched_encode_and_add(sched_time, ledctrl_set_illum_id, &param, sizeof(ledctrl_set_illum_param_t));
-    // END schedule command ##########
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, ledctrl_set_illum_id, &param, sizeof(ledctrl_set_illum_param_t));
   }
   else{
-    //immediate command
-    ledctrl_set_illum(illum);
+    ledctrl_set_illum(param.illum);
   }
   return 0;
 }
 
-
+//blinkled is for testing only and is not schedulable, it keeps the plain arg helpers
 int32_t cli_cmd_blinkled_fn(int32_t argc, char** argv){
   float current;
   uint32_t dur;
@@ -567,102 +414,139 @@ int32_t cli_cmd_blinkled_fn(int32_t argc, char** argv){
   return 0;
 }
 
-int32_t cli_cmd_flash_measure_fn(int32_t argc, char** argv){
-  float illum;
-  uint32_t flash_dur;
-  uint32_t measure_at;
-  uint32_t numavg;
-  uint32_t ch;
-
-  //parse channel
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
-  else{
-    ch = 0;
-  }
+//flashmeasure options. -m and -n are required for single sample only
+typedef struct {
+    meas_flashmeasure_singlesample_param_t param;
+    uint8_t dump;
+    uint8_t flat;
+    uint32_t num_flashes;
+    uint32_t period_us;
+    uint32_t num_phases;
+    float adapt_tol_v;
+} prv_cmdsprt_flash_opts_t;
 
-  //parse illum
-  if(cmdsprt_is_arg("-illum", argc, argv)){
-    cmdsprt_parse_float("-illum", &illum, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
+int32_t cli_cmd_flash_measure_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, prv_cmdsprt_flash_opts_t, param.channel),
+      CMDSPRT_OPT("-illum", cmdsprt_opt_float, CMDSPRT_REQUIRED, prv_cmdsprt_flash_opts_t, param.illum),
+      CMDSPRT_OPT("-t", cmdsprt_opt_u32, CMDSPRT_REQUIRED, prv_cmdsprt_flash_opts_t, param.flash_dur_us),
+      CMDSPRT_OPT("-m", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, prv_cmdsprt_flash_opts_t, param.measure_at_us),
+      CMDSPRT_OPT("-n", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, prv_cmdsprt_flash_opts_t, param.numavg),
+      CMDSPRT_OPT("-DUMP", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, prv_cmdsprt_flash_opts_t, dump),
+      CMDSPRT_OPT("-flat", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, prv_cmdsprt_flash_opts_t, flat),
+      CMDSPRT_OPT("-burst", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, prv_cmdsprt_flash_opts_t, num_flashes),
+      CMDSPRT_OPT("-p", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, prv_cmdsprt_flash_opts_t, period_us),
+      CMDSPRT_OPT("-ets", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, prv_cmdsprt_flash_opts_t, num_phases),
+      CMDSPRT_OPT("-adapt", cmdsprt_opt_float, CMDSPRT_OPTIONAL, prv_cmdsprt_flash_opts_t, adapt_tol_v),
+  };
+  cmdsprt_sched_opts_t sched;
+  //UINT32_MAX marks missing -m/-n
+  prv_cmdsprt_flash_opts_t o = {.param = {.channel = 0, .measure_at_us = UINT32_MAX, .numavg = UINT32_MAX}, .dump = 0, .flat = 0, .num_flashes = 0, .period_us = 0, .num_phases = 0, .adapt_tol_v = -1.0f};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &o, &sched, argc, argv) != 0){
     return -1;
   }
 
-  //parse flash_dur
-  if(cmdsprt_is_arg("-t", argc, argv)){
-    cmdsprt_parse_uint32("-t", &flash_dur, argc, argv);
+  if(o.adapt_tol_v >= 0.0f){
+    //adaptive flash, -t is max duration. 0 tolerance means default
+    meas_flashmeasure_adaptive_param_t param;
+    param.channel = o.param.channel;
+    param.illum = o.param.illum;
+    param.max_dur_us = o.param.flash_dur_us;
+    param.tol_v = (o.adapt_tol_v > 0.0f) ? o.adapt_tol_v : MEAS_FLASH_ADAPT_DEF_TOL_V;
+    //scheduled or immediate
+    if(sched.sched){
+      prv_cmdsprt_schedule(&sched, meas_flashmeasure_adaptive_id, &param, sizeof(meas_flashmeasure_adaptive_param_t));
+    }
+    else{
+      if(meas_flashmeasure_adaptive(param.channel, param.illum, param.max_dur_us, param.tol_v) != 0){
+        return -1;
+      }
+    }
   }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
-    return -1;
+  else if(o.flat){
+    //droop compensated flash (LED waveform), dump only
+    if(!o.dump || o.num_flashes > 0 || o.num_phases > 0){
+      dbg(Warning, "CLI CMD Error\r\n");
+      return -1;
+    }
+    meas_flashmeasure_dumpbuffer_param_t param;
+    param.channel = o.param.channel;
+    param.illum = o.param.illum;
+    param.flash_dur_us = o.param.flash_dur_us;
+    //scheduled or immediate
+    if(sched.sched){
+      prv_cmdsprt_schedule(&sched, meas_flashmeasure_flat_id, &param, sizeof(meas_flashmeasure_dumpbuffer_param_t));
+    }
+    else{
+      if(meas_flashmeasure_flat(param.channel, param.illum, param.flash_dur_us) != 0){
+        return -1;
+      }
+    }
   }
-
-  //check if dump
-  if(cmdsprt_is_arg("-DUMP", argc, argv)){
-    //dump measurement
+  else if(o.dump && o.num_phases > 0){
+    //equivalent-time capture, one flash per phase if -burst is not given
+    meas_flashmeasure_ets_param_t param;
+    param.channel = o.param.channel;
+    param.illum = o.param.illum;
+    param.flash_dur_us = o.param.flash_dur_us;
+    param.num_phases = o.num_phases;
+    param.num_flashes = (o.num_flashes > 0) ? o.num_flashes : 1;
+    param.period_us = o.period_us;
     //scheduled or immediate
-
-    if(cmdsprt_is_arg("-sched", argc, argv)){
-      //scheduled command
-      uint64_t sched_time;
-      cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-      // schedule command ##########
-      meas_flashmeasure_dumpbuffer_param_t param;
-      param.channel = ch;
-      param.illum = illum;
-      param.flash_dur_us = flash_dur;
-      cmdsched_encode_and_add(sched_time, meas_flashmeasure_dumpbuffer_id, &param, sizeof(meas_flashmeasure_dumpbuffer_param_t));
-      // END schedule command ##########
+    if(sched.sched){
+      prv_cmdsprt_schedule(&sched, meas_flashmeasure_ets_id, &param, sizeof(meas_flashmeasure_ets_param_t));
     }
     else{
-      //immediate command
-      meas_flashmeasure_dumpbuffer(ch, illum, flash_dur);
+      if(meas_flashmeasure_ets(param.channel, param.illum, param.flash_dur_us, param.num_phases, param.num_flashes, param.period_us) != 0){
+        return -1;
+      }
     }
-
   }
-  else{
-    //singleshot measurement
-    //parse measure_at
-    if(cmdsprt_is_arg("-m", argc, argv)){
-      cmdsprt_parse_uint32("-m", &measure_at, argc, argv);
+  else if(o.dump && o.num_flashes > 0){
+    //burst of flashes, averaged dump
+    meas_flashmeasure_burst_param_t param;
+    param.channel = o.param.channel;
+    param.illum = o.param.illum;
+    param.flash_dur_us = o.param.flash_dur_us;
+    param.num_flashes = o.num_flashes;
+    param.period_us = o.period_us;
+    //scheduled or immediate
+    if(sched.sched){
+      prv_cmdsprt_schedule(&sched, meas_flashmeasure_burst_id, &param, sizeof(meas_flashmeasure_burst_param_t));
     }
     else{
-      dbg(Warning, "CLI CMD Error\r\n");
-      return -1;
+      if(meas_flashmeasure_burst(param.channel, param.illum, param.flash_dur_us, param.num_flashes, param.period_us) != 0){
+        return -1;
+      }
     }
-    //parse numavg
-    if(cmdsprt_is_arg("-n", argc, argv)){
-      cmdsprt_parse_uint32("-n", &numavg, argc, argv);
+  }
+  else if(o.dump){
+    //dump measurement
+    meas_flashmeasure_dumpbuffer_param_t param;
+    param.channel = o.param.channel;
+    param.illum = o.param.illum;
+    param.flash_dur_us = o.param.flash_dur_us;
+    //scheduled or immediate
+    if(sched.sched){
+      prv_cmdsprt_schedule(&sched, meas_flashmeasure_dumpbuffer_id, &param, sizeof(meas_flashmeasure_dumpbuffer_param_t));
     }
     else{
+      meas_flashmeasure_dumpbuffer(param.channel, param.illum, param.flash_dur_us);
+    }
+  }
+  else{
+    //singleshot measurement
+    if(o.param.measure_at_us == UINT32_MAX || o.param.numavg == UINT32_MAX){
       dbg(Warning, "CLI CMD Error\r\n");
       return -1;
     }
-
     //scheduled or immediate
-
-    if(cmdsprt_is_arg("-sched", argc, argv)){
-      //scheduled command
-      uint64_t sched_time;
-      cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-      // schedule command ##########
-      meas_flashmeasure_singlesample_param_t param;
-      param.channel = ch;
-      param.illum = illum;
-      param.flash_dur_us = flash_dur;
-      param.measure_at_us = measure_at;
-      param.numavg = numavg;
-      cmdsched_encode_and_add(sched_time, meas_flashmeasure_singlesample_id, &param, sizeof(meas_flashmeasure_singlesample_param_t));
-      // END schedule command ##########
+    if(sched.sched){
+      prv_cmdsprt_schedule(&sched, meas_flashmeasure_singlesample_id, &o.param, sizeof(meas_flashmeasure_singlesample_param_t));
     }
     else{
-      //immediate command
-      meas_flashmeasure_singlesample(ch, illum, flash_dur, measure_at, numavg);
+      meas_flashmeasure_singlesample(o.param.channel, o.param.illum, o.param.flash_dur_us, o.param.measure_at_us, o.param.numavg);
     }
-
   }
   return 0;
 }
@@ -675,121 +559,86 @@ int32_t cli_cmd_reset_timestamp_fn(int32_t argc, char** argv){
 int32_t cli_cmd_get_timestamp_fn(int32_t argc, char** argv){
   uint64_t timestamp = usec_get_timestamp_64();
   mainser_printf("TIMESTAMP:%llu\r\n", timestamp);
+  if(cmdsprt_is_arg("-host", argc, argv)){
+    if(!clksync_is_synced()){
+      mainser_printf("HOST_TIMESTAMP:NONE\r\n");
+      return -1;
+    }
+    mainser_printf("HOST_TIMESTAMP:%llu\r\n", clksync_dev_to_host(timestamp));
+  }
   return 0;
 }
 
+static const cmdsprt_opt_t prv_cmdsprt_channel_opts[] = {
+    CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, fec_enable_disable_current_param_t, channel),
+};
+
 int32_t cli_cmd_enable_current_fn(int32_t argc, char** argv){
-  uint32_t ch;
-  //parse ch
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
-  else{
-    ch = 0;
+  cmdsprt_sched_opts_t sched;
+  fec_enable_disable_current_param_t param = {.channel = 0};
+  if(cmdsprt_parse_opts(prv_cmdsprt_channel_opts, CMDSPRT_NUM_OPTS(prv_cmdsprt_channel_opts), &param, &sched, argc, argv) != 0){
+    return -1;
   }
-  //scheduled or immediate
 
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    fec_enable_disable_current_param_t param;
-    param.channel = ch;
-    cmdsched_encode_and_add(sched_time, fec_enable_current_id, &param, sizeof(fec_enable_disable_current_param_t));
-    // END schedule command ##########
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, fec_enable_current_id, &param, sizeof(fec_enable_disable_current_param_t));
   }
   else{
-    //immediate command
-    fec_enable_current(ch);
+    fec_enable_current(param.channel);
   }
   return 0;
 }
 
 int32_t cli_cmd_disable_current_fn(int32_t argc, char** argv){
-  uint32_t ch;
-  //parse ch
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
-  else{
-    ch = 0;
+  cmdsprt_sched_opts_t sched;
+  fec_enable_disable_current_param_t param = {.channel = 0};
+  if(cmdsprt_parse_opts(prv_cmdsprt_channel_opts, CMDSPRT_NUM_OPTS(prv_cmdsprt_channel_opts), &param, &sched, argc, argv) != 0){
+    return -1;
   }
-  //scheduled or immediate
 
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    fec_enable_disable_current_param_t param;
-    param.channel = ch;
-    cmdsched_encode_and_add(sched_time, fec_disable_current_id, &param, sizeof(fec_enable_disable_current_param_t));
-    // END schedule command ##########
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, fec_disable_current_id, &param, sizeof(fec_enable_disable_current_param_t));
   }
   else{
-    //immediate command
-    fec_disable_current(ch);
+    fec_disable_current(param.channel);
   }
   return 0;
 }
 
 int32_t cli_cmd_setforcevolt_fn(int32_t argc, char** argv){
-  uint32_t ch;
-  float volt;
-  //parse ch
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
-  else{
-    ch = 0;
-  }
-  //parse volt
-  if(cmdsprt_is_arg("-v", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-v", &volt, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, fec_setforcevolt_param_t, channel),
+      CMDSPRT_OPT("-v", cmdsprt_opt_float, CMDSPRT_REQUIRED, fec_setforcevolt_param_t, volt),
+  };
+  cmdsprt_sched_opts_t sched;
+  fec_setforcevolt_param_t param = {.channel = 0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
     return -1;
   }
 
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    fec_setforcevolt_param_t param;
-    param.channel = ch;
-    param.volt = volt;
-    cmdsched_encode_and_add(sched_time, setforcevolt_id, &param, sizeof(fec_setforcevolt_param_t));
-    // END schedule command ##########
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, setforcevolt_id, &param, sizeof(fec_setforcevolt_param_t));
   }
   else{
-    //immediate command
-    fec_set_force_voltage(ch, volt);
+    fec_set_force_voltage(param.channel, param.volt);
   }
-
-
   return 0;
 }
 
 int32_t cli_cmd_autorange_fn(int32_t argc, char** argv){
-  //scheduled or immediate
+  cmdsprt_sched_opts_t sched;
+  if(cmdsprt_parse_opts(NULL, 0, NULL, &sched, argc, argv) != 0){
+    return -1;
+  }
 
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    cmdsched_encode_and_add(sched_time, autorange_id, 0, 0);
-    // END schedule command ##########
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, autorange_id, NULL, 0);
   }
   else{
-    //immediate command
     daq_autorange();
   }
   return 0;
@@ -812,21 +661,18 @@ int32_t cli_cmd_yeet_fn(int32_t argc, char** argv){
 }
 
 int32_t cli_cmd_getledtemp_fn(int32_t argc, char** argv){
-  //scheduled or immediate
+  cmdsprt_sched_opts_t sched;
+  if(cmdsprt_parse_opts(NULL, 0, NULL, &sched, argc, argv) != 0){
+    return -1;
+  }
 
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    cmdsched_encode_and_add(sched_time, getledtemp_id, 0, 0);
-    // END schedule command ##########
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, getledtemp_id, NULL, 0);
   }
   else{
-    //immediate command
     ledctrl_print_temperature_mainser();
   }
-
   return 0;
 }
 
@@ -851,88 +697,74 @@ int32_t cli_cmd_ready_fn(int32_t argc, char** argv){
   return 0;
 }
 
+//setshunt options: channel and shunt flags
+typedef struct {
+    uint8_t channel;
+    uint8_t x1;
+    uint8_t x10;
+    uint8_t x100;
+    uint8_t x1000;
+} prv_cmdsprt_shunt_opts_t;
+
 int32_t cli_cmd_set_shunt_fn(int32_t argc, char** argv){
-  uint32_t ch;
-  uint32_t shunt;
-  //parse ch
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
-  }
-  else{
-    ch = 0;
-  }
-  //parse shunt
-  if(cmdsprt_is_arg("-1x", argc, argv)){
-    shunt = 1;
-    fec_set_shunt_1x(ch);
-  }
-  else if(cmdsprt_is_arg("-10x", argc, argv)){
-    shunt = 10;
-    fec_set_shunt_10x(ch);
-  }
-  else if(cmdsprt_is_arg("-100x", argc, argv)){
-    shunt = 100;
-    fec_set_shunt_100x(ch);
-  }
-  else if(cmdsprt_is_arg("-1000x", argc, argv)){
-    shunt = 1000;
-    fec_set_shunt_1000x(ch);
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, prv_cmdsprt_shunt_opts_t, channel),
+      CMDSPRT_OPT("-1x", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, prv_cmdsprt_shunt_opts_t, x1),
+      CMDSPRT_OPT("-10x", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, prv_cmdsprt_shunt_opts_t, x10),
+      CMDSPRT_OPT("-100x", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, prv_cmdsprt_shunt_opts_t, x100),
+      CMDSPRT_OPT("-1000x", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, prv_cmdsprt_shunt_opts_t, x1000),
+  };
+  cmdsprt_sched_opts_t sched;
+  prv_cmdsprt_shunt_opts_t o = {0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &o, &sched, argc, argv) != 0){
+    return -1;
   }
+
+  fec_setshunt_param_t param;
+  param.channel = o.channel;
+  if(o.x1) param.shunt = 1;
+  else if(o.x10) param.shunt = 10;
+  else if(o.x100) param.shunt = 100;
+  else if(o.x1000) param.shunt = 1000;
   else{
     dbg(Warning, "CLI CMD Error\r\n");
     return -1;
   }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // save params
-    // schedule command ##########
-    fec_setshunt_param_t param;
-    param.channel = ch;
-    param.shunt = shunt;
-    cmdsched_encode_and_add(sched_time, setshunt_id, &param, sizeof(fec_setshunt_param_t));
-    // END schedule command ##########
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, setshunt_id, &param, sizeof(fec_setshunt_param_t));
   }
   else{
-    //immediate command
-    switch(shunt){
+    switch(param.shunt){
       case 1:
-        fec_set_shunt_1x(ch);
+        fec_set_shunt_1x(param.channel);
         break;
       case 10:
-        fec_set_shunt_10x(ch);
+        fec_set_shunt_10x(param.channel);
         break;
       case 100:
-        fec_set_shunt_100x(ch);
+        fec_set_shunt_100x(param.channel);
         break;
       case 1000:
-        fec_set_shunt_1000x(ch);
+        fec_set_shunt_1000x(param.channel);
         break;
-      default:
-        dbg(Warning, "CLI CMD Error\r\n");
     }
   }
   return 0;
 }
 
 int32_t cli_cmd_endseq_fn(int32_t argc, char** argv){
-  //scheduled or immediate
+  cmdsprt_sched_opts_t sched;
+  if(cmdsprt_parse_opts(NULL, 0, NULL, &sched, argc, argv) != 0){
+    return -1;
+  }
 
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    // schedule command ##########
-    cmdsched_encode_and_add(sched_time, end_of_sequence_id, 0, 0);
-    // END schedule command ##########
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, end_of_sequence_id, NULL, 0);
   }
   else{
-    //immediate command
     meas_end_of_sequence();
     HAL_Delay(1000);
     NVIC_SystemReset();
@@ -941,161 +773,84 @@ int32_t cli_cmd_endseq_fn(int32_t argc, char** argv){
 }
 
 int32_t cli_cmd_calib_illum_fn(int32_t argc, char** argv){
-  float illum;
-  float curr;
-  float a=0;
-  float b=1;
-  float c=0;
-  //parse illum
-  if(cmdsprt_is_arg("-illum", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-illum", &illum, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
-    return -1;
-  }
-  //parse curr
-  if(cmdsprt_is_arg("-i", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-i", &curr, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-illum", cmdsprt_opt_float, CMDSPRT_REQUIRED, ledctrl_calibillum_param_t, illum),
+      CMDSPRT_OPT("-i", cmdsprt_opt_float, CMDSPRT_REQUIRED, ledctrl_calibillum_param_t, curr),
+      //polynomial coefficients
+      CMDSPRT_OPT("-pa", cmdsprt_opt_float, CMDSPRT_OPTIONAL, ledctrl_calibillum_param_t, a),
+      CMDSPRT_OPT("-pb", cmdsprt_opt_float, CMDSPRT_OPTIONAL, ledctrl_calibillum_param_t, b),
+      CMDSPRT_OPT("-pc", cmdsprt_opt_float, CMDSPRT_OPTIONAL, ledctrl_calibillum_param_t, c),
+  };
+  cmdsprt_sched_opts_t sched;
+  ledctrl_calibillum_param_t param = {.a = 0, .b = 1, .c = 0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
     return -1;
   }
 
-  //parse polynomial coefficient a
-  if(cmdsprt_is_arg("-pa", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-pa", &a, argc, argv);
-  }
-  //parse polynomial coefficient b
-  if(cmdsprt_is_arg("-pb", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-pb", &b, argc, argv);
-  }
-  //parse polynomial coefficient c
-  if(cmdsprt_is_arg("-pc", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-pc", &c, argc, argv);
-  }
-
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    //save params
-    ledctrl_calibillum_param_t param;
-    param.illum = illum;
-    param.curr = curr;
-    param.a = a;
-    param.b = b;
-    param.c = c;
-    // schedule command ##########
-    cmdsched_encode_and_add(sched_time, calibillum_id, &param, sizeof(ledctrl_calibillum_param_t));
-    // END schedule command ##########
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, calibillum_id, &param, sizeof(ledctrl_calibillum_param_t));
   }
   else{
-    //immediate command
-    ledctrl_calibrate_illum_curr(illum, curr, a, b, c);
+    ledctrl_calibrate_illum_curr(param.illum, param.curr, param.a, param.b, param.c);
   }
   return 0;
 }
 
 int32_t cli_cmd_calib_illum_low_fn(int32_t argc, char** argv){
-  float a=0;
-  float b=1;
-  float c=0;
-
-  //parse polynomial coefficient a
-  if(cmdsprt_is_arg("-pa", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-pa", &a, argc, argv);
-  }
-  //parse polynomial coefficient b
-  if(cmdsprt_is_arg("-pb", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-pb", &b, argc, argv);
-  }
-  //parse polynomial coefficient c
-  if(cmdsprt_is_arg("-pc", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_float("-pc", &c, argc, argv);
+  static const cmdsprt_opt_t opts[] = {
+      //polynomial coefficients
+      CMDSPRT_OPT("-pa", cmdsprt_opt_float, CMDSPRT_OPTIONAL, ledctrl_calibillumL_param_t, a),
+      CMDSPRT_OPT("-pb", cmdsprt_opt_float, CMDSPRT_OPTIONAL, ledctrl_calibillumL_param_t, b),
+      CMDSPRT_OPT("-pc", cmdsprt_opt_float, CMDSPRT_OPTIONAL, ledctrl_calibillumL_param_t, c),
+  };
+  cmdsprt_sched_opts_t sched;
+  ledctrl_calibillumL_param_t param = {.a = 0, .b = 1, .c = 0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
+    return -1;
   }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    //save params
-    ledctrl_calibillumL_param_t param;
-    param.a = a;
-    param.b = b;
-    param.c = c;
-    // schedule command ##########
-    cmdsched_encode_and_add(sched_time, calibillumL_id, &param, sizeof(ledctrl_calibillumL_param_t));
-    // END schedule command ##########
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, calibillumL_id, &param, sizeof(ledctrl_calibillumL_param_t));
   }
   else{
-    //immediate command
-    ledctrl_calibrate_illum_curr_low(a, b, c);
+    ledctrl_calibrate_illum_curr_low(param.a, param.b, param.c);
   }
   return 0;
 }
 
 int32_t cli_cmd_setnumavg_fn(int32_t argc, char** argv){
-  uint32_t numavg = 0;
-  //parse numavg
-  if(cmdsprt_is_arg("-n", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-n", &numavg, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-n", cmdsprt_opt_u32, CMDSPRT_REQUIRED, meas_set_num_avg_param_t, numavg),
+  };
+  cmdsprt_sched_opts_t sched;
+  meas_set_num_avg_param_t param;
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
     return -1;
   }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    //save params
-    meas_set_num_avg_param_t param;
-    param.numavg = numavg;
-    // schedule command ##########
-    cmdsched_encode_and_add(sched_time, meas_set_numavg_id, &param, sizeof(meas_set_num_avg_param_t));
-    // END schedule command ##########
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_set_numavg_id, &param, sizeof(meas_set_num_avg_param_t));
   }
   else{
-    //immediate command
-    meas_set_num_avg(numavg);
+    meas_set_num_avg(param.numavg);
   }
   return 0;
-
 }
 
 int32_t cli_cmd_getnumavg_fn(int32_t argc, char** argv){
-  //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    //save params
+  cmdsprt_sched_opts_t sched;
+  if(cmdsprt_parse_opts(NULL, 0, NULL, &sched, argc, argv) != 0){
+    return -1;
+  }
 
-    // schedule command ##########
-    cmdsched_encode_and_add(sched_time, meas_get_numavg_id, 0, 0);
-    // END schedule command ##########
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_get_numavg_id, NULL, 0);
   }
   else{
-    //immediate command
     prv_meas_print_timestamp(usec_get_timestamp_64());
     mainser_printf("NUMAVG:%lu\r\n", meas_get_num_avg());
   }
@@ -1103,52 +858,36 @@ int32_t cli_cmd_getnumavg_fn(int32_t argc, char** argv){
 }
 
 int32_t cli_cmd_setdutsettle_fn(int32_t argc, char** argv){
-  uint32_t stltm = 0;
-  //parse settling time
-  if(cmdsprt_is_arg("-t", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-t", &stltm, argc, argv);
-  }
-  else{
-    dbg(Warning, "CLI CMD Error\r\n");
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-t", cmdsprt_opt_u32, CMDSPRT_REQUIRED, meas_set_stltm_param_t, settle_time),
+  };
+  cmdsprt_sched_opts_t sched;
+  meas_set_stltm_param_t param;
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
     return -1;
   }
 
   //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    //save params
-    meas_set_stltm_param_t param;
-    param.settle_time = stltm;
-    // schedule command ##########
-    cmdsched_encode_and_add(sched_time, meas_set_settle_time_id, &param, sizeof(meas_set_stltm_param_t));
-    // END schedule command ##########
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_set_settle_time_id, &param, sizeof(meas_set_stltm_param_t));
   }
   else{
-    //immediate command
-    meas_set_settling_time(stltm);
+    meas_set_settling_time(param.settle_time);
   }
   return 0;
 }
 
 int32_t cli_cmd_getdutsettle_fn(int32_t argc, char** argv){
-  //scheduled or immediate
-
-  if(cmdsprt_is_arg("-sched", argc, argv)){
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
-    //save params
+  cmdsprt_sched_opts_t sched;
+  if(cmdsprt_parse_opts(NULL, 0, NULL, &sched, argc, argv) != 0){
+    return -1;
+  }
 
-    // schedule command ##########
-    cmdsched_encode_and_add(sched_time, meas_get_settle_time_id, 0, 0);
-    // END schedule command ##########
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_get_settle_time_id, NULL, 0);
   }
   else{
-    //immediate command
     prv_meas_print_timestamp(usec_get_timestamp_64());
     mainser_printf("SETTLE_TIME:%lu\r\n", meas_get_settling_time());
   }
@@ -1156,67 +895,390 @@ int32_t cli_cmd_getdutsettle_fn(int32_t argc, char** argv){
 }
 
 int32_t cli_cmd_getnoise_fn(int32_t argc, char** argv){
-  uint32_t ch;
-  uint8_t vflag = 0;
-  uint8_t iflag = 0;
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, meas_get_noise_param_t, channel),
+      CMDSPRT_OPT("-VOLT", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, meas_get_noise_param_t, volt_flag),
+      CMDSPRT_OPT("-CURR", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, meas_get_noise_param_t, curr_flag),
+  };
+  cmdsprt_sched_opts_t sched;
+  meas_get_noise_param_t param = {.channel = 0, .volt_flag = 0, .curr_flag = 0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
+    return -1;
+  }
+  //-VOLT wins over -CURR, none measures both
+  if(param.volt_flag){
+    param.curr_flag = 0;
+  }
+  else if(!param.curr_flag){
+    param.volt_flag = 1;
+    param.curr_flag = 1;
+  }
 
-  if(cmdsprt_is_arg("-c", argc, argv)){
-    //channel argument present, parse
-    cmdsprt_parse_uint32("-c", &ch, argc, argv);
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_get_noise_id, &param, sizeof(meas_get_noise_param_t));
   }
   else{
-    ch = 0;
+    if(param.volt_flag){
+      meas_get_noise_volt(param.channel);
+    }
+    if(param.curr_flag){
+      meas_get_noise_curr(param.channel);
+    }
   }
+  return 0;
+}
 
-  if(cmdsprt_is_arg("-VOLT", argc, argv)){
-    vflag = 1;
+int32_t cli_cmd_schedjitter_fn(int32_t argc, char** argv){
+  cmdsched_print_jitter();
+  if(cmdsprt_is_arg("-reset", argc, argv)){
+    cmdsched_reset_jitter();
   }
-  else if(cmdsprt_is_arg("-CURR", argc, argv)){
-    iflag = 1;
+  return 0;
+}
+
+int32_t cli_cmd_schedbin_fn(int32_t argc, char** argv){
+  //main loop feeds serial to batch receiver until block is received or timeout
+  cmdsched_batch_start();
+  return 0;
+}
+
+int32_t cli_cmd_schedtrace_fn(int32_t argc, char** argv){
+  if(cmdsprt_is_arg("-dump", argc, argv)){
+    cmdtrace_dump();
   }
   else{
-    vflag = 1;
-    iflag = 1;
+    cmdtrace_print_hist();
+    cmdtrace_print_worst();
   }
+  if(cmdsprt_is_arg("-reset", argc, argv)){
+    cmdtrace_reset();
+  }
+  return 0;
+}
 
+int32_t cli_cmd_schedstat_fn(int32_t argc, char** argv){
+  cmdsched_print_stats();
+  cmdsched_print_duration_scales();
+  return 0;
+}
 
-  //scheduled or immediate
+int32_t cli_cmd_schedcancel_fn(int32_t argc, char** argv){
+  uint32_t tag = CMDSCHED_NO_TAG;
+  if(cmdsprt_is_arg("-all", argc, argv)){
+    tag = CMDSCHED_NO_TAG;
+  }
+  else if(cmdsprt_parse_uint32("-tag", &tag, argc, argv) != 0 || tag == CMDSCHED_NO_TAG){
+    mainser_printf("SCHEDCANCEL_FAIL\r\n");
+    return 0;
+  }
+  uint32_t removed = cmdsched_cancel(tag);
+  mainser_printf("SCHEDCANCEL:%lu\r\n", removed);
+  return 0;
+}
 
-  if(cmdsprt_is_arg("-sched", argc, argv)) {
-    //scheduled command
-    uint64_t sched_time;
-    cmdsprt_parse_uint64("-sched", &sched_time, argc, argv);
+int32_t cli_cmd_seqload_fn(int32_t argc, char** argv){
+  if(seqvm_is_running()){
+    mainser_printf("SEQLOAD_FAIL:RUNNING\r\n");
+    return 0;
+  }
+  //main loop feeds serial to batch receiver until block is received or timeout
+  cmdsched_batch_receive("SEQLOAD", seqvm_load);
+  return 0;
+}
 
-    // schedule command ##########
-    meas_get_noise_param_t param;
-    param.channel = ch;
-    param.volt_flag = vflag;
-    param.curr_flag = iflag;
-    cmdsched_encode_and_add(sched_time, meas_get_noise_id, &param, sizeof(meas_get_noise_param_t));
-    // END schedule command ##########
+int32_t cli_cmd_seqrun_fn(int32_t argc, char** argv){
+  if(seqvm_run() != 0){
+    mainser_printf("SEQRUN_FAIL\r\n");
+    return 0;
+  }
+  mainser_printf("SEQRUN_OK\r\n");
+  return 0;
+}
+
+int32_t cli_cmd_seqstop_fn(int32_t argc, char** argv){
+  seqvm_stop();
+  mainser_printf("SEQSTOP_OK\r\n");
+  return 0;
+}
+
+int32_t cli_cmd_seqstat_fn(int32_t argc, char** argv){
+  seqvm_print_status();
+  return 0;
+}
+
+int32_t cli_cmd_taskstat_fn(int32_t argc, char** argv){
+  tasksch_print_stats();
+  if(cmdsprt_is_arg("-reset", argc, argv)){
+    tasksch_reset_stats();
+  }
+  return 0;
+}
+
+//LED waveform segment options
+typedef struct {
+    float illum;
+    float illum_low;
+    float offset;
+    float amplitude;
+    float freq_hz;
+    uint32_t period_us;
+    float duty;
+    uint32_t dur_us;
+} prv_cmdsprt_wave_opts_t;
+
+static int32_t prv_cmdsprt_wave_result(int8_t ret){
+  if(ret != 0){
+    mainser_printf("WAVE_FAIL\r\n");
+    return 0;
+  }
+  mainser_printf("WAVE_OK:%lu\r\n", ledwave_get_num_points());
+  return 0;
+}
+
+int32_t cli_cmd_waveclear_fn(int32_t argc, char** argv){
+  ledwave_clear();
+  return prv_cmdsprt_wave_result(ledwave_is_playing() ? -1 : 0);
+}
+
+int32_t cli_cmd_wavestep_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-illum", cmdsprt_opt_float, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, illum),
+      CMDSPRT_OPT("-t", cmdsprt_opt_u32, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, dur_us),
+  };
+  cmdsprt_sched_opts_t sched;
+  prv_cmdsprt_wave_opts_t o = {0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &o, &sched, argc, argv) != 0){
+    return -1;
+  }
+  return prv_cmdsprt_wave_result(ledwave_add_step(o.illum, o.dur_us));
+}
+
+int32_t cli_cmd_waveflash_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-illum", cmdsprt_opt_float, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, illum),
+      CMDSPRT_OPT("-t", cmdsprt_opt_u32, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, dur_us),
+  };
+  cmdsprt_sched_opts_t sched;
+  prv_cmdsprt_wave_opts_t o = {0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &o, &sched, argc, argv) != 0){
+    return -1;
+  }
+  return prv_cmdsprt_wave_result(ledwave_add_flash(o.illum, o.dur_us));
+}
+
+int32_t cli_cmd_waveramp_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-illum", cmdsprt_opt_float, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, illum),
+      CMDSPRT_OPT("-t", cmdsprt_opt_u32, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, dur_us),
+  };
+  cmdsprt_sched_opts_t sched;
+  prv_cmdsprt_wave_opts_t o = {0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &o, &sched, argc, argv) != 0){
+    return -1;
+  }
+  return prv_cmdsprt_wave_result(ledwave_add_ramp(o.illum, o.dur_us));
+}
+
+int32_t cli_cmd_wavesine_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-off", cmdsprt_opt_float, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, offset),
+      CMDSPRT_OPT("-amp", cmdsprt_opt_float, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, amplitude),
+      CMDSPRT_OPT("-f", cmdsprt_opt_float, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, freq_hz),
+      CMDSPRT_OPT("-t", cmdsprt_opt_u32, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, dur_us),
+  };
+  cmdsprt_sched_opts_t sched;
+  prv_cmdsprt_wave_opts_t o = {0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &o, &sched, argc, argv) != 0){
+    return -1;
+  }
+  return prv_cmdsprt_wave_result(ledwave_add_sine(o.offset, o.amplitude, o.freq_hz, o.dur_us));
+}
+
+int32_t cli_cmd_wavepwm_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-illum", cmdsprt_opt_float, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, illum),
+      CMDSPRT_OPT("-low", cmdsprt_opt_float, CMDSPRT_OPTIONAL, prv_cmdsprt_wave_opts_t, illum_low),
+      CMDSPRT_OPT("-p", cmdsprt_opt_u32, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, period_us),
+      CMDSPRT_OPT("-d", cmdsprt_opt_float, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, duty),
+      CMDSPRT_OPT("-t", cmdsprt_opt_u32, CMDSPRT_REQUIRED, prv_cmdsprt_wave_opts_t, dur_us),
+  };
+  cmdsprt_sched_opts_t sched;
+  prv_cmdsprt_wave_opts_t o = {0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &o, &sched, argc, argv) != 0){
+    return -1;
+  }
+  return prv_cmdsprt_wave_result(ledwave_add_pwm(o.illum, o.illum_low, o.period_us, o.duty, o.dur_us));
+}
+
+int32_t cli_cmd_waveplay_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, meas_wave_play_param_t, channel),
+      CMDSPRT_OPT("-loop", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, meas_wave_play_param_t, loop),
+      CMDSPRT_OPT("-DUMP", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, meas_wave_play_param_t, dump),
+  };
+  cmdsprt_sched_opts_t sched;
+  meas_wave_play_param_t param = {.channel = 0, .loop = 0, .dump = 0};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
+    return -1;
+  }
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_wave_play_id, &param, sizeof(meas_wave_play_param_t));
   }
   else{
-    //immediate command
-    if(vflag) {
-      meas_get_noise_volt(ch);
-    }
-    if(iflag) {
-      meas_get_noise_curr(ch);
+    if(meas_wave_play(param.channel, param.loop, param.dump) != 0){
+      return -1;
     }
   }
+  return 0;
+}
 
-
+int32_t cli_cmd_wavestop_fn(int32_t argc, char** argv){
+  ledwave_stop();
+  mainser_printf("WAVESTOP_OK\r\n");
   return 0;
+}
 
+int32_t cli_cmd_wavestat_fn(int32_t argc, char** argv){
+  ledwave_print_status();
+  return 0;
 }
 
+int32_t cli_cmd_sunsvoc_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, meas_sunsvoc_param_t, channel),
+      CMDSPRT_OPT("-imin", cmdsprt_opt_float, CMDSPRT_REQUIRED, meas_sunsvoc_param_t, illum_min),
+      CMDSPRT_OPT("-imax", cmdsprt_opt_float, CMDSPRT_REQUIRED, meas_sunsvoc_param_t, illum_max),
+      CMDSPRT_OPT("-n", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, meas_sunsvoc_param_t, num_steps),
+      CMDSPRT_OPT("-t", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, meas_sunsvoc_param_t, step_us),
+  };
+  cmdsprt_sched_opts_t sched;
+  meas_sunsvoc_param_t param = {.channel = 0, .num_steps = MEAS_SUNSVOC_DEF_STEPS, .step_us = MEAS_SUNSVOC_DEF_STEP_US};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
+    return -1;
+  }
 
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_sunsvoc_id, &param, sizeof(meas_sunsvoc_param_t));
+  }
+  else{
+    if(meas_sunsvoc(param.channel, param.illum_min, param.illum_max, param.num_steps, param.step_us) != 0){
+      return -1;
+    }
+  }
+  return 0;
+}
 
+int32_t cli_cmd_lockin_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_OPTIONAL, meas_lockin_sweep_param_t, channel),
+      CMDSPRT_OPT("-CURR", cmdsprt_opt_flag, CMDSPRT_OPTIONAL, meas_lockin_sweep_param_t, curr),
+      CMDSPRT_OPT("-bias", cmdsprt_opt_float, CMDSPRT_REQUIRED, meas_lockin_sweep_param_t, bias),
+      CMDSPRT_OPT("-amp", cmdsprt_opt_float, CMDSPRT_REQUIRED, meas_lockin_sweep_param_t, amp),
+      CMDSPRT_OPT("-fstart", cmdsprt_opt_float, CMDSPRT_REQUIRED, meas_lockin_sweep_param_t, f_start),
+      CMDSPRT_OPT("-fstop", cmdsprt_opt_float, CMDSPRT_OPTIONAL, meas_lockin_sweep_param_t, f_stop),
+      CMDSPRT_OPT("-n", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, meas_lockin_sweep_param_t, num_freq),
+      CMDSPRT_OPT("-settle", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, meas_lockin_sweep_param_t, settle_periods),
+      CMDSPRT_OPT("-avg", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, meas_lockin_sweep_param_t, num_avg),
+  };
+  cmdsprt_sched_opts_t sched;
+  meas_lockin_sweep_param_t param = {.channel = 0, .curr = 0, .f_stop = 0, .num_freq = 1,
+                                     .settle_periods = MEAS_LOCKIN_DEF_SETTLE_PERIODS, .num_avg = 1};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &param, &sched, argc, argv) != 0){
+    return -1;
+  }
+  //single frequency without -fstop
+  if(param.f_stop == 0.0f){
+    param.f_stop = param.f_start;
+  }
 
+  //scheduled or immediate
+  if(sched.sched){
+    prv_cmdsprt_schedule(&sched, meas_lockin_sweep_id, &param, sizeof(meas_lockin_sweep_param_t));
+  }
+  else{
+    if(meas_lockin_sweep(param.channel, param.curr, param.bias, param.amp, param.f_start, param.f_stop,
+                         param.num_freq, param.settle_periods, param.num_avg) != 0){
+      return -1;
+    }
+  }
+  return 0;
+}
 
+//LED droop options
+typedef struct {
+    uint8_t channel;
+    float illum;
+    uint32_t flash_dur_us;
+    float droop_per_sun;
+    float tau_us;
+} prv_cmdsprt_leddroop_opts_t;
+
+int32_t cli_cmd_leddroopcal_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-c", cmdsprt_opt_u8, CMDSPRT_REQUIRED, prv_cmdsprt_leddroop_opts_t, channel),
+      CMDSPRT_OPT("-illum", cmdsprt_opt_float, CMDSPRT_OPTIONAL, prv_cmdsprt_leddroop_opts_t, illum),
+      CMDSPRT_OPT("-t", cmdsprt_opt_u32, CMDSPRT_OPTIONAL, prv_cmdsprt_leddroop_opts_t, flash_dur_us),
+  };
+  cmdsprt_sched_opts_t sched;
+  prv_cmdsprt_leddroop_opts_t o = {.illum = MEAS_LEDDROOP_DEF_ILLUM, .flash_dur_us = MEAS_LEDDROOP_DEF_DUR_US};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &o, &sched, argc, argv) != 0){
+    return -1;
+  }
+  if(meas_led_droop_calibrate(o.channel, o.illum, o.flash_dur_us) != 0){
+    mainser_printf("LEDDROOP_CAL_FAIL\r\n");
+    return -1;
+  }
+  return 0;
+}
 
+int32_t cli_cmd_setleddroop_fn(int32_t argc, char** argv){
+  static const cmdsprt_opt_t opts[] = {
+      CMDSPRT_OPT("-k", cmdsprt_opt_float, CMDSPRT_REQUIRED, prv_cmdsprt_leddroop_opts_t, droop_per_sun),
+      CMDSPRT_OPT("-tau", cmdsprt_opt_float, CMDSPRT_OPTIONAL, prv_cmdsprt_leddroop_opts_t, tau_us),
+  };
+  cmdsprt_sched_opts_t sched;
+  prv_cmdsprt_leddroop_opts_t o = {.tau_us = ledctrl_get_droop_tau_us()};
+  if(cmdsprt_parse_opts(opts, CMDSPRT_NUM_OPTS(opts), &o, &sched, argc, argv) != 0){
+    return -1;
+  }
+  ledctrl_set_droop_model(o.droop_per_sun, o.tau_us);
+  ledctrl_print_droop_model();
+  return 0;
+}
+
+int32_t cli_cmd_getleddroop_fn(int32_t argc, char** argv){
+  ledctrl_print_droop_model();
+  return 0;
+}
 
+int32_t cli_cmd_timesync_fn(int32_t argc, char** argv){
+  uint64_t t1;
+  uint64_t t4 = 0;
+  if(cmdsprt_is_arg("-reset", argc, argv)){
+    clksync_reset();
+    mainser_printf("TIMESYNC_RESET_OK\r\n");
+    return 0;
+  }
+  if(cmdsprt_parse_uint64("-t1", &t1, argc, argv) != 0){
+    dbg(Warning, "CLI CMD Error\r\n");
+    return -1;
+  }
+  uint8_t has_t4 = cmdsprt_is_arg("-t4", argc, argv);
+  if(has_t4 && cmdsprt_parse_uint64("-t4", &t4, argc, argv) != 0){
+    dbg(Warning, "CLI CMD Error\r\n");
+    return -1;
+  }
+  clksync_exchange(t1, has_t4, t4);
+  return 0;
+}
 
+int32_t cli_cmd_timesyncstat_fn(int32_t argc, char** argv){
+  clksync_print_status();
+  return 0;
+}
 
 int8_t cmdsprt_parse_float(const char* arg_str, float* float_out, int32_t argc, char** argv) {
   for (int i = 0; i < argc - 1; i++) {  // -1 because we are looking for the next arg after match
@@ -1271,6 +1333,126 @@ int8_t cmdsprt_parse_uint64(const char* arg_str, uint64_t* uint_out, int32_t arg
   return -1;
 }
 
+//converts one option value and stores it to field. Returns 0 on success, -1 if value is invalid
+static int8_t prv_cmdsprt_store_value(uint8_t type, const char *str, uint8_t *field){
+  char *endptr;
+  switch(type){
+    case cmdsprt_opt_u8:
+    case cmdsprt_opt_u32: {
+      unsigned long value = strtoul(str, &endptr, 10);
+      if(endptr == str || *endptr != '\0'){
+        return -1;
+      }
+      if(type == cmdsprt_opt_u8){
+        if(value > UINT8_MAX){
+          return -1;
+        }
+        *field = (uint8_t)value;
+      }
+      else{
+        uint32_t v = (uint32_t)value;
+        memcpy(field, &v, sizeof(v));
+      }
+      return 0;
+    }
+    case cmdsprt_opt_float: {
+      float value = strtof(str, &endptr);
+      if(endptr == str || *endptr != '\0'){
+        return -1;
+      }
+      memcpy(field, &value, sizeof(value));
+      return 0;
+    }
+    default:
+      return -1;
+  }
+}
+
+/**
+ * @brief parses argv in one pass. Options from table are written to out struct, -sched and -tag to sched.
+ * Options not given keep the value out had before, so set defaults first. Unknown args are ignored.
+ * @param opts option table of cmd (max 32 options), NULL if cmd has only -sched
+ * @return 0 on success, -1 (and CLI CMD Error) if a value is invalid or a required option is missing
+ */
+int8_t cmdsprt_parse_opts(const cmdsprt_opt_t *opts, uint8_t num_opts, void *out, cmdsprt_sched_opts_t *sched,
+                          int32_t argc, char** argv){
+  uint32_t found = 0;
+  sched->sched = 0;
+  sched->sched_time = 0;
+  sched->tag = CMDSCHED_NO_TAG;
+
+  //argv[0] is cmd name
+  for(int32_t i = 1; i < argc; i++){
+    const char *arg = argv[i];
+    const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if(arg[0] != '-'){
+      continue;
+    }
+
+    //-hsched: time in host time, needs timesync
+    uint8_t host_time = (strcmp(arg, "-hsched") == 0);
+    if(host_time || strcmp(arg, "-sched") == 0){
+      char *endptr;
+      if(value == NULL){
+        dbg(Warning, "CLI CMD Error\r\n");
+        return -1;
+      }
+      sched->sched_time = strtoull(value, &endptr, 10);
+      if(endptr == value || *endptr != '\0'){
+        dbg(Warning, "CLI CMD Error\r\n");
+        return -1;
+      }
+      if(host_time){
+        if(!clksync_is_synced()){
+          dbg(Warning, "-hsched needs timesync\n");
+          return -1;
+        }
+        sched->sched_time = clksync_host_to_dev(sched->sched_time);
+      }
+      sched->sched = 1;
+      i++;
+      continue;
+    }
+    if(strcmp(arg, "-tag") == 0){
+      uint32_t tag;
+      if(value == NULL || prv_cmdsprt_store_value(cmdsprt_opt_u32, value, (uint8_t*)&tag) != 0){
+        dbg(Warning, "bad -tag value, cmd not tagged\n");
+        continue;
+      }
+      sched->tag = tag;
+      i++;
+      continue;
+    }
+
+    for(uint8_t o = 0; o < num_opts; o++){
+      if(strcmp(arg, opts[o].name) != 0){
+        continue;
+      }
+      uint8_t *field = (uint8_t*)out + opts[o].offset;
+      if(opts[o].type == cmdsprt_opt_flag){
+        *field = 1;
+      }
+      else{
+        if(value == NULL || prv_cmdsprt_store_value(opts[o].type, value, field) != 0){
+          dbg(Warning, "CLI CMD Error\r\n");
+          return -1;
+        }
+        i++;
+      }
+      found |= 1UL << o;
+      break;
+    }
+  }
+
+  for(uint8_t o = 0; o < num_opts; o++){
+    if(opts[o].required && !(found & (1UL << o))){
+      dbg(Warning, "CLI CMD Error\r\n");
+      return -1;
+    }
+  }
+  return 0;
+}
+
 //checks if the number of arguments is correct
 uint8_t cmdsprt_check_argnum( int32_t argnum, int32_t argc){
   return (argc == argnum);
@@ -1286,6 +1468,65 @@ uint8_t cmdsprt_is_arg(const char* arg_str, int32_t argc, char** argv) {
   return 0;  // Argument not found
 }
 
+/**
+ * @brief finds -id #n# in cmd line (modifies line)
+ * @return request id, CMDSCHED_NO_REQ_ID if there is none or it is invalid
+ */
+static uint32_t prv_cmdsprt_find_req_id(char *line){
+  char *save;
+  for(char *tok = strtok_r(line, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save)){
+    if(strcmp(tok, "-id") != 0){
+      continue;
+    }
+    char *value = strtok_r(NULL, " ", &save);
+    char *endptr;
+    unsigned long id = (value != NULL) ? strtoul(value, &endptr, 10) : 0;
+    if(value == NULL || endptr == value || *endptr != '\0' || id == CMDSCHED_NO_REQ_ID){
+      dbg(Warning, "bad -id value, response not tagged\n");
+      return CMDSCHED_NO_REQ_ID;
+    }
+    return (uint32_t)id;
+  }
+  return CMDSCHED_NO_REQ_ID;
+}
+
+/**
+ * @brief feeds one char from main serial to CLI. Executed cmd lines are recorded in cmd trace.
+ * CMDSPRT_CMD_SEPARATOR ends a cmd like end of line, so several cmds can be sent in one line.
+ * Output of a cmd with -id #n# (and of its scheduled execution) has "#n:" in front of every line.
+ */
+void cmdsprt_input(char c){
+  static char line[LWSHELL_CFG_MAX_INPUT_LEN + 1];
+  static uint8_t line_len = 0;
+  if(c == CMDSPRT_CMD_SEPARATOR){
+    c = '\n';
+  }
+  if(c != '\r' && c != '\n'){
+    //keep a copy of what lwshell keeps in its buffer
+    if(c >= 0x20 && c < 0x7F && line_len < LWSHELL_CFG_MAX_INPUT_LEN){
+      line[line_len++] = c;
+    }
+    else if((c == 0x08 || c == 0x7F) && line_len > 0){
+      line_len--;
+    }
+    lwshell_input(&c, 1);
+    return;
+  }
+  line[line_len] = '\0';
+  prv_cmdsprt_req_id = prv_cmdsprt_find_req_id(line);
+  mainser_set_resp_id(prv_cmdsprt_req_id);
+  uint64_t t_start = usec_get_timestamp_64();
+  lwshell_input(&c, 1);
+  if(line_len > 0){
+    cmdtrace_record(CMDTRACE_ID_CLI, t_start, t_start, t_start, usec_get_timestamp_64());
+  }
+  line_len = 0;
+}
+
 void cmdsprt_request_new_cmds(void){
+  //running sequence feeds the queue itself
+  if(seqvm_is_running()){
+    return;
+  }
   mainser_printf("REQ_SCHED_CMD\r\n");
 }
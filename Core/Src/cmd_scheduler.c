@@ -3,67 +3,391 @@
 //
 
 #include "cmd_scheduler.h"
+#include "cmd_trace.h"
+#include "led_wave.h"
 #include "UserGPIO.h"
 
 //Scheduler running status flag
 static uint8_t sch_running=0;
 #define isSchRunning() (sch_running == 1) //safety macro
 
-// time of last scheduled cmd for chronological scheduling check
-static uint64_t cmdsched_last_scheduled_time = 0;
+// Statically allocated queue. Cmds are stored as variable length records in an arena:
+//   uint8 cmd_id | uint8 params_len (bit7: tag, bit6: req id present) | varint exec_time delta |
+//   [uint32 tag] | [uint32 req_id] | params
+// exec_time is stored as zigzag varint relative to prv_cmdsched_q_base (time of first cmd put in empty queue).
+// New records are appended at the end of arena. Popped/canceled records are only marked dead, space is
+// reclaimed by compaction when the end of arena is reached. Compaction keeps the order of records, so arena
+// order is always the order in which cmds were added.
+// Order is kept by an index of record offsets sorted by exec_time, latest first (earliest at the end, pop is O(1)).
+// Position of a new cmd and its neighbours (overlap check) are found by binary search, O(log n).
+// Cmds with same exec_time keep the order in which they were added.
+static uint8_t cmdsched_q_arena[CMDSCHED_ARENA_SIZE];
+static uint16_t cmdsched_q_idx[CMDSCHED_QUEUE_SIZE];
+static uint32_t cmdsched_q_len = 0;
+static uint32_t cmdsched_q_top = 0;         //end of used part of arena
+static uint32_t cmdsched_q_live_bytes = 0;  //bytes used by records still in queue
+static uint64_t cmdsched_q_base = 0;
 
-// Statically allocated FIFO queue
-static cmd_sched_t cmdsched_q_queue[CMDSCHED_QUEUE_SIZE];
+//occupancy statistics
+static uint32_t cmdsched_q_peak_count = 0;
+static uint32_t cmdsched_q_peak_bytes = 0;
+static uint32_t cmdsched_q_compactions = 0;
 
-// Indices for front and rear of the queue, initialized to 0
-static int cmdsched_q_front = 0;
-static int cmdsched_q_rear = 0;
+#define CMDSCHED_Q_DEAD 0xFF        //cmd_id of removed record
+#define CMDSCHED_Q_HAS_TAG 0x80     //flags in params_len byte
+#define CMDSCHED_Q_HAS_REQ_ID 0x40
+#define CMDSCHED_Q_LEN_MASK 0x3F
+#define CMDSCHED_Q_HEADER_LEN 2
+#define CMDSCHED_Q_REC_MAX_LEN (CMDSCHED_Q_HEADER_LEN + 10 + 4 + 4 + CMDSCHED_PARAM_BUFF_LEN)
+#define CMDSCHED_Q_REC_TYPICAL_LEN 12 //header, 3 byte time delta, 7 bytes params. For free space estimate of empty queue
+
+_Static_assert(CMDSCHED_ARENA_SIZE <= 0x10000, "arena offsets are 16 bit");
+_Static_assert(CMDSCHED_PARAM_BUFF_LEN <= CMDSCHED_Q_LEN_MASK, "params_len shares byte with flags");
+
+static const cmdsched_cmd_desc_t* prv_cmdsched_get_desc(meas_funct_id cmd_id);
 
 //scheduled cmd queue functions ########################################################
-void cmdsched_q_push(cmd_sched_t item) {
-  if (cmdsched_q_count() == CMDSCHED_QUEUE_SIZE) {
-    // Queue is full, you might want to handle this case, e.g., by logging an error or discarding the item
-    return;
+static uint32_t prv_cmdsched_q_put_varint(uint8_t *buff, uint64_t val){
+  uint32_t n = 0;
+  while(val >= 0x80){
+    buff[n++] = (uint8_t)val | 0x80;
+    val >>= 7;
   }
-  cmdsched_q_queue[cmdsched_q_rear] = item;
-  cmdsched_q_rear = (cmdsched_q_rear + 1) % CMDSCHED_QUEUE_SIZE;  // wrap around if necessary
+  buff[n++] = (uint8_t)val;
+  return n;
+}
+
+static uint32_t prv_cmdsched_q_get_varint(const uint8_t *buff, uint64_t *val){
+  uint32_t n = 0;
+  uint8_t shift = 0;
+  *val = 0;
+  do{
+    *val |= (uint64_t)(buff[n] & 0x7F) << shift;
+    shift += 7;
+  } while(buff[n++] & 0x80);
+  return n;
+}
+
+/**
+ * @brief encodes cmd into record
+ * @return record length
+ */
+static uint32_t prv_cmdsched_q_encode(uint8_t *rec, const cmd_sched_t *cmd, uint8_t params_len){
+  int64_t delta = (int64_t)(cmd->exec_time - cmdsched_q_base);
+  uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+  uint32_t n = 0;
+  rec[n++] = (uint8_t)cmd->cmd_id;
+  rec[n++] = params_len | (cmd->tag != CMDSCHED_NO_TAG ? CMDSCHED_Q_HAS_TAG : 0) |
+             (cmd->req_id != CMDSCHED_NO_REQ_ID ? CMDSCHED_Q_HAS_REQ_ID : 0);
+  n += prv_cmdsched_q_put_varint(&rec[n], zigzag);
+  if(cmd->tag != CMDSCHED_NO_TAG){
+    memcpy(&rec[n], &cmd->tag, sizeof(cmd->tag));
+    n += sizeof(cmd->tag);
+  }
+  if(cmd->req_id != CMDSCHED_NO_REQ_ID){
+    memcpy(&rec[n], &cmd->req_id, sizeof(cmd->req_id));
+    n += sizeof(cmd->req_id);
+  }
+  memcpy(&rec[n], cmd->params_buff, params_len);
+  return n + params_len;
+}
+
+/**
+ * @brief decodes record at offset. cmd can be NULL if only length is needed.
+ * @return record length
+ */
+static uint32_t prv_cmdsched_q_decode(uint32_t off, cmd_sched_t *cmd){
+  const uint8_t *rec = &cmdsched_q_arena[off];
+  uint8_t params_len = rec[1] & CMDSCHED_Q_LEN_MASK;
+  uint64_t zigzag;
+  uint32_t n = CMDSCHED_Q_HEADER_LEN;
+  n += prv_cmdsched_q_get_varint(&rec[n], &zigzag);
+  uint32_t tag = CMDSCHED_NO_TAG;
+  if(rec[1] & CMDSCHED_Q_HAS_TAG){
+    memcpy(&tag, &rec[n], sizeof(tag));
+    n += sizeof(tag);
+  }
+  uint32_t req_id = CMDSCHED_NO_REQ_ID;
+  if(rec[1] & CMDSCHED_Q_HAS_REQ_ID){
+    memcpy(&req_id, &rec[n], sizeof(req_id));
+    n += sizeof(req_id);
+  }
+  if(cmd != NULL){
+    int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->cmd_id = (meas_funct_id)rec[0];
+    cmd->exec_time = cmdsched_q_base + (uint64_t)delta;
+    cmd->tag = tag;
+    cmd->req_id = req_id;
+    memcpy(cmd->params_buff, &rec[n], params_len);
+  }
+  return n + params_len;
+}
+
+static uint64_t prv_cmdsched_q_rec_time(uint16_t off){
+  uint64_t zigzag;
+  prv_cmdsched_q_get_varint(&cmdsched_q_arena[off + CMDSCHED_Q_HEADER_LEN], &zigzag);
+  int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+  return cmdsched_q_base + (uint64_t)delta;
+}
+
+static uint32_t prv_cmdsched_q_rec_tag(uint16_t off){
+  const uint8_t *rec = &cmdsched_q_arena[off];
+  uint32_t tag = CMDSCHED_NO_TAG;
+  if(rec[1] & CMDSCHED_Q_HAS_TAG){
+    uint64_t dummy;
+    uint32_t n = CMDSCHED_Q_HEADER_LEN + prv_cmdsched_q_get_varint(&rec[CMDSCHED_Q_HEADER_LEN], &dummy);
+    memcpy(&tag, &rec[n], sizeof(tag));
+  }
+  return tag;
+}
+
+/**
+ * @brief record a runs before record b (same exec_time: the one added first, i.e. lower in arena)
+ */
+static uint8_t prv_cmdsched_q_before(uint16_t a, uint16_t b){
+  uint64_t ta = prv_cmdsched_q_rec_time(a);
+  uint64_t tb = prv_cmdsched_q_rec_time(b);
+  if(ta != tb){
+    return ta < tb;
+  }
+  return a < b;
+}
+
+/**
+ * @brief index position for a new cmd at time t: cmds before it run later, cmds from it on run at or before t. O(log n)
+ */
+static uint32_t prv_cmdsched_q_search(uint64_t t){
+  uint32_t lo = 0, hi = cmdsched_q_len;
+  while(lo < hi){
+    uint32_t mid = (lo + hi) / 2;
+    if(prv_cmdsched_q_rec_time(cmdsched_q_idx[mid]) > t){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/**
+ * @brief index position of queued record. O(log n)
+ */
+static uint32_t prv_cmdsched_q_find(uint16_t off){
+  uint32_t lo = 0, hi = cmdsched_q_len;
+  while(lo < hi){
+    uint32_t mid = (lo + hi) / 2;
+    if(prv_cmdsched_q_before(off, cmdsched_q_idx[mid])){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/**
+ * @brief moves live records to start of arena and updates index. Records keep their order, so index stays sorted
+ * while it holds a mix of moved and not yet moved offsets.
+ */
+static void prv_cmdsched_q_compact(void){
+  uint32_t src = 0, dst = 0;
+  while(src < cmdsched_q_top){
+    uint32_t rec_len = prv_cmdsched_q_decode(src, NULL);
+    if(cmdsched_q_arena[src] != CMDSCHED_Q_DEAD){
+      uint32_t i = prv_cmdsched_q_find((uint16_t)src);
+      memmove(&cmdsched_q_arena[dst], &cmdsched_q_arena[src], rec_len);
+      cmdsched_q_idx[i] = (uint16_t)dst;
+      dst += rec_len;
+    }
+    src += rec_len;
+  }
+  cmdsched_q_top = dst;
+  cmdsched_q_compactions++;
+}
+
+/**
+ * @brief marks record dead. Space at the end of arena is given back immediately.
+ */
+static void prv_cmdsched_q_free(uint16_t off){
+  uint32_t rec_len = prv_cmdsched_q_decode(off, NULL);
+  cmdsched_q_arena[off] = CMDSCHED_Q_DEAD;
+  cmdsched_q_live_bytes -= rec_len;
+  if(off + rec_len == cmdsched_q_top){
+    cmdsched_q_top = off;
+  }
+}
+
+int8_t cmdsched_q_push(cmd_sched_t item) {
+  const cmdsched_cmd_desc_t *desc = prv_cmdsched_get_desc(item.cmd_id);
+  uint8_t rec[CMDSCHED_Q_REC_MAX_LEN];
+  if (desc == NULL || cmdsched_q_len == CMDSCHED_QUEUE_SIZE) {
+    return -1;
+  }
+  if (cmdsched_q_len == 0) {
+    //empty queue, start new arena
+    cmdsched_q_top = 0;
+    cmdsched_q_base = item.exec_time;
+  }
+  uint32_t rec_len = prv_cmdsched_q_encode(rec, &item, desc->params_len);
+  if (cmdsched_q_top + rec_len > CMDSCHED_ARENA_SIZE) {
+    if (cmdsched_q_live_bytes + rec_len > CMDSCHED_ARENA_SIZE) {
+      return -1;
+    }
+    prv_cmdsched_q_compact();
+  }
+  memcpy(&cmdsched_q_arena[cmdsched_q_top], rec, rec_len);
+  //new record is the last one added, so it goes after queued cmds with the same exec_time
+  uint32_t i = prv_cmdsched_q_search(item.exec_time);
+  memmove(&cmdsched_q_idx[i + 1], &cmdsched_q_idx[i], (cmdsched_q_len - i) * sizeof(cmdsched_q_idx[0]));
+  cmdsched_q_idx[i] = (uint16_t)cmdsched_q_top;
+  cmdsched_q_top += rec_len;
+  cmdsched_q_live_bytes += rec_len;
+  cmdsched_q_len++;
+
+  if(cmdsched_q_len > cmdsched_q_peak_count) cmdsched_q_peak_count = cmdsched_q_len;
+  if(cmdsched_q_live_bytes > cmdsched_q_peak_bytes) cmdsched_q_peak_bytes = cmdsched_q_live_bytes;
+  return 0;
 }
 
 cmd_sched_t cmdsched_q_pop() {
-  if (cmdsched_q_count() == 0) {
+  cmd_sched_t item = {0};
+  if (cmdsched_q_len == 0) {
     // Queue is empty, returning an empty item
-    cmd_sched_t empty_item = {0, 0, {0}};
-    return empty_item;
+    return item;
   }
-  cmd_sched_t item = cmdsched_q_queue[cmdsched_q_front];
-  cmdsched_q_front = (cmdsched_q_front + 1) % CMDSCHED_QUEUE_SIZE;  // wrap around if necessary
+  uint16_t off = cmdsched_q_idx[cmdsched_q_len - 1];
+  prv_cmdsched_q_decode(off, &item);
+  prv_cmdsched_q_free(off);
+  cmdsched_q_len--;
   return item;
 }
 
 uint32_t cmdsched_q_count() {
-  if (cmdsched_q_rear >= cmdsched_q_front) {
-    return cmdsched_q_rear - cmdsched_q_front;
-  } else {
-    return cmdsched_q_rear + (CMDSCHED_QUEUE_SIZE - cmdsched_q_front);
-  }
+  return cmdsched_q_len;
+}
+
+/**
+ * @brief free arena bytes (fragmented space counts as free, it is reclaimed by compaction)
+ */
+uint32_t cmdsched_q_free_bytes() {
+  return CMDSCHED_ARENA_SIZE - cmdsched_q_live_bytes;
 }
 
+/**
+ * @brief estimated number of cmds that can still be added, based on average size of queued records (typical
+ * size if queue is empty). For reporting to host, adding is checked with prv_cmdsched_q_fits()
+ */
 uint32_t cmdsched_q_free_spaces() {
-  //todo: is -1 needed?
-  if(cmdsched_q_count() < CMDSCHED_QUEUE_SIZE-1){
-    return CMDSCHED_QUEUE_SIZE - cmdsched_q_count();
-  }
-  return 0;
+  uint32_t rec_len = (cmdsched_q_len > 0) ? (cmdsched_q_live_bytes + cmdsched_q_len - 1) / cmdsched_q_len
+                                          : CMDSCHED_Q_REC_TYPICAL_LEN;
+  uint32_t by_bytes = cmdsched_q_free_bytes() / rec_len;
+  uint32_t by_count = CMDSCHED_QUEUE_SIZE - cmdsched_q_len;
+  return (by_bytes < by_count) ? by_bytes : by_count;
+}
+
+/**
+ * @brief checks if cmds with total params length can surely be added (assumes largest possible records)
+ */
+static uint8_t prv_cmdsched_q_fits(uint32_t num, uint32_t params_bytes){
+  uint32_t max_bytes = num * (CMDSCHED_Q_REC_MAX_LEN - CMDSCHED_PARAM_BUFF_LEN) + params_bytes;
+  return (cmdsched_q_len + num <= CMDSCHED_QUEUE_SIZE) && (cmdsched_q_live_bytes + max_bytes <= CMDSCHED_ARENA_SIZE);
 }
 
 cmd_sched_t cmdsched_q_peek() {
-  if (cmdsched_q_count() == 0) {
+  cmd_sched_t item = {0};
+  if (cmdsched_q_len == 0) {
     // Queue is empty, returning an empty item
-    cmd_sched_t empty_item = {0, 0, {0}};
-    return empty_item;
+    return item;
   }
-  // Return the item at the front of the queue without removing it
-  return cmdsched_q_queue[cmdsched_q_front];
+  // Return the earliest item without removing it
+  prv_cmdsched_q_decode(cmdsched_q_idx[cmdsched_q_len - 1], &item);
+  return item;
+}
+
+/**
+ * @brief exec time of earliest cmd (cheaper than cmdsched_q_peek()). Queue must not be empty.
+ */
+static uint64_t prv_cmdsched_q_peek_time(void){
+  return prv_cmdsched_q_rec_time(cmdsched_q_idx[cmdsched_q_len - 1]);
+}
+
+/**
+ * @brief removes all queued cmds with given tag (or all cmds if all != 0). O(n), index stays sorted.
+ * @return number of removed cmds
+ */
+static uint32_t prv_cmdsched_q_remove(uint32_t tag, uint8_t all){
+  uint32_t kept = 0;
+  for(uint32_t i = 0; i < cmdsched_q_len; i++){
+    uint16_t off = cmdsched_q_idx[i];
+    cmd_sched_t item;
+    prv_cmdsched_q_decode(off, &item);
+    if(all || item.tag == tag){
+      prv_cmdsched_q_free(off);
+    }
+    else{
+      cmdsched_q_idx[kept++] = off;
+    }
+  }
+  uint32_t removed = cmdsched_q_len - kept;
+  cmdsched_q_len = kept;
+  return removed;
+}
+
+/**
+ * @brief checks if a cmd with given id is in queue
+ */
+static uint8_t prv_cmdsched_q_contains(meas_funct_id cmd_id){
+  for(uint32_t i = 0; i < cmdsched_q_len; i++){
+    if(cmdsched_q_arena[cmdsched_q_idx[i]] == (uint8_t)cmd_id){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief finds queued cmds closest before (exec_time <= t) and after (exec_time > t) time t. O(log n)
+ * Cmds with skip_tag are ignored (they are about to be replaced), so those are stepped over.
+ * @return bit 0: prev found, bit 1: next found
+ */
+static uint8_t prv_cmdsched_q_neighbours(uint64_t t, uint32_t skip_tag, cmd_sched_t *prev, cmd_sched_t *next){
+  uint32_t pos = prv_cmdsched_q_search(t);
+  uint8_t found = 0;
+  for(uint32_t i = pos; i < cmdsched_q_len; i++){
+    if(skip_tag == CMDSCHED_NO_TAG || prv_cmdsched_q_rec_tag(cmdsched_q_idx[i]) != skip_tag){
+      prv_cmdsched_q_decode(cmdsched_q_idx[i], prev);
+      found |= 1;
+      break;
+    }
+  }
+  for(uint32_t i = pos; i-- > 0;){
+    if(skip_tag == CMDSCHED_NO_TAG || prv_cmdsched_q_rec_tag(cmdsched_q_idx[i]) != skip_tag){
+      prv_cmdsched_q_decode(cmdsched_q_idx[i], next);
+      found |= 2;
+      break;
+    }
+  }
+  return found;
+}
+
+/**
+ * @brief prints queue occupancy statistics to main serial
+ */
+void cmdsched_print_stats(void){
+  mainser_printf("SCHED_STATS:\r\n");
+  mainser_printf("COUNT:%lu\r\n", cmdsched_q_len);
+  mainser_printf("MAX_COUNT:%lu\r\n", (uint32_t)CMDSCHED_QUEUE_SIZE);
+  mainser_printf("PEAK_COUNT:%lu\r\n", cmdsched_q_peak_count);
+  mainser_printf("BYTES:%lu\r\n", cmdsched_q_live_bytes);
+  mainser_printf("ARENA_BYTES:%lu\r\n", (uint32_t)CMDSCHED_ARENA_SIZE);
+  mainser_printf("PEAK_BYTES:%lu\r\n", cmdsched_q_peak_bytes);
+  mainser_printf("FRAGMENTED_BYTES:%lu\r\n", cmdsched_q_top - cmdsched_q_live_bytes);
+  mainser_printf("COMPACTIONS:%lu\r\n", cmdsched_q_compactions);
+  mainser_printf("FREE:%lu\r\n", cmdsched_q_free_spaces());
+  mainser_printf("FREE_BYTES:%lu\r\n", cmdsched_q_free_bytes());
 }
 
 void cmdsched_start() {
@@ -74,40 +398,670 @@ void cmdsched_start() {
   }
 }
 
+//cmd popped from the queue, waiting for its exec time (compare interrupt)
+static cmd_sched_t prv_cmdsched_armed_cmd;
+static uint8_t prv_cmdsched_armed = 0;
+static volatile uint8_t prv_cmdsched_due = 0;
+//time when compare interrupt actually fired
+static volatile uint64_t prv_cmdsched_trigger_time = 0;
+
+//descriptor of armed cmd
+static const cmdsched_cmd_desc_t* volatile prv_cmdsched_armed_desc = NULL;
+
+//lateness statistics for jitter report. trig: compare interrupt (trigger hook), exec: main loop exec hook
+static cmdsched_jitter_t prv_cmdsched_jitter_trig = {0, UINT32_MAX, 0, 0};
+static cmdsched_jitter_t prv_cmdsched_jitter_exec = {0, UINT32_MAX, 0, 0};
+
+//scheduled cmd hooks ##################################################
+//params point to cmd params_buff (cast to cmd param struct)
+
+static void prv_cmdsched_exec_mppt_start(const void *params){
+  const mppt_param_t *p = params;
+  mppt_start(p->channel, p->settling_time, p->report_every_xth_point);
+}
+
+static void prv_cmdsched_exec_mppt_resume(const void *params){
+  const mppt_param_t *p = params;
+  mppt_resume(p->channel, p->settling_time, p->report_every_xth_point);
+}
+
+static void prv_cmdsched_exec_mppt_stop(const void *params){
+  mppt_stop();
+}
+
+static void prv_cmdsched_exec_get_voltage(const void *params){
+  const meas_get_voltage_param_t *p = params;
+  meas_get_voltage(p->channel);
+}
+
+static void prv_cmdsched_exec_get_current(const void *params){
+  const meas_get_current_param_t *p = params;
+  meas_get_current(p->channel);
+}
+
+static void prv_cmdsched_exec_get_IV_point(const void *params){
+  const meas_get_IV_point_param_t *p = params;
+  meas_get_exact_IV_point(p->channel, p->voltage, p->disable_current_when_finished, p->noident);
+}
+
+static void prv_cmdsched_exec_get_iv_characteristic(const void *params){
+  const meas_get_iv_characteristic_param_t *p = params;
+  meas_get_iv_characteristic(p->channel, p->start_volt, p->end_volt, p->step_volt, p->step_time, p->Npoints_per_step);
+}
+
+static void prv_cmdsched_stage_sample_and_dump(const void *params){
+  const meas_sample_and_dump_param_t *p = params;
+  daq_prepare_for_sampling(p->num_samples);
+}
+
+static void prv_cmdsched_trig_start_sampling(const void *params){
+  daq_start_sampling();
+}
+
+static void prv_cmdsched_exec_volt_sample_and_dump(const void *params){
+  const meas_sample_and_dump_param_t *p = params;
+  //sampling started in compare interrupt
+  while(!daq_is_sampling_done());
+  prv_meas_dump_from_buffer_human_readable_volt(p->channel, p->num_samples);
+}
+
+static void prv_cmdsched_exec_curr_sample_and_dump(const void *params){
+  const meas_sample_and_dump_param_t *p = params;
+  //sampling started in compare interrupt
+  while(!daq_is_sampling_done());
+  prv_meas_dump_from_buffer_human_readable_curr(p->channel, p->num_samples);
+}
+
+static void prv_cmdsched_exec_iv_sample_and_dump(const void *params){
+  const meas_sample_and_dump_param_t *p = params;
+  //sampling started in compare interrupt
+  while(!daq_is_sampling_done());
+  prv_meas_dump_from_buffer_human_readable_iv(p->channel, p->num_samples);
+}
+
+static void prv_cmdsched_stage_set_current(const void *params){
+  const ledctrl_set_current_param_t *p = params;
+  ledctrl_stage_current(p->current);
+}
+
+static void prv_cmdsched_stage_set_illum(const void *params){
+  const ledctrl_set_illum_param_t *p = params;
+  ledctrl_stage_illum(p->illum);
+}
+
+static void prv_cmdsched_trig_led_apply(const void *params){
+  ledctrl_apply_staged();
+}
+
+static void prv_cmdsched_exec_set_illum(const void *params){
+  const ledctrl_set_illum_param_t *p = params;
+  //illumination already set in compare interrupt, only report
+  ledctrl_print_illum(p->illum, prv_cmdsched_trigger_time);
+}
+
+static void prv_cmdsched_stage_flashmeasure_dumpbuffer(const void *params){
+  const meas_flashmeasure_dumpbuffer_param_t *p = params;
+  meas_flashmeasure_dumpbuffer_stage(p->illum, p->flash_dur_us);
+}
+
+static void prv_cmdsched_trig_flashmeasure_dumpbuffer(const void *params){
+  meas_flashmeasure_dumpbuffer_trigger();
+}
+
+static void prv_cmdsched_exec_flashmeasure_dumpbuffer(const void *params){
+  const meas_flashmeasure_dumpbuffer_param_t *p = params;
+  meas_flashmeasure_dumpbuffer_finish(p->channel);
+}
+
+static void prv_cmdsched_stage_flashmeasure_burst(const void *params){
+  const meas_flashmeasure_burst_param_t *p = params;
+  meas_flashmeasure_burst_stage(p->channel, p->illum, p->flash_dur_us, p->num_flashes, p->period_us);
+}
+
+static void prv_cmdsched_exec_flashmeasure_burst(const void *params){
+  meas_flashmeasure_burst_finish();
+}
+
+static void prv_cmdsched_stage_flashmeasure_ets(const void *params){
+  const meas_flashmeasure_ets_param_t *p = params;
+  meas_flashmeasure_ets_stage(p->channel, p->illum, p->flash_dur_us, p->num_phases, p->num_flashes, p->period_us);
+}
+
+static void prv_cmdsched_stage_flashmeasure_adaptive(const void *params){
+  const meas_flashmeasure_adaptive_param_t *p = params;
+  meas_flashmeasure_adaptive_stage(p->illum, p->max_dur_us);
+}
+
+static void prv_cmdsched_exec_flashmeasure_adaptive(const void *params){
+  const meas_flashmeasure_adaptive_param_t *p = params;
+  meas_flashmeasure_adaptive_finish(p->channel, p->illum, p->tol_v);
+}
+
+static void prv_cmdsched_stage_wave_play(const void *params){
+  const meas_wave_play_param_t *p = params;
+  meas_wave_play_stage(p->loop, p->dump);
+}
+
+static void prv_cmdsched_trig_wave_play(const void *params){
+  const meas_wave_play_param_t *p = params;
+  meas_wave_play_trigger(p->dump);
+}
+
+static void prv_cmdsched_exec_wave_play(const void *params){
+  const meas_wave_play_param_t *p = params;
+  meas_wave_play_finish(p->channel, p->loop, p->dump);
+}
+
+static void prv_cmdsched_exec_lockin_sweep(const void *params){
+  const meas_lockin_sweep_param_t *p = params;
+  meas_lockin_sweep(p->channel, p->curr, p->bias, p->amp, p->f_start, p->f_stop, p->num_freq, p->settle_periods, p->num_avg);
+}
+
+static void prv_cmdsched_stage_sunsvoc(const void *params){
+  const meas_sunsvoc_param_t *p = params;
+  meas_sunsvoc_stage(p->illum_min, p->illum_max, p->num_steps, p->step_us);
+}
+
+static void prv_cmdsched_trig_sunsvoc(const void *params){
+  meas_sunsvoc_trigger();
+}
+
+static void prv_cmdsched_exec_sunsvoc(const void *params){
+  const meas_sunsvoc_param_t *p = params;
+  meas_sunsvoc_finish(p->channel, p->illum_min, p->illum_max, p->num_steps);
+}
+
+static void prv_cmdsched_stage_flashmeasure_flat(const void *params){
+  const meas_flashmeasure_dumpbuffer_param_t *p = params;
+  meas_flashmeasure_flat_stage(p->illum, p->flash_dur_us);
+}
+
+static void prv_cmdsched_trig_flashmeasure_flat(const void *params){
+  meas_flashmeasure_flat_trigger();
+}
+
+static void prv_cmdsched_exec_flashmeasure_flat(const void *params){
+  const meas_flashmeasure_dumpbuffer_param_t *p = params;
+  meas_flashmeasure_flat_finish(p->channel);
+}
+
+static void prv_cmdsched_stage_flashmeasure_singlesample(const void *params){
+  const meas_flashmeasure_singlesample_param_t *p = params;
+  meas_flashmeasure_singlesample_stage(p->illum, p->flash_dur_us, p->measure_at_us, p->numavg);
+}
+
+static void prv_cmdsched_trig_flashmeasure_singlesample(const void *params){
+  meas_flashmeasure_singlesample_trigger();
+}
+
+static void prv_cmdsched_exec_flashmeasure_singlesample(const void *params){
+  const meas_flashmeasure_singlesample_param_t *p = params;
+  meas_flashmeasure_singlesample_finish(p->channel, p->numavg);
+}
+
+static void prv_cmdsched_exec_end_of_sequence(const void *params){
+  meas_end_of_sequence();
+  dbg_flush();
+  HAL_Delay(1000);
+  NVIC_SystemReset();
+}
+
+static void prv_cmdsched_trig_enable_current(const void *params){
+  const fec_enable_disable_current_param_t *p = params;
+  fec_enable_current(p->channel);
+}
+
+static void prv_cmdsched_trig_disable_current(const void *params){
+  const fec_enable_disable_current_param_t *p = params;
+  fec_disable_current(p->channel);
+}
+
+static void prv_cmdsched_exec_setshunt(const void *params){
+  const fec_setshunt_param_t *p = params;
+  switch(p->shunt){
+    case 1:
+      fec_set_shunt_1x(p->channel);
+      break;
+    case 10:
+      fec_set_shunt_10x(p->channel);
+      break;
+    case 100:
+      fec_set_shunt_100x(p->channel);
+      break;
+    case 1000:
+      fec_set_shunt_1000x(p->channel);
+      break;
+    default:
+      break;
+  }
+}
+
+static void prv_cmdsched_stage_set_force_voltage(const void *params){
+  const fec_setforcevolt_param_t *p = params;
+  fec_stage_force_voltage(p->channel, p->volt);
+}
+
+static void prv_cmdsched_trig_set_force_voltage(const void *params){
+  fec_apply_staged_force_voltage();
+}
+
+static void prv_cmdsched_exec_autorange(const void *params){
+  daq_autorange();
+}
+
+static void prv_cmdsched_exec_getledtemp(const void *params){
+  ledctrl_print_temperature_mainser();
+}
+
+static void prv_cmdsched_exec_calibillum(const void *params){
+  const ledctrl_calibillum_param_t *p = params;
+  ledctrl_calibrate_illum_curr(p->illum, p->curr, p->a, p->b, p->c);
+}
+
+static void prv_cmdsched_exec_calibillumL(const void *params){
+  const ledctrl_calibillumL_param_t *p = params;
+  ledctrl_calibrate_illum_curr_low(p->a, p->b, p->c);
+}
+
+static void prv_cmdsched_exec_set_numavg(const void *params){
+  const meas_set_num_avg_param_t *p = params;
+  meas_set_num_avg(p->numavg);
+}
+
+static void prv_cmdsched_exec_get_numavg(const void *params){
+  prv_meas_print_timestamp(usec_get_timestamp_64());
+  mainser_printf("NUMAVG:%lu\r\n", meas_get_num_avg());
+}
+
+static void prv_cmdsched_exec_set_settle_time(const void *params){
+  const meas_set_stltm_param_t *p = params;
+  meas_set_settling_time(p->settle_time);
+}
+
+static void prv_cmdsched_exec_get_settle_time(const void *params){
+  prv_meas_print_timestamp(usec_get_timestamp_64());
+  mainser_printf("SETTLE_TIME:%lu\r\n", meas_get_settling_time());
+}
+
+static void prv_cmdsched_exec_get_noise(const void *params){
+  const meas_get_noise_param_t *p = params;
+  if(p->volt_flag) {
+    meas_get_noise_volt(p->channel);
+  }
+  if(p->curr_flag) {
+    meas_get_noise_curr(p->channel);
+  }
+}
+
+//duration model ##########################################################
+//Rough runtime estimates (us) of cmds, used to detect overlapping cmds at schedule time.
+//Estimates are multiplied by per cmd scale, calibrated from measured runtimes.
+
+//time to send bytes over main serial (10 bits per byte)
+static uint32_t prv_cmdsched_dur_tx(uint32_t bytes){
+  return (uint32_t)(((uint64_t)bytes * 10 * 1000000) / mainser_get_baudrate());
+}
+
+//printed bytes per sample/point, all channels or single channel
+#define CMDSCHED_DUR_LINE_BYTES(channel) ((channel) == 0 ? 80 : 16)
+
+static uint32_t prv_cmdsched_dur_single_shot(uint8_t channel){
+  return meas_get_num_avg() * DAQ_SAMPLE_TIME_100KSPS + prv_cmdsched_dur_tx(30 + CMDSCHED_DUR_LINE_BYTES(channel));
+}
+
+static uint32_t prv_cmdsched_dur_mppt_start(const void *params){
+  const mppt_param_t *p = params;
+  //autorange, Voc and about 20 fast search steps
+  return 7 * p->settling_time + 20 * meas_get_num_avg() * DAQ_SAMPLE_TIME_100KSPS;
+}
+
+static uint32_t prv_cmdsched_dur_mppt_resume(const void *params){
+  const mppt_param_t *p = params;
+  return p->settling_time;
+}
+
+static uint32_t prv_cmdsched_dur_get_voltage(const void *params){
+  const meas_get_voltage_param_t *p = params;
+  return prv_cmdsched_dur_single_shot(p->channel);
+}
+
+static uint32_t prv_cmdsched_dur_get_current(const void *params){
+  const meas_get_current_param_t *p = params;
+  return prv_cmdsched_dur_single_shot(p->channel);
+}
+
+static uint32_t prv_cmdsched_dur_get_IV_point(const void *params){
+  const meas_get_IV_point_param_t *p = params;
+  //force voltage usually converges in a few iterations, each waits for DUT to settle
+  return 3 * (meas_get_settling_time() * 1000 + meas_get_num_avg() * DAQ_SAMPLE_TIME_100KSPS)
+         + prv_cmdsched_dur_tx(30 + 2 * CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_get_iv_characteristic(const void *params){
+  const meas_get_iv_characteristic_param_t *p = params;
+  float steps_f = (p->step_volt != 0.0f) ? (p->end_volt - p->start_volt) / p->step_volt : 0.0f;
+  uint32_t steps = (steps_f > 0.0f) ? (uint32_t)steps_f + 1 : 1;
+  //autorange at start takes about one step
+  return (steps + 1) * p->step_time * 1000
+         + prv_cmdsched_dur_tx(steps * p->Npoints_per_step * 2 * CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_sample_and_dump(const void *params){
+  const meas_sample_and_dump_param_t *p = params;
+  return p->num_samples * DAQ_SAMPLE_TIME_100KSPS + prv_cmdsched_dur_tx(p->num_samples * CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_iv_sample_and_dump(const void *params){
+  const meas_sample_and_dump_param_t *p = params;
+  return p->num_samples * DAQ_SAMPLE_TIME_100KSPS + prv_cmdsched_dur_tx(p->num_samples * 2 * CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_flashmeasure_dumpbuffer(const void *params){
+  const meas_flashmeasure_dumpbuffer_param_t *p = params;
+  uint32_t dur = p->flash_dur_us + 2 * MEAS_FLASH_DUMP_SAMPLEBORDER_US;
+  uint32_t samples = dur / DAQ_SAMPLE_TIME_100KSPS;
+  return dur + prv_cmdsched_dur_tx(samples * CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_flashmeasure_singlesample(const void *params){
+  const meas_flashmeasure_singlesample_param_t *p = params;
+  uint32_t dur = p->measure_at_us + p->numavg * DAQ_SAMPLE_TIME_100KSPS;
+  if(p->flash_dur_us > dur) dur = p->flash_dur_us;
+  return dur + prv_cmdsched_dur_tx(30 + CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_flashmeasure_burst(const void *params){
+  const meas_flashmeasure_burst_param_t *p = params;
+  uint32_t dur = p->flash_dur_us + 2 * MEAS_FLASH_DUMP_SAMPLEBORDER_US;
+  uint32_t samples = dur / DAQ_SAMPLE_TIME_100KSPS;
+  if(p->num_flashes > 1) dur += (p->num_flashes - 1) * p->period_us;
+  return dur + prv_cmdsched_dur_tx(samples * CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_flashmeasure_ets(const void *params){
+  const meas_flashmeasure_ets_param_t *p = params;
+  uint32_t dur = p->flash_dur_us + 2 * MEAS_FLASH_ETS_BORDER_US;
+  uint32_t samples = dur / DAQ_SAMPLE_TIME_100KSPS * p->num_phases;
+  uint32_t total = p->num_phases * p->num_flashes;
+  if(total > 1) dur += (total - 1) * p->period_us;
+  return dur + prv_cmdsched_dur_tx(samples * CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_flashmeasure_adaptive(const void *params){
+  const meas_flashmeasure_adaptive_param_t *p = params;
+  return p->max_dur_us + prv_cmdsched_dur_tx(80 + CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_wave_play(const void *params){
+  const meas_wave_play_param_t *p = params;
+  uint32_t points = ledwave_get_num_points();
+  //looped playback runs in background after first pass
+  if(!p->dump){
+    return points * LEDWAVE_POINT_TIME_US + prv_cmdsched_dur_tx(60);
+  }
+  return points * LEDWAVE_POINT_TIME_US + prv_cmdsched_dur_tx(60 + points * CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_lockin_sweep(const void *params){
+  const meas_lockin_sweep_param_t *p = params;
+  uint64_t dur = 0;
+  for(uint32_t i = 0; i < p->num_freq; i++){
+    float f = (p->num_freq > 1) ? p->f_start * powf(p->f_stop / p->f_start, (float)i / (float)(p->num_freq - 1)) : p->f_start;
+    float period_us = (f > 0.0f) ? 1000000.0f / f : 0.0f;
+    //capture is a full table (20 ms) at high frequencies, one to two periods at low
+    float capture_us = (LEDWAVE_MAX_POINTS * LEDWAVE_POINT_TIME_US > period_us) ? LEDWAVE_MAX_POINTS * LEDWAVE_POINT_TIME_US : 2.0f * period_us;
+    dur += (uint64_t)(p->settle_periods * period_us + p->num_avg * capture_us);
+  }
+  dur += prv_cmdsched_dur_tx(100 + p->num_freq * CMDSCHED_DUR_LINE_BYTES(p->channel));
+  return (dur > UINT32_MAX) ? UINT32_MAX : (uint32_t)dur;
+}
+
+static uint32_t prv_cmdsched_dur_sunsvoc(const void *params){
+  const meas_sunsvoc_param_t *p = params;
+  return p->num_steps * p->step_us + prv_cmdsched_dur_tx(100 + (p->num_steps + 2) * CMDSCHED_DUR_LINE_BYTES(p->channel));
+}
+
+static uint32_t prv_cmdsched_dur_end_of_sequence(const void *params){
+  return 1000000;
+}
+
+static uint32_t prv_cmdsched_dur_autorange(const void *params){
+  //up to 4 shunt steps: switch, settle, measure
+  return 4 * (SHUNT_SWITCH_SETTLING_TIME + DAQ_AUTORANGE_SAMPLES * DAQ_SAMPLE_TIME_100KSPS) + 500;
+}
+
+static uint32_t prv_cmdsched_dur_get_noise(const void *params){
+  const meas_get_noise_param_t *p = params;
+  uint32_t dur = 0;
+  if(p->volt_flag) dur += NOISE_MEASURE_NUMSAMPLES * DAQ_SAMPLE_TIME_100KSPS + prv_cmdsched_dur_tx(4 * CMDSCHED_DUR_LINE_BYTES(p->channel));
+  if(p->curr_flag) dur += NOISE_MEASURE_NUMSAMPLES * DAQ_SAMPLE_TIME_100KSPS + prv_cmdsched_dur_tx(4 * CMDSCHED_DUR_LINE_BYTES(p->channel));
+  return dur;
+}
+
+/**
+ * @brief Dispatch table, indexed by cmd id.
+ * - params_len: size of param struct (checked at compile time to fit in CMDSCHED_PARAM_BUFF_LEN)
+ * - stage: runs in main loop when cmd is popped (CMDSCHED_POP_BEFORE_EXEC_US before exec time)
+ * - trigger: runs from compare interrupt exactly at exec time. Short register writes only, no printing!
+ * - exec: runs in main loop right after exec time
+ * - duration: estimated runtime in us (stage not included), for overlap check. NULL: CMDSCHED_DUR_DEFAULT_US
+ * Any hook can be NULL.
+ */
+static const cmdsched_cmd_desc_t prv_cmdsched_cmd_table[meas_funct_id_count] = {
+  [mppt_start_id]                     = {CMDSCHED_PARAMS(mppt_param_t), NULL, NULL, prv_cmdsched_exec_mppt_start, prv_cmdsched_dur_mppt_start},
+  [mppt_resume_id]                    = {CMDSCHED_PARAMS(mppt_param_t), NULL, NULL, prv_cmdsched_exec_mppt_resume, prv_cmdsched_dur_mppt_resume},
+  [mppt_stop_id]                      = {CMDSCHED_NO_PARAMS, NULL, NULL, prv_cmdsched_exec_mppt_stop, NULL},
+  [meas_get_voltage_id]               = {CMDSCHED_PARAMS(meas_get_voltage_param_t), NULL, NULL, prv_cmdsched_exec_get_voltage, prv_cmdsched_dur_get_voltage},
+  [meas_get_current_id]               = {CMDSCHED_PARAMS(meas_get_current_param_t), NULL, NULL, prv_cmdsched_exec_get_current, prv_cmdsched_dur_get_current},
+  [meas_get_IV_point_id]              = {CMDSCHED_PARAMS(meas_get_IV_point_param_t), NULL, NULL, prv_cmdsched_exec_get_IV_point, prv_cmdsched_dur_get_IV_point},
+  [meas_get_iv_characteristic_id]     = {CMDSCHED_PARAMS(meas_get_iv_characteristic_param_t), NULL, NULL, prv_cmdsched_exec_get_iv_characteristic, prv_cmdsched_dur_get_iv_characteristic},
+  [meas_volt_sample_and_dump_id]      = {CMDSCHED_PARAMS(meas_sample_and_dump_param_t), prv_cmdsched_stage_sample_and_dump, prv_cmdsched_trig_start_sampling, prv_cmdsched_exec_volt_sample_and_dump, prv_cmdsched_dur_sample_and_dump},
+  [meas_curr_sample_and_dump_id]      = {CMDSCHED_PARAMS(meas_sample_and_dump_param_t), prv_cmdsched_stage_sample_and_dump, prv_cmdsched_trig_start_sampling, prv_cmdsched_exec_curr_sample_and_dump, prv_cmdsched_dur_sample_and_dump},
+  [meas_iv_sample_and_dump_id]        = {CMDSCHED_PARAMS(meas_sample_and_dump_param_t), prv_cmdsched_stage_sample_and_dump, prv_cmdsched_trig_start_sampling, prv_cmdsched_exec_iv_sample_and_dump, prv_cmdsched_dur_iv_sample_and_dump},
+  [ledctrl_set_current_id]            = {CMDSCHED_PARAMS(ledctrl_set_current_param_t), prv_cmdsched_stage_set_current, prv_cmdsched_trig_led_apply, NULL, NULL},
+  [ledctrl_set_illum_id]              = {CMDSCHED_PARAMS(ledctrl_set_illum_param_t), prv_cmdsched_stage_set_illum, prv_cmdsched_trig_led_apply, prv_cmdsched_exec_set_illum, NULL},
+  [meas_flashmeasure_dumpbuffer_id]   = {CMDSCHED_PARAMS(meas_flashmeasure_dumpbuffer_param_t), prv_cmdsched_stage_flashmeasure_dumpbuffer, prv_cmdsched_trig_flashmeasure_dumpbuffer, prv_cmdsched_exec_flashmeasure_dumpbuffer, prv_cmdsched_dur_flashmeasure_dumpbuffer},
+  [meas_flashmeasure_singlesample_id] = {CMDSCHED_PARAMS(meas_flashmeasure_singlesample_param_t), prv_cmdsched_stage_flashmeasure_singlesample, prv_cmdsched_trig_flashmeasure_singlesample, prv_cmdsched_exec_flashmeasure_singlesample, prv_cmdsched_dur_flashmeasure_singlesample},
+  [end_of_sequence_id]                = {CMDSCHED_NO_PARAMS, NULL, NULL, prv_cmdsched_exec_end_of_sequence, prv_cmdsched_dur_end_of_sequence},
+  [fec_enable_current_id]             = {CMDSCHED_PARAMS(fec_enable_disable_current_param_t), NULL, prv_cmdsched_trig_enable_current, NULL, NULL},
+  [fec_disable_current_id]            = {CMDSCHED_PARAMS(fec_enable_disable_current_param_t), NULL, prv_cmdsched_trig_disable_current, NULL, NULL},
+  [setshunt_id]                       = {CMDSCHED_PARAMS(fec_setshunt_param_t), NULL, NULL, prv_cmdsched_exec_setshunt, NULL},
+  [setforcevolt_id]                   = {CMDSCHED_PARAMS(fec_setforcevolt_param_t), prv_cmdsched_stage_set_force_voltage, prv_cmdsched_trig_set_force_voltage, NULL, NULL},
+  [autorange_id]                      = {CMDSCHED_NO_PARAMS, NULL, NULL, prv_cmdsched_exec_autorange, prv_cmdsched_dur_autorange},
+  [getledtemp_id]                     = {CMDSCHED_NO_PARAMS, NULL, NULL, prv_cmdsched_exec_getledtemp, NULL},
+  [calibillum_id]                     = {CMDSCHED_PARAMS(ledctrl_calibillum_param_t), NULL, NULL, prv_cmdsched_exec_calibillum, NULL},
+  [calibillumL_id]                    = {CMDSCHED_PARAMS(ledctrl_calibillumL_param_t), NULL, NULL, prv_cmdsched_exec_calibillumL, NULL},
+  [meas_set_numavg_id]                = {CMDSCHED_PARAMS(meas_set_num_avg_param_t), NULL, NULL, prv_cmdsched_exec_set_numavg, NULL},
+  [meas_get_numavg_id]                = {CMDSCHED_NO_PARAMS, NULL, NULL, prv_cmdsched_exec_get_numavg, NULL},
+  [meas_set_settle_time_id]           = {CMDSCHED_PARAMS(meas_set_stltm_param_t), NULL, NULL, prv_cmdsched_exec_set_settle_time, NULL},
+  [meas_get_settle_time_id]           = {CMDSCHED_NO_PARAMS, NULL, NULL, prv_cmdsched_exec_get_settle_time, NULL},
+  [meas_get_noise_id]                 = {CMDSCHED_PARAMS(meas_get_noise_param_t), NULL, NULL, prv_cmdsched_exec_get_noise, prv_cmdsched_dur_get_noise},
+  [meas_flashmeasure_burst_id]        = {CMDSCHED_PARAMS(meas_flashmeasure_burst_param_t), prv_cmdsched_stage_flashmeasure_burst, prv_cmdsched_trig_flashmeasure_dumpbuffer, prv_cmdsched_exec_flashmeasure_burst, prv_cmdsched_dur_flashmeasure_burst},
+  [meas_flashmeasure_ets_id]          = {CMDSCHED_PARAMS(meas_flashmeasure_ets_param_t), prv_cmdsched_stage_flashmeasure_ets, prv_cmdsched_trig_flashmeasure_dumpbuffer, prv_cmdsched_exec_flashmeasure_burst, prv_cmdsched_dur_flashmeasure_ets},
+  [meas_flashmeasure_adaptive_id]     = {CMDSCHED_PARAMS(meas_flashmeasure_adaptive_param_t), prv_cmdsched_stage_flashmeasure_adaptive, prv_cmdsched_trig_flashmeasure_singlesample, prv_cmdsched_exec_flashmeasure_adaptive, prv_cmdsched_dur_flashmeasure_adaptive},
+  [meas_wave_play_id]                 = {CMDSCHED_PARAMS(meas_wave_play_param_t), prv_cmdsched_stage_wave_play, prv_cmdsched_trig_wave_play, prv_cmdsched_exec_wave_play, prv_cmdsched_dur_wave_play},
+  [meas_lockin_sweep_id]              = {CMDSCHED_PARAMS(meas_lockin_sweep_param_t), NULL, NULL, prv_cmdsched_exec_lockin_sweep, prv_cmdsched_dur_lockin_sweep},
+  [meas_sunsvoc_id]                   = {CMDSCHED_PARAMS(meas_sunsvoc_param_t), prv_cmdsched_stage_sunsvoc, prv_cmdsched_trig_sunsvoc, prv_cmdsched_exec_sunsvoc, prv_cmdsched_dur_sunsvoc},
+  [meas_flashmeasure_flat_id]         = {CMDSCHED_PARAMS(meas_flashmeasure_dumpbuffer_param_t), prv_cmdsched_stage_flashmeasure_flat, prv_cmdsched_trig_flashmeasure_flat, prv_cmdsched_exec_flashmeasure_flat, prv_cmdsched_dur_flashmeasure_dumpbuffer},
+};
+
+/**
+ * @brief returns cmd descriptor, NULL if cmd id is not schedulable
+ */
+static const cmdsched_cmd_desc_t* prv_cmdsched_get_desc(meas_funct_id cmd_id){
+  if((uint32_t)cmd_id >= meas_funct_id_count){
+    return NULL;
+  }
+  const cmdsched_cmd_desc_t *desc = &prv_cmdsched_cmd_table[cmd_id];
+  if(desc->trigger == NULL && desc->exec == NULL){
+    return NULL;
+  }
+  return desc;
+}
+
+//duration calibration, per cmd id. 0: not calibrated yet (scale 1)
+static float prv_cmdsched_dur_scale[meas_funct_id_count];
+
+/**
+ * @brief estimated runtime of cmd in us (model * calibrated scale)
+ */
+uint32_t cmdsched_estimate_duration(meas_funct_id cmd_id, const void *params){
+  const cmdsched_cmd_desc_t *desc = prv_cmdsched_get_desc(cmd_id);
+  if(desc == NULL){
+    return CMDSCHED_DUR_DEFAULT_US;
+  }
+  uint32_t model = (desc->duration != NULL) ? desc->duration(params) : CMDSCHED_DUR_DEFAULT_US;
+  float scale = prv_cmdsched_dur_scale[cmd_id];
+  if(scale <= 0.0f){
+    return model;
+  }
+  return (uint32_t)((float)model * scale);
+}
+
+/**
+ * @brief updates duration scale of cmd id with measured runtime (moving average)
+ */
+static void prv_cmdsched_dur_calibrate(meas_funct_id cmd_id, const void *params, uint32_t actual_us){
+  const cmdsched_cmd_desc_t *desc = prv_cmdsched_get_desc(cmd_id);
+  if(desc == NULL){
+    return;
+  }
+  uint32_t model = (desc->duration != NULL) ? desc->duration(params) : CMDSCHED_DUR_DEFAULT_US;
+  if(model == 0){
+    return;
+  }
+  float ratio = (float)actual_us / (float)model;
+  if(ratio < CMDSCHED_DUR_SCALE_MIN) ratio = CMDSCHED_DUR_SCALE_MIN;
+  if(ratio > CMDSCHED_DUR_SCALE_MAX) ratio = CMDSCHED_DUR_SCALE_MAX;
+  float *scale = &prv_cmdsched_dur_scale[cmd_id];
+  if(*scale <= 0.0f){
+    *scale = ratio;
+  }
+  else{
+    *scale += (ratio - *scale) / 8.0f;
+  }
+}
+
+/**
+ * @brief prints calibrated duration scales (only calibrated cmd ids) to main serial
+ */
+void cmdsched_print_duration_scales(void){
+  mainser_printf("SCHED_DUR_SCALE:\r\n");
+  for(uint32_t id = 0; id < meas_funct_id_count; id++){
+    if(prv_cmdsched_dur_scale[id] > 0.0f){
+      mainser_printf("%lu:%f\r\n", id, prv_cmdsched_dur_scale[id]);
+    }
+  }
+}
+
+/**
+ * @brief checks if cmd would collide with the cmd before or after it (armed or queued). O(log n)
+ * @return 0 if ok, -1 if cmd must be rejected
+ */
+static int8_t prv_cmdsched_check_overlap(uint64_t exec_time, meas_funct_id cmd_id, uint32_t tag, const void *params){
+#if CMDSCHED_OVERLAP_CHECK == CMDSCHED_OVERLAP_OFF
+  return 0;
+#else
+  cmd_sched_t prev, next;
+  uint8_t found = prv_cmdsched_q_neighbours(exec_time, tag, &prev, &next);
+  if(prv_cmdsched_armed && prv_cmdsched_armed_cmd.exec_time <= exec_time &&
+     (!(found & 1) || prv_cmdsched_armed_cmd.exec_time >= prev.exec_time)){
+    prev = prv_cmdsched_armed_cmd;
+    found |= 1;
+  }
+
+  uint8_t overlap = 0;
+  if((found & 1) && prev.exec_time + cmdsched_estimate_duration(prev.cmd_id, prev.params_buff) > exec_time + CMDSCHED_OVERLAP_TOLERANCE_US){
+    overlap = 1;
+  }
+  if((found & 2) && exec_time + cmdsched_estimate_duration(cmd_id, params) > next.exec_time + CMDSCHED_OVERLAP_TOLERANCE_US){
+    overlap = 1;
+  }
+  if(overlap){
+    dbg(Warning, "sched cmd %d at %llu overlaps\n", cmd_id, exec_time);
+#if CMDSCHED_OVERLAP_CHECK == CMDSCHED_OVERLAP_REJECT
+    return -1;
+#endif
+  }
+  return 0;
+#endif
+}
+
 //######################################################################
 
 uint8_t EndOfSequenceReceived = 0;
 uint64_t time_of_lastcmd_request = 0;
-int8_t cmdsched_encode_and_add(uint64_t exec_time, meas_funct_id cmd_id, void *params, uint8_t params_len){
-  uint32_t free_space = cmdsched_q_free_spaces();
-  if(free_space == 0){
-    dbg(Error, "sched queue full\n");
-    mainser_printf("SCHED_FAIL\r\n");
-    return -1;
+
+//tag for next cmdsched_encode_and_add() (set from -tag argument)
+static uint32_t prv_cmdsched_next_tag = CMDSCHED_NO_TAG;
+//host request id for next cmdsched_encode_and_add() (set from -id argument)
+static uint32_t prv_cmdsched_next_req_id = CMDSCHED_NO_REQ_ID;
+
+/**
+ * @brief removes queued cmds with tag (all queued cmds if tag is CMDSCHED_NO_TAG).
+ * Cmd that is already armed (about to execute) is not affected.
+ * @return number of removed cmds
+ */
+uint32_t cmdsched_cancel(uint32_t tag){
+  uint32_t removed = prv_cmdsched_q_remove(tag, tag == CMDSCHED_NO_TAG);
+  if(removed > 0){
+    //end of sequence may have been removed
+    EndOfSequenceReceived = prv_cmdsched_q_contains(end_of_sequence_id);
   }
-  if(exec_time <= cmdsched_last_scheduled_time){
-    dbg(Error, "sched time before last sched time\n");
-    mainser_printf("SCHED_FAIL:NOT_CHRONOLOGICAL\r\n");
-    return -1;
+  return removed;
+}
+
+/**
+ * @brief sets tag of the next cmd added with cmdsched_encode_and_add()
+ */
+void cmdsched_set_next_tag(uint32_t tag){
+  prv_cmdsched_next_tag = tag;
+}
+
+/**
+ * @brief sets request id of the next cmd added with cmdsched_encode_and_add(). Output of the cmd is prefixed
+ * with it when it executes.
+ */
+void cmdsched_set_next_req_id(uint32_t req_id){
+  prv_cmdsched_next_req_id = req_id;
+}
+
+/**
+ * @brief puts already validated cmd into queue. Tagged cmd replaces queued cmds with the same tag.
+ * Starts execution if queue is full or sequence is complete.
+ */
+static void prv_cmdsched_enqueue(uint64_t exec_time, meas_funct_id cmd_id, uint32_t tag, uint32_t req_id,
+                                 const void *params, uint8_t params_len){
+  if(tag != CMDSCHED_NO_TAG && cmdsched_cancel(tag) > 0){
+    dbg(Debug, "sched tag %lu replaced\n", tag);
   }
-  cmdsched_last_scheduled_time = exec_time;
-  cmd_sched_t cmd;
+  cmd_sched_t cmd = {0};
   cmd.cmd_id = cmd_id;
   cmd.exec_time = exec_time;
+  cmd.tag = tag;
+  cmd.req_id = req_id;
   memcpy(cmd.params_buff, params, params_len);
-  cmdsched_q_push(cmd);
+  if(cmdsched_q_push(cmd) != 0){
+    //should not happen, space is checked before
+    dbg(Error, "sched queue push failed\n");
+    return;
+  }
   dbg(Debug, "cmd scheduled at %llu\n", exec_time);
-  mainser_printf("SCHED_OK\r\n");
 
   //if schedule queue full or complete sequence loaded, start execution
-  free_space = cmdsched_q_free_spaces();
-  if (free_space == 0)
+  if (!prv_cmdsched_q_fits(1, CMDSCHED_PARAM_BUFF_LEN))
     cmdsched_start();
   if (cmd_id == end_of_sequence_id)
   {
     EndOfSequenceReceived = 1;
     cmdsched_start();
   }
+}
+
+/**
+ * @brief sends REQ_SCHED_CMD to host if there is enough time until next cmd
+ */
+static void prv_cmdsched_request_more(void){
   uint64_t tnow = usec_get_timestamp_64();
 
   //request new cmd if time
@@ -115,22 +1069,22 @@ int8_t cmdsched_encode_and_add(uint64_t exec_time, meas_funct_id cmd_id, void *p
     //nothing in queue, we have a lot of time, request sched
     time_of_lastcmd_request = tnow;
     cmdsprt_request_new_cmds();
-    return 0;
+    return;
   }
-  cmd = cmdsched_q_peek();
+  uint64_t exec_time = prv_cmdsched_q_peek_time();
 
   if (isSchRunning())
   {
     //check that if time left is actually positive (scheduled cmds can be late...)
-    if((tnow + CMDSCHED_POP_BEFORE_EXEC_US) >  cmd.exec_time){
-      //we are already late, no time to transfer cmds. return 0
-      return 0;
+    if((tnow + CMDSCHED_POP_BEFORE_EXEC_US) >  exec_time){
+      //we are already late, no time to transfer cmds
+      return;
     }
 
-    uint64_t time_to_cmd =  cmd.exec_time - tnow - CMDSCHED_POP_BEFORE_EXEC_US;
+    uint64_t time_to_cmd =  exec_time - tnow - CMDSCHED_POP_BEFORE_EXEC_US;
     if(time_to_cmd > MIN_TIME_TO_CMD_TO_REQ_CMDS_US){
       // send request for new cmds to put in cmd queue
-      if ( (cmdsched_q_free_spaces() > 0) && (!EndOfSequenceReceived))
+      if ( prv_cmdsched_q_fits(1, CMDSCHED_PARAM_BUFF_LEN) && (!EndOfSequenceReceived))
       {
         time_of_lastcmd_request = tnow;
         cmdsprt_request_new_cmds();
@@ -142,31 +1096,394 @@ int8_t cmdsched_encode_and_add(uint64_t exec_time, meas_funct_id cmd_id, void *p
     time_of_lastcmd_request = tnow;
     cmdsprt_request_new_cmds();
   }
+}
+
+/**
+ * @brief checks and adds cmd to queue without answering to host (used by cmdsched_encode_and_add() and
+ * on-device sequences). Tagged cmd replaces queued cmds with the same tag.
+ * @return CMDSCHED_ADD_OK or CMDSCHED_ADD_* failure
+ */
+static int8_t prv_cmdsched_add(uint64_t exec_time, meas_funct_id cmd_id, uint32_t tag, uint32_t req_id, const void *params){
+  const cmdsched_cmd_desc_t *desc = prv_cmdsched_get_desc(cmd_id);
+  if(desc == NULL){
+    dbg(Error, "sched unknown cmd\n");
+    return CMDSCHED_ADD_UNKNOWN;
+  }
+  if(prv_cmdsched_check_overlap(exec_time, cmd_id, tag, params) != 0){
+    return CMDSCHED_ADD_OVERLAP;
+  }
+  if(!prv_cmdsched_q_fits(1, desc->params_len) && (tag == CMDSCHED_NO_TAG || cmdsched_cancel(tag) == 0)){
+    dbg(Error, "sched queue full\n");
+    return CMDSCHED_ADD_FULL;
+  }
+  prv_cmdsched_enqueue(exec_time, cmd_id, tag, req_id, params, desc->params_len);
+  return CMDSCHED_ADD_OK;
+}
+
+int8_t cmdsched_add(uint64_t exec_time, meas_funct_id cmd_id, uint32_t tag, const void *params){
+  return prv_cmdsched_add(exec_time, cmd_id, tag, CMDSCHED_NO_REQ_ID, params);
+}
+
+/**
+ * @brief params length of cmd id, -1 if cmd can't be scheduled
+ */
+int16_t cmdsched_get_params_len(meas_funct_id cmd_id){
+  const cmdsched_cmd_desc_t *desc = prv_cmdsched_get_desc(cmd_id);
+  return (desc == NULL) ? -1 : desc->params_len;
+}
+
+/**
+ * @brief exec time of the first queued cmd, UINT64_MAX if queue is empty. Armed cmd is not in queue.
+ */
+uint64_t cmdsched_next_exec_time(void){
+  return (cmdsched_q_count() == 0) ? UINT64_MAX : prv_cmdsched_q_peek_time();
+}
+
+int8_t cmdsched_encode_and_add(uint64_t exec_time, meas_funct_id cmd_id, void *params, uint8_t params_len){
+  uint32_t tag = prv_cmdsched_next_tag;
+  uint32_t req_id = prv_cmdsched_next_req_id;
+  prv_cmdsched_next_tag = CMDSCHED_NO_TAG;
+  prv_cmdsched_next_req_id = CMDSCHED_NO_REQ_ID;
+  if(cmdsched_get_params_len(cmd_id) != params_len){
+    dbg(Error, "sched unknown cmd or bad params\n");
+    mainser_printf("SCHED_FAIL\r\n");
+    return -1;
+  }
+  int8_t ret = prv_cmdsched_add(exec_time, cmd_id, tag, req_id, params);
+  if(ret == CMDSCHED_ADD_OVERLAP){
+    mainser_printf("SCHED_FAIL:OVERLAP\r\n");
+    return -1;
+  }
+  if(ret != CMDSCHED_ADD_OK){
+    mainser_printf("SCHED_FAIL\r\n");
+    return -1;
+  }
+  mainser_printf("SCHED_OK\r\n");
 
+  prv_cmdsched_request_more();
   return 0;
 }
 
+//binary batch upload ##################################################
+
+typedef enum {
+    prv_cmdsched_batch_idle,
+    prv_cmdsched_batch_sync,     //waiting for magic, anything else is discarded
+    prv_cmdsched_batch_header,   //payload length
+    prv_cmdsched_batch_payload,
+    prv_cmdsched_batch_crc,
+    prv_cmdsched_batch_complete  //waiting for armed cmd to finish before processing
+} prv_cmdsched_batch_state_t;
+
+static prv_cmdsched_batch_state_t prv_cmdsched_batch_state = prv_cmdsched_batch_idle;
+static uint8_t prv_cmdsched_batch_buff[CMDSCHED_BATCH_BUFF_LEN];
+static uint32_t prv_cmdsched_batch_len = 0;    //payload length from header
+static uint32_t prv_cmdsched_batch_pos = 0;    //bytes received in current state
+static uint32_t prv_cmdsched_batch_crc_rx = 0;
+static uint32_t prv_cmdsched_batch_start_tick = 0;
+static const char *prv_cmdsched_batch_name = NULL;       //answer prefix
+static cmdsched_batch_fn prv_cmdsched_batch_process_fn = NULL;
+static uint32_t prv_cmdsched_batch_req_id = CMDSCHED_NO_REQ_ID;  //request id of cmd that started receiving
+
+/**
+ * @brief CRC-32 (IEEE 802.3, same as zlib crc32()). Nibble table, small and fast enough for a few kB.
+ */
+static uint32_t prv_cmdsched_crc32(uint32_t crc, const uint8_t *data, uint32_t len){
+  static const uint32_t table[16] = {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+      0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  crc = ~crc;
+  for(uint32_t i = 0; i < len; i++){
+    crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+/**
+ * @brief switches main serial input to binary block mode. Block is passed to process when complete and CRC is ok.
+ * See cmd_scheduler.h for block format.
+ * @param name prefix of answers (<name>_READY, <name>_FAIL:<reason>). Must be a static string.
+ */
+void cmdsched_batch_receive(const char *name, cmdsched_batch_fn process){
+  prv_cmdsched_batch_name = name;
+  prv_cmdsched_batch_process_fn = process;
+  prv_cmdsched_batch_state = prv_cmdsched_batch_sync;
+  prv_cmdsched_batch_pos = 0;
+  prv_cmdsched_batch_start_tick = HAL_GetTick();
+  prv_cmdsched_batch_req_id = mainser_get_resp_id();
+  mainser_printf("%s_READY\r\n", name);
+}
+
+uint8_t cmdsched_batch_is_receiving(void){
+  return prv_cmdsched_batch_state != prv_cmdsched_batch_idle;
+}
+
+static void prv_cmdsched_batch_end(const char *fail_reason){
+  prv_cmdsched_batch_state = prv_cmdsched_batch_idle;
+  if(fail_reason != NULL){
+    dbg(Error, "%s block failed: %s\n", prv_cmdsched_batch_name, fail_reason);
+    uint32_t resp_id = mainser_get_resp_id();
+    mainser_set_resp_id(prv_cmdsched_batch_req_id);
+    mainser_printf("%s_FAIL:%s\r\n", prv_cmdsched_batch_name, fail_reason);
+    mainser_set_resp_id(resp_id);
+  }
+}
+
+/**
+ * @brief validates whole batch first, then puts all cmds in queue. Nothing is added if anything is wrong.
+ * @return NULL on success, fail reason otherwise
+ */
+static const char* prv_cmdsched_batch_process(const uint8_t *buff, uint32_t len){
+  //pass 1: check (free space is checked without counting cmds that will be replaced)
+  uint32_t pos = 0;
+  uint32_t num = 0;
+  uint32_t params_bytes = 0;
+  uint64_t prev_time = 0;
+  uint32_t prev_dur = 0;
+  while(pos < len){
+    if(pos + CMDSCHED_BATCH_ENTRY_HEADER_LEN > len){
+      return "FORMAT";
+    }
+    const cmdsched_cmd_desc_t *desc = prv_cmdsched_get_desc((meas_funct_id)buff[pos]);
+    if(desc == NULL){
+      return "UNKNOWN_CMD";
+    }
+    uint32_t entry_pos = pos;
+    pos += CMDSCHED_BATCH_ENTRY_HEADER_LEN + desc->params_len;
+    if(pos > len){
+      return "FORMAT";
+    }
+    //overlap with queued cmds, and with previous entry if batch is in chronological order
+    meas_funct_id cmd_id = (meas_funct_id)buff[entry_pos];
+    const uint8_t *params = &buff[entry_pos + CMDSCHED_BATCH_ENTRY_HEADER_LEN];
+    uint64_t exec_time;
+    uint32_t tag;
+    memcpy(&exec_time, &buff[entry_pos + 1], sizeof(exec_time));
+    memcpy(&tag, &buff[entry_pos + 9], sizeof(tag));
+    if(prv_cmdsched_check_overlap(exec_time, cmd_id, tag, params) != 0 ||
+       (num > 0 && prev_time <= exec_time && prev_time + prev_dur > exec_time + CMDSCHED_OVERLAP_TOLERANCE_US &&
+        CMDSCHED_OVERLAP_CHECK == CMDSCHED_OVERLAP_REJECT)){
+      return "OVERLAP";
+    }
+    prev_time = exec_time;
+    prev_dur = cmdsched_estimate_duration(cmd_id, params);
+    params_bytes += desc->params_len;
+    num++;
+  }
+  if(!prv_cmdsched_q_fits(num, params_bytes)){
+    return "FULL";
+  }
+
+  //pass 2: add
+  pos = 0;
+  while(pos < len){
+    meas_funct_id cmd_id = (meas_funct_id)buff[pos];
+    const cmdsched_cmd_desc_t *desc = prv_cmdsched_get_desc(cmd_id);
+    uint64_t exec_time;
+    uint32_t tag;
+    memcpy(&exec_time, &buff[pos + 1], sizeof(exec_time));
+    memcpy(&tag, &buff[pos + 9], sizeof(tag));
+    prv_cmdsched_enqueue(exec_time, cmd_id, tag, CMDSCHED_NO_REQ_ID, &buff[pos + CMDSCHED_BATCH_ENTRY_HEADER_LEN], desc->params_len);
+    pos += CMDSCHED_BATCH_ENTRY_HEADER_LEN + desc->params_len;
+  }
+  mainser_printf("SCHEDBIN_OK:%lu:%lu:%lu\r\n", num, cmdsched_q_free_spaces(), cmdsched_q_free_bytes());
+
+  prv_cmdsched_request_more();
+  return NULL;
+}
+
+/**
+ * @brief switches main serial input to binary batch mode (schedbin)
+ */
+void cmdsched_batch_start(void){
+  cmdsched_batch_receive("SCHEDBIN", prv_cmdsched_batch_process);
+}
+
+/**
+ * @brief checks CRC and passes complete block to process function
+ */
+static void prv_cmdsched_batch_complete_process(void){
+  uint8_t crc_bytes[2] = {(uint8_t)prv_cmdsched_batch_len, (uint8_t)(prv_cmdsched_batch_len >> 8)};
+  uint32_t crc = prv_cmdsched_crc32(0, crc_bytes, 2);
+  crc = prv_cmdsched_crc32(crc, prv_cmdsched_batch_buff, prv_cmdsched_batch_len);
+  if(crc != prv_cmdsched_batch_crc_rx){
+    prv_cmdsched_batch_end("CRC");
+    return;
+  }
+  //OK answer of process function goes to the same request
+  uint32_t resp_id = mainser_get_resp_id();
+  mainser_set_resp_id(prv_cmdsched_batch_req_id);
+  prv_cmdsched_batch_end(prv_cmdsched_batch_process_fn(prv_cmdsched_batch_buff, prv_cmdsched_batch_len));
+  mainser_set_resp_id(resp_id);
+}
+
+/**
+ * @brief feeds main serial bytes into batch receiver. Call from main loop while cmdsched_batch_is_receiving().
+ * Received block is processed only when no cmd is armed, so it never delays a scheduled cmd.
+ */
+void cmdsched_batch_handler(void){
+  while(mainser_available() && prv_cmdsched_batch_state != prv_cmdsched_batch_complete){
+    uint8_t c = mainser_read();
+    switch(prv_cmdsched_batch_state){
+      case prv_cmdsched_batch_sync:
+        //leftovers of the text cmd line (LF after CR...) are skipped here
+        if(prv_cmdsched_batch_pos == 0 && c == CMDSCHED_BATCH_MAGIC0){
+          prv_cmdsched_batch_pos = 1;
+        }
+        else if(prv_cmdsched_batch_pos == 1 && c == CMDSCHED_BATCH_MAGIC1){
+          prv_cmdsched_batch_state = prv_cmdsched_batch_header;
+          prv_cmdsched_batch_pos = 0;
+          prv_cmdsched_batch_len = 0;
+        }
+        else{
+          prv_cmdsched_batch_pos = (c == CMDSCHED_BATCH_MAGIC0) ? 1 : 0;
+        }
+        break;
+      case prv_cmdsched_batch_header:
+        prv_cmdsched_batch_len |= (uint32_t)c << (8 * prv_cmdsched_batch_pos);
+        if(++prv_cmdsched_batch_pos == 2){
+          prv_cmdsched_batch_pos = 0;
+          if(prv_cmdsched_batch_len > CMDSCHED_BATCH_BUFF_LEN){
+            prv_cmdsched_batch_end("TOO_LONG");
+            return;
+          }
+          prv_cmdsched_batch_crc_rx = 0;
+          prv_cmdsched_batch_state = (prv_cmdsched_batch_len == 0) ? prv_cmdsched_batch_crc : prv_cmdsched_batch_payload;
+        }
+        break;
+      case prv_cmdsched_batch_payload:
+        prv_cmdsched_batch_buff[prv_cmdsched_batch_pos++] = c;
+        if(prv_cmdsched_batch_pos == prv_cmdsched_batch_len){
+          prv_cmdsched_batch_pos = 0;
+          prv_cmdsched_batch_state = prv_cmdsched_batch_crc;
+        }
+        break;
+      case prv_cmdsched_batch_crc:
+        prv_cmdsched_batch_crc_rx |= (uint32_t)c << (8 * prv_cmdsched_batch_pos);
+        if(++prv_cmdsched_batch_pos == 4){
+          prv_cmdsched_batch_state = prv_cmdsched_batch_complete;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  if(prv_cmdsched_batch_state == prv_cmdsched_batch_complete){
+    if(!cmdsched_is_armed()){
+      prv_cmdsched_batch_complete_process();
+    }
+  }
+  else if(HAL_GetTick() - prv_cmdsched_batch_start_tick > CMDSCHED_BATCH_TIMEOUT_MS){
+    prv_cmdsched_batch_end("TIMEOUT");
+  }
+}
+
+//######################################################################
+
 void cmdsched_decode(cmd_sched_t cmd, void *params, uint8_t params_len){
   memcpy(params, cmd.params_buff, params_len);
 }
 
+/**
+ * @brief usec compare callback. Runs in interrupt at exec time of armed cmd.
+ */
+static void prv_cmdsched_compare_callback(void){
+  prv_cmdsched_trigger_time = usec_get_timestamp_64();
+  if(prv_cmdsched_armed_desc != NULL && prv_cmdsched_armed_desc->trigger != NULL){
+    prv_cmdsched_armed_desc->trigger(prv_cmdsched_armed_cmd.params_buff);
+  }
+  prv_cmdsched_due = 1;
+}
+
+static void prv_cmdsched_exec(void);
+static uint64_t prv_cmdsched_time_to_next_cmd(void);
+
+static void prv_cmdsched_jitter_add(cmdsched_jitter_t *stats, uint64_t actual, uint64_t planned){
+  uint32_t late = 0;
+  if(actual > planned){
+    late = (actual - planned > UINT32_MAX) ? UINT32_MAX : (uint32_t)(actual - planned);
+  }
+  stats->num++;
+  stats->sum_us += late;
+  if(late < stats->min_us) stats->min_us = late;
+  if(late > stats->max_us) stats->max_us = late;
+}
+
+static void prv_cmdsched_jitter_print(const char *name, const cmdsched_jitter_t *stats){
+  uint32_t avg = stats->num ? (uint32_t)(stats->sum_us / stats->num) : 0;
+  uint32_t min = stats->num ? stats->min_us : 0;
+  mainser_printf("%s_N:%lu\r\n", name, stats->num);
+  mainser_printf("%s_MIN_US:%lu\r\n", name, min);
+  mainser_printf("%s_MAX_US:%lu\r\n", name, stats->max_us);
+  mainser_printf("%s_AVG_US:%lu\r\n", name, avg);
+}
+
+/**
+ * @brief prints how late scheduled cmds started (since boot or last reset) to main serial
+ * TRIG: compare interrupt (LED, DAQ start, force voltage...), EXEC: main loop part of cmd
+ */
+void cmdsched_print_jitter(void){
+  mainser_printf("SCHED_JITTER:\r\n");
+  prv_cmdsched_jitter_print("TRIG", &prv_cmdsched_jitter_trig);
+  prv_cmdsched_jitter_print("EXEC", &prv_cmdsched_jitter_exec);
+}
+
+/**
+ * @brief resets jitter statistics
+ */
+void cmdsched_reset_jitter(void){
+  cmdsched_jitter_t empty = {0, UINT32_MAX, 0, 0};
+  prv_cmdsched_jitter_trig = empty;
+  prv_cmdsched_jitter_exec = empty;
+}
+
+/**
+ * @brief returns 1 if a cmd is popped and waiting for its exec time.
+ * Don't start anything that could delay it (CLI cmds, sampling...)
+ */
+uint8_t cmdsched_is_armed(void){
+  return prv_cmdsched_armed;
+}
+
 //run this as often as possible. returns time left until next cmd is to be executed
 uint64_t cmdsched_handler(void){
   uint64_t time_to_cmd;
 
+  //cmd armed. Don't block, just check if compare interrupt already fired
+  if(prv_cmdsched_armed){
+    if(!prv_cmdsched_due){
+      return 0;
+    }
+    prv_cmdsched_armed = 0;
+    uint64_t exec_start = usec_get_timestamp_64();
+    prv_cmdsched_jitter_add(&prv_cmdsched_jitter_trig, prv_cmdsched_trigger_time, prv_cmdsched_armed_cmd.exec_time);
+    prv_cmdsched_jitter_add(&prv_cmdsched_jitter_exec, exec_start, prv_cmdsched_armed_cmd.exec_time);
+    prv_cmdsched_exec();
+    //cmds without trigger hook actually start in main loop
+    uint8_t has_trigger = prv_cmdsched_armed_desc != NULL && prv_cmdsched_armed_desc->trigger != NULL;
+    uint64_t start = has_trigger ? prv_cmdsched_trigger_time : exec_start;
+    uint64_t end = usec_get_timestamp_64();
+    cmdtrace_record(prv_cmdsched_armed_cmd.cmd_id, prv_cmdsched_armed_cmd.exec_time, start, exec_start, end);
+    prv_cmdsched_dur_calibrate(prv_cmdsched_armed_cmd.cmd_id, prv_cmdsched_armed_cmd.params_buff, (uint32_t)(end - start));
+    return prv_cmdsched_time_to_next_cmd();
+  }
+
   if(cmdsched_q_count() == 0 || !isSchRunning()){
     //nothing in queue. we have a lot of time.
     time_of_lastcmd_request = 0;
     return 0xFFFFFFFFFFFFFFFF;
   }
   uint64_t time_now = usec_get_timestamp_64();
-  cmd_sched_t cmd = cmdsched_q_peek();
+  uint64_t exec_time = prv_cmdsched_q_peek_time();
   //time to parse and run?
-  if(time_now < cmd.exec_time - CMDSCHED_POP_BEFORE_EXEC_US)
+  if(time_now < exec_time - CMDSCHED_POP_BEFORE_EXEC_US)
   {
     //nothing to do yet. return time to next cmd
-    time_to_cmd =  cmd.exec_time - time_now - CMDSCHED_POP_BEFORE_EXEC_US;
-    if((cmdsched_q_free_spaces() > 0) && (EndOfSequenceReceived == 0)) //if there is any room in the buffer
+    time_to_cmd =  exec_time - time_now - CMDSCHED_POP_BEFORE_EXEC_US;
+    if(prv_cmdsched_q_fits(1, CMDSCHED_PARAM_BUFF_LEN) && (EndOfSequenceReceived == 0)) //if there is any room in the buffer
     {
       if(time_to_cmd > MIN_TIME_TO_CMD_TO_REQ_CMDS_US)    //and enough time to do it
       {                                                   //send request for new cmds to put in cmd queue
@@ -181,300 +1498,56 @@ uint64_t cmdsched_handler(void){
     return time_to_cmd;
   }
 
-  //time to pop, parse and execute cmd
-  //data already loaded in cmd from peek. Just pop this one out of the q
-  cmdsched_q_pop();
-  //parse depending on cmd_id
-  switch (cmd.cmd_id) {
-    case mppt_start_id: {
-      mppt_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(mppt_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      mppt_start(param.channel, param.settling_time, param.report_every_xth_point);
-      break;
-    }
-    case mppt_resume_id: {
-      mppt_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(mppt_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      mppt_resume(param.channel, param.settling_time, param.report_every_xth_point);
-      break;
-    }
-    case mppt_stop_id: {
-      mainser_printf("\r\n");
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      mppt_stop();
-      break;
-    }
-    case meas_get_voltage_id: {
-      meas_get_voltage_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_get_voltage_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_get_voltage(param.channel);
-      break;
-    }
-    case meas_get_current_id: {
-      meas_get_current_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_get_current_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_get_current(param.channel);
-      break;
-    }
-    case meas_get_IV_point_id: {
-      meas_get_IV_point_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_get_IV_point_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_get_exact_IV_point(param.channel, param.voltage, param.disable_current_when_finished, param.noident);
-      break;
-    }
-    case meas_get_iv_characteristic_id: {
-      meas_get_iv_characteristic_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_get_iv_characteristic_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_get_iv_characteristic(param.channel, param.start_volt, param.end_volt, param.step_volt, param.step_time, param.Npoints_per_step);
-      break;
-    }
-    case meas_volt_sample_and_dump_id: {
-      meas_sample_and_dump_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_sample_and_dump_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_volt_sample_and_dump(param.channel, param.num_samples);
-      break;
-    }
-    case meas_curr_sample_and_dump_id: {
-      meas_sample_and_dump_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_sample_and_dump_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_curr_sample_and_dump(param.channel, param.num_samples);
-      break;
-    }
-    case meas_iv_sample_and_dump_id: {
-      meas_sample_and_dump_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_sample_and_dump_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_iv_sample_and_dump(param.channel, param.num_samples);
-      break;
-    }
-    case ledctrl_set_current_id: {
-      ledctrl_set_current_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(ledctrl_set_current_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      ledctrl_set_current_tempcomp(param.current);
-      break;
-    }
-    case ledctrl_set_illum_id: {
-      ledctrl_set_illum_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(ledctrl_set_illum_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      ledctrl_set_illum(param.illum);
-      break;
-    }
-    case meas_flashmeasure_dumpbuffer_id: {
-      meas_flashmeasure_dumpbuffer_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_flashmeasure_dumpbuffer_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_flashmeasure_dumpbuffer(param.channel, param.illum, param.flash_dur_us);
-      break;
-    }
-    case meas_flashmeasure_singlesample_id: {
-      meas_flashmeasure_singlesample_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_flashmeasure_singlesample_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_flashmeasure_singlesample(param.channel, param.illum, param.flash_dur_us, param.measure_at_us, param.numavg);
-      break;
-    }
-    case end_of_sequence_id: {
-      mainser_printf("\r\n");
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_end_of_sequence();
-      HAL_Delay(1000);
-      NVIC_SystemReset();
-      break;
-    }
-    case fec_enable_current_id: {
-      fec_enable_disable_current_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(fec_enable_disable_current_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      fec_enable_current(param.channel);
-      break;
-    }
-    case fec_disable_current_id: {
-      fec_enable_disable_current_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(fec_enable_disable_current_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      fec_disable_current(param.channel);
-      break;
-    }
-    case setshunt_id: {
-      fec_setshunt_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(fec_setshunt_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-
-      switch(param.shunt){
-        case 1:
-          fec_set_shunt_1x(param.channel);
-          break;
-        case 10:
-          fec_set_shunt_10x(param.channel);
-          break;
-        case 100:
-          fec_set_shunt_100x(param.channel);
-          break;
-        case 1000:
-          fec_set_shunt_1000x(param.channel);
-          break;
-        default:
-          break;
-      }
-    }
-    case setforcevolt_id: {
-      fec_setforcevolt_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(fec_setforcevolt_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      fec_set_force_voltage(param.channel, param.volt);
-      break;
-    }
-    case autorange_id: {
-      mainser_printf("\r\n");
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      daq_autorange();
-      break;
-    }
-    case getledtemp_id: {
-      mainser_printf("\r\n");
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      ledctrl_print_temperature_mainser();
-      break;
-    }
-    case calibillum_id: {
-      mainser_printf("\r\n");
-      ledctrl_calibillum_param_t param;
-      cmdsched_decode(cmd, &param, sizeof(ledctrl_calibillum_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      ledctrl_calibrate_illum_curr(param.illum, param.curr, param.a, param.b, param.c);
-      break;
-    }
-    case calibillumL_id: {
-      mainser_printf("\r\n");
-      ledctrl_calibillumL_param_t param;
-      cmdsched_decode(cmd, &param, sizeof(ledctrl_calibillumL_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      ledctrl_calibrate_illum_curr_low(param.a, param.b, param.c);
-      break;
-    }
-    case meas_set_numavg_id: {
-      mainser_printf("\r\n");
-      meas_set_num_avg_param_t param;
-      cmdsched_decode(cmd, &param, sizeof(meas_set_num_avg_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_set_num_avg(param.numavg);
-      break;
-    }
-    case meas_get_numavg_id: {
-      mainser_printf("\r\n");
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      prv_meas_print_timestamp(usec_get_timestamp_64());
-      mainser_printf("NUMAVG:%lu\r\n", meas_get_num_avg());
-      break;
-    }
-    case meas_get_settle_time_id: {
-      meas_set_stltm_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_set_stltm_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      prv_meas_print_timestamp(usec_get_timestamp_64());
-      mainser_printf("SETTLE_TIME:%lu\r\n", meas_get_settling_time());
-      break;
-    }
-    case meas_set_settle_time_id: {
-      meas_set_stltm_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_set_stltm_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      meas_set_settling_time(param.settle_time);
-      break;
-    }
-    case meas_get_noise_id: {
-      meas_get_noise_param_t param;
-      mainser_printf("\r\n");
-      cmdsched_decode(cmd, &param, sizeof(meas_get_noise_param_t));
-      //wait for exact time to call function
-      while(usec_get_timestamp_64() < cmd.exec_time);
-      if(param.volt_flag) {
-        meas_get_noise_volt(param.channel);
-      }
-      if(param.curr_flag) {
-        meas_get_noise_curr(param.channel);
-      }
-      break;
-    }
-
+  //time to pop cmd and arm compare interrupt for its exec time
+  cmd_sched_t cmd = cmdsched_q_pop();
+  prv_cmdsched_armed_cmd = cmd;
+  prv_cmdsched_armed = 1;
+  prv_cmdsched_due = 0;
+  prv_cmdsched_armed_desc = prv_cmdsched_get_desc(cmd.cmd_id);
+  if(prv_cmdsched_armed_desc != NULL && prv_cmdsched_armed_desc->stage != NULL){
+    prv_cmdsched_armed_desc->stage(prv_cmdsched_armed_cmd.params_buff);
+  }
+  usec_compare_arm(cmd.exec_time, prv_cmdsched_compare_callback);
+  return 0;
+}
 
-    default: {
-      // Handle other cases or errors
-      printf("Unknown command id\n");
-      break;
-    }
+/**
+ * @brief executes (main loop part of) armed cmd. Called after compare interrupt fired.
+ */
+static void prv_cmdsched_exec(void){
+  const cmdsched_cmd_desc_t *desc = prv_cmdsched_armed_desc;
+  if(desc == NULL){
+    dbg(Error, "Unknown command id %d\n", prv_cmdsched_armed_cmd.cmd_id);
+    return;
+  }
+  if(desc->exec != NULL){
+    uint32_t resp_id = mainser_get_resp_id();
+    mainser_set_resp_id(prv_cmdsched_armed_cmd.req_id);
+    //separator line belongs to the cmd output, so it is tagged too
+    mainser_printf("\r\n");
+    desc->exec(prv_cmdsched_armed_cmd.params_buff);
+    mainser_set_resp_id(resp_id);
   }
-  //return time left until next cmd is to be executed
-  if ( (cmdsched_q_count() == 0) && (EndOfSequenceReceived == 0) ){
+}
+
+/**
+ * @brief returns time left until next cmd has to be popped. Requests new cmds if queue is empty
+ */
+static uint64_t prv_cmdsched_time_to_next_cmd(void){
+  if (cmdsched_q_count() == 0){
     //nothing in queue, we have a lot of time, request sched
-    cmdsprt_request_new_cmds();
+    if (EndOfSequenceReceived == 0)
+      cmdsprt_request_new_cmds();
     return 0xFFFFFFFFFFFFFFFF;
   }
 
-  cmd = cmdsched_q_peek();
+  uint64_t exec_time = prv_cmdsched_q_peek_time();
   uint64_t tnow = usec_get_timestamp_64();
-  time_to_cmd =  cmd.exec_time - time_now - CMDSCHED_POP_BEFORE_EXEC_US;
   //check that if time left is actually positive (scheduled cmds can be late...)
   //  (unsigned numbers can be tricky :) - time_to_cmd is always positive value)
-  if((tnow + CMDSCHED_POP_BEFORE_EXEC_US) >  cmd.exec_time){
+  if((tnow + CMDSCHED_POP_BEFORE_EXEC_US) >  exec_time){
     //we are already late, no time to transfer cmds. return 0
     return 0;
   }
-  return time_to_cmd;
+  return exec_time - tnow - CMDSCHED_POP_BEFORE_EXEC_US;
 }
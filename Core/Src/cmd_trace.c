@@ -0,0 +1,147 @@
+//
+// cmd_trace.c
+//
+// See cmd_trace.h for the trace ring and reports.
+
+#include "cmd_trace.h"
+#include <string.h>
+#include "main_serial.h"
+
+_Static_assert((CMDTRACE_RING_SIZE & (CMDTRACE_RING_SIZE - 1)) == 0, "CMDTRACE_RING_SIZE must be power of 2");
+
+//per cmd id statistics
+typedef struct {
+    uint32_t num;
+    uint32_t max_late_us;
+    uint32_t max_duration_us;
+    uint64_t sum_duration_us;
+} prv_cmdtrace_id_stats_t;
+
+static cmdtrace_record_t prv_cmdtrace_ring[CMDTRACE_RING_SIZE];
+static uint32_t prv_cmdtrace_head = 0;  //free running, number of records since reset
+static uint32_t prv_cmdtrace_hist[CMDTRACE_HIST_BINS];
+static prv_cmdtrace_id_stats_t prv_cmdtrace_id_stats[CMDTRACE_NUM_IDS];
+
+
+static uint32_t prv_cmdtrace_diff(uint64_t actual, uint64_t planned){
+  if(actual <= planned){
+    return 0;
+  }
+  return (actual - planned > UINT32_MAX) ? UINT32_MAX : (uint32_t)(actual - planned);
+}
+
+static uint8_t prv_cmdtrace_bin(uint32_t late_us){
+  if(late_us == 0){
+    return 0;
+  }
+  uint8_t bin = 32 - __builtin_clz(late_us);
+  return (bin < CMDTRACE_HIST_BINS) ? bin : CMDTRACE_HIST_BINS - 1;
+}
+
+/**
+ * @brief records one executed cmd. Call from main loop after cmd finished.
+ * @param cmd_id meas_funct_id or CMDTRACE_ID_CLI
+ * @param planned planned start time
+ * @param start actual start time (compare interrupt)
+ * @param exec_start start of main loop part
+ * @param end end of main loop part
+ */
+void cmdtrace_record(uint8_t cmd_id, uint64_t planned, uint64_t start, uint64_t exec_start, uint64_t end){
+  if(cmd_id >= CMDTRACE_NUM_IDS){
+    return;
+  }
+  cmdtrace_record_t *rec = &prv_cmdtrace_ring[prv_cmdtrace_head & (CMDTRACE_RING_SIZE - 1)];
+  rec->cmd_id = cmd_id;
+  rec->planned = planned;
+  rec->start_late_us = prv_cmdtrace_diff(start, planned);
+  rec->exec_late_us = prv_cmdtrace_diff(exec_start, planned);
+  rec->duration_us = prv_cmdtrace_diff(end, exec_start);
+  prv_cmdtrace_head++;
+
+  //CLI cmds are not planned, lateness is meaningless
+  if(cmd_id != CMDTRACE_ID_CLI){
+    prv_cmdtrace_hist[prv_cmdtrace_bin(rec->start_late_us)]++;
+  }
+  prv_cmdtrace_id_stats_t *stats = &prv_cmdtrace_id_stats[cmd_id];
+  stats->num++;
+  stats->sum_duration_us += rec->duration_us;
+  if(rec->start_late_us > stats->max_late_us) stats->max_late_us = rec->start_late_us;
+  if(rec->duration_us > stats->max_duration_us) stats->max_duration_us = rec->duration_us;
+}
+
+/**
+ * @brief prints lateness histogram of scheduled cmds to main serial
+ */
+void cmdtrace_print_hist(void){
+  mainser_printf("SCHED_LATE_HIST:\r\n");
+  mainser_printf("LT_1US:%lu\r\n", prv_cmdtrace_hist[0]);
+  for(uint8_t i = 1; i < CMDTRACE_HIST_BINS - 1; i++){
+    mainser_printf("LT_%luUS:%lu\r\n", 1UL << i, prv_cmdtrace_hist[i]);
+  }
+  mainser_printf("GE_%luUS:%lu\r\n", 1UL << (CMDTRACE_HIST_BINS - 2), prv_cmdtrace_hist[CMDTRACE_HIST_BINS - 1]);
+}
+
+/**
+ * @brief prints statistics of all cmd ids that were executed, worst (latest) first.
+ * Line format: ID:N:MAX_LATE_US:MAX_DUR_US:AVG_DUR_US. CLI cmds have ID CLI.
+ */
+void cmdtrace_print_worst(void){
+  uint8_t order[CMDTRACE_NUM_IDS];
+  uint8_t n = 0;
+  for(uint8_t id = 0; id < CMDTRACE_NUM_IDS; id++){
+    if(prv_cmdtrace_id_stats[id].num > 0){
+      order[n++] = id;
+    }
+  }
+  //insertion sort by max lateness, then by max duration
+  for(uint8_t i = 1; i < n; i++){
+    uint8_t id = order[i];
+    uint8_t j = i;
+    while(j > 0){
+      const prv_cmdtrace_id_stats_t *a = &prv_cmdtrace_id_stats[order[j - 1]];
+      const prv_cmdtrace_id_stats_t *b = &prv_cmdtrace_id_stats[id];
+      if(a->max_late_us > b->max_late_us ||
+         (a->max_late_us == b->max_late_us && a->max_duration_us >= b->max_duration_us)) break;
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = id;
+  }
+
+  mainser_printf("SCHED_WORST:\r\n");
+  mainser_printf("ID:N:MAX_LATE_US:MAX_DUR_US:AVG_DUR_US\r\n");
+  for(uint8_t i = 0; i < n; i++){
+    const prv_cmdtrace_id_stats_t *stats = &prv_cmdtrace_id_stats[order[i]];
+    uint32_t avg = (uint32_t)(stats->sum_duration_us / stats->num);
+    if(order[i] == CMDTRACE_ID_CLI){
+      mainser_printf("CLI:%lu:%lu:%lu:%lu\r\n", stats->num, stats->max_late_us, stats->max_duration_us, avg);
+    }
+    else{
+      mainser_printf("%u:%lu:%lu:%lu:%lu\r\n", order[i], stats->num, stats->max_late_us, stats->max_duration_us, avg);
+    }
+  }
+}
+
+/**
+ * @brief prints last records (oldest first) to main serial
+ */
+void cmdtrace_dump(void){
+  uint32_t num = (prv_cmdtrace_head < CMDTRACE_RING_SIZE) ? prv_cmdtrace_head : CMDTRACE_RING_SIZE;
+  mainser_printf("SCHED_TRACE:%lu\r\n", num);
+  mainser_printf("ID:PLANNED:START_LATE_US:EXEC_LATE_US:DUR_US\r\n");
+  for(uint32_t i = prv_cmdtrace_head - num; i != prv_cmdtrace_head; i++){
+    const cmdtrace_record_t *rec = &prv_cmdtrace_ring[i & (CMDTRACE_RING_SIZE - 1)];
+    if(rec->cmd_id == CMDTRACE_ID_CLI){
+      mainser_printf("CLI:%llu:%lu:%lu:%lu\r\n", rec->planned, rec->start_late_us, rec->exec_late_us, rec->duration_us);
+    }
+    else{
+      mainser_printf("%u:%llu:%lu:%lu:%lu\r\n", rec->cmd_id, rec->planned, rec->start_late_us, rec->exec_late_us, rec->duration_us);
+    }
+  }
+}
+
+void cmdtrace_reset(void){
+  prv_cmdtrace_head = 0;
+  memset(prv_cmdtrace_hist, 0, sizeof(prv_cmdtrace_hist));
+  memset(prv_cmdtrace_id_stats, 0, sizeof(prv_cmdtrace_id_stats));
+}
@@ -22,6 +22,9 @@ uint8_t prv_daq_ready_to_sample;
 
 uint32_t prv_daq_num_samples;
 
+//sample time in us, DAQ_SAMPLE_TIME_100KSPS x divider (daq_set_sample_divider())
+uint32_t prv_daq_sample_time_us = DAQ_SAMPLE_TIME_100KSPS;
+
 
 /**
  * @brief init data acquisition. Inits vars, timers, etc
@@ -58,6 +61,8 @@ void daq_prepare_for_sampling(uint32_t num_samples){
 
   //stop timer
   HAL_TIM_Base_Stop_IT(DAQ_SAMPLE_TIMER_HANDLE);
+  //not started by trigger unless asked (daq_start_sampling_on_trigger())
+  daq_release_trigger();
   //reset overflow IT flag just in case
   __HAL_TIM_CLEAR_IT(DAQ_SAMPLE_TIMER_HANDLE , TIM_IT_UPDATE);
   //reset tim20 counter to just before overflow
@@ -105,6 +110,148 @@ void daq_start_sampling(void){
 
 }
 
+/**
+ * @brief Starts sampling while the sample timer is already running (e.g. looped LED waveform), without
+ * stopping it. First sample is taken on the next timer update after this returns.
+ * Disables timer update interrupt (it is not used while sampling).
+ * @param num_samples number of samples to take
+ */
+void daq_start_sampling_running(uint32_t num_samples){
+  assert_param(daq_sampling_done_volt && daq_sampling_done_curr);
+  assert_param(num_samples*DAQ_NUM_CH <= DAQ_BUFF_SIZE);
+
+  prv_daq_num_samples = num_samples;
+  prv_daq_ready_to_sample = 0;
+  //ADCs may still wait for a trigger after previous sampling
+  HAL_ADC_Stop_DMA(DAQ_VOLT_ADC_HANDLE);
+  HAL_ADC_Stop_DMA(DAQ_CURR_ADC_HANDLE);
+  daq_sampling_done_volt = 0;
+  daq_sampling_done_curr = 0;
+  D2On();
+  L2On();
+  //start both ADCs right after an update, so they start on the same one
+  __HAL_TIM_DISABLE_IT(DAQ_SAMPLE_TIMER_HANDLE, TIM_IT_UPDATE);
+  __HAL_TIM_CLEAR_FLAG(DAQ_SAMPLE_TIMER_HANDLE, TIM_FLAG_UPDATE);
+  while(!__HAL_TIM_GET_FLAG(DAQ_SAMPLE_TIMER_HANDLE, TIM_FLAG_UPDATE));
+  __disable_irq();
+  HAL_ADC_Start_DMA(DAQ_VOLT_ADC_HANDLE,
+                    (uint32_t*)g_daq_buffer_volt,
+                    num_samples*DAQ_NUM_CH);
+  HAL_ADC_Start_DMA(DAQ_CURR_ADC_HANDLE,
+                    (uint32_t*)g_daq_buffer_curr,
+                    num_samples*DAQ_NUM_CH);
+  __enable_irq();
+}
+
+/**
+ * @brief Sets sample time to div x DAQ_SAMPLE_TIME_100KSPS: sample timer updates (ADC trigger, LED waveform
+ * point) only every div-th period (repetition counter). Stops the sample timer. Must not be called while
+ * sampling is prepared or a waveform is armed (update event is generated to load the counter).
+ * Set back to 1 when done, other measurements expect 100 ksps.
+ * @param div 1 to DAQ_SAMPLE_DIV_MAX
+ */
+void daq_set_sample_divider(uint32_t div){
+  if(div < 1){
+    div = 1;
+  }
+  if(div > DAQ_SAMPLE_DIV_MAX){
+    div = DAQ_SAMPLE_DIV_MAX;
+  }
+  HAL_TIM_Base_Stop_IT(DAQ_SAMPLE_TIMER_HANDLE);
+  WRITE_REG((DAQ_SAMPLE_TIMER_HANDLE)->Instance->RCR, div - 1);
+  //repetition counter is preloaded, load it now
+  (DAQ_SAMPLE_TIMER_HANDLE)->Instance->EGR = TIM_EGR_UG;
+  __HAL_TIM_CLEAR_IT(DAQ_SAMPLE_TIMER_HANDLE, TIM_IT_UPDATE);
+  prv_daq_sample_time_us = DAQ_SAMPLE_TIME_100KSPS * div;
+}
+
+/**
+ * @brief sample time in us (DAQ_SAMPLE_TIME_100KSPS unless divider is set)
+ */
+uint32_t daq_get_sample_time_us(void){
+  return prv_daq_sample_time_us;
+}
+
+/**
+ * @brief Delays first sample (and so all of them) by delay_ticks of sample timer (170 MHz) after start.
+ * Call after daq_prepare_for_sampling(), before start. Used for equivalent-time sampling.
+ * @param delay_ticks less than DAQ_SAMPLE_TIMER_PERIOD_100KSPS
+ */
+void daq_set_start_delay(uint32_t delay_ticks){
+  if(delay_ticks >= DAQ_SAMPLE_TIMER_PERIOD_100KSPS){
+    delay_ticks = DAQ_SAMPLE_TIMER_PERIOD_100KSPS - 1;
+  }
+  __HAL_TIM_SET_COUNTER(DAQ_SAMPLE_TIMER_HANDLE, DAQ_SAMPLE_TIMER_PERIOD_100KSPS - 1 - delay_ticks);
+}
+
+/**
+ * @brief Like daq_start_sampling(), but sampling timer is started by hardware on next rising edge of
+ * DAQ_SAMPLE_TIMER_TRIGGER (LED pulse edge). Register writes only, safe to call from interrupt.
+ * !!! daq_prepare_for_sampling() MUST be called before this !!!
+ */
+void daq_start_sampling_on_trigger(void){
+  //check if ready to sample
+  assert_param(prv_daq_ready_to_sample);
+
+  //reset flag
+  prv_daq_ready_to_sample = 0;
+
+  //reset done flags
+  daq_sampling_done_volt = 0;
+  daq_sampling_done_curr = 0;
+
+  D2On();
+  L2On();
+
+  //trigger mode: trigger edge sets counter enable. Counter is just before overflow, so first sample is right at the edge
+  __HAL_TIM_ENABLE_IT(DAQ_SAMPLE_TIMER_HANDLE, TIM_IT_UPDATE);
+  MODIFY_REG((DAQ_SAMPLE_TIMER_HANDLE)->Instance->SMCR, TIM_SMCR_TS | TIM_SMCR_SMS,
+             DAQ_SAMPLE_TIMER_TRIGGER | TIM_SLAVEMODE_TRIGGER);
+}
+
+/**
+ * @brief disconnects sampling timer from trigger. Timer keeps running if trigger already started it.
+ */
+void daq_release_trigger(void){
+  CLEAR_BIT((DAQ_SAMPLE_TIMER_HANDLE)->Instance->SMCR, TIM_SMCR_SMS);
+}
+
+/**
+ * @brief number of complete samples (all channels) in voltage buffer so far. Can be read while sampling.
+ */
+uint32_t daq_get_num_samples_taken(void){
+  if(daq_sampling_done_volt){
+    return prv_daq_num_samples;
+  }
+  //DMA counts down remaining transfers
+  uint32_t remaining = __HAL_DMA_GET_COUNTER((DAQ_VOLT_ADC_HANDLE)->DMA_Handle);
+  return prv_daq_num_samples - (remaining + DAQ_NUM_CH - 1) / DAQ_NUM_CH;
+}
+
+/**
+ * @brief Stops sampling before all samples are taken. Samples taken so far stay in buffers and
+ * count as all samples (timestamps, averages). Does nothing if sampling is done.
+ */
+void daq_stop_sampling(void){
+  if(daq_is_sampling_done()){
+    return;
+  }
+  HAL_TIM_Base_Stop_IT(DAQ_SAMPLE_TIMER_HANDLE);
+  daq_release_trigger();
+  uint32_t taken = daq_get_num_samples_taken();
+  HAL_ADC_Stop_DMA(DAQ_VOLT_ADC_HANDLE);
+  HAL_ADC_Stop_DMA(DAQ_CURR_ADC_HANDLE);
+  //last sample was taken less than a sample time ago
+  prv_daq_num_samples = (taken > 0) ? taken : 1;
+  daq_sampling_volt_done_timestamp = usec_get_timestamp_64();
+  daq_sampling_curr_done_timestamp = daq_sampling_volt_done_timestamp;
+  daq_sampling_done_volt = 1;
+  daq_sampling_done_curr = 1;
+  prv_daq_ready_to_sample = 0;
+  D2Off();
+  L2Off();
+}
+
 /**
  * @brief Check if sampling both voltage and current channels is done.
  * (should happen at the same time)
@@ -137,7 +284,7 @@ void daq_calibrate_adcs(void){
  */
 uint64_t daq_get_sampling_start_timestamp(void){
   //sampling time for n samples takes n-1 periods of TIM20 + 1 conversion time
-  return daq_sampling_volt_done_timestamp - (uint64_t)DAQ_SAMPLE_TIME_100KSPS*(prv_daq_num_samples-1);
+  return daq_sampling_volt_done_timestamp - (uint64_t)prv_daq_sample_time_us*(prv_daq_num_samples-1);
 }
 
 
@@ -168,7 +315,7 @@ t_daq_sample_raw daq_get_from_buffer_volt(uint32_t sample_idx){
   sample.ch4 = g_daq_buffer_volt[sample_idx * DAQ_NUM_CH + 3]<<DAQ_SAMPLE_BITSIHFT;
   sample.ch5 = g_daq_buffer_volt[sample_idx * DAQ_NUM_CH + 4]<<DAQ_SAMPLE_BITSIHFT;
   sample.ch6 = g_daq_buffer_volt[sample_idx * DAQ_NUM_CH + 5]<<DAQ_SAMPLE_BITSIHFT;
-  sample.timestamp = daq_get_sampling_start_timestamp()+DAQ_SAMPLE_TIME_100KSPS*sample_idx;
+  sample.timestamp = daq_get_sampling_start_timestamp()+prv_daq_sample_time_us*sample_idx;
   return sample;
 }
 
@@ -198,7 +345,7 @@ t_daq_sample_raw daq_get_from_buffer_curr(uint32_t sample_idx){
   sample.ch4 = g_daq_buffer_curr[sample_idx * DAQ_NUM_CH + 3]<<DAQ_SAMPLE_BITSIHFT;
   sample.ch5 = g_daq_buffer_curr[sample_idx * DAQ_NUM_CH + 4]<<DAQ_SAMPLE_BITSIHFT;
   sample.ch6 = g_daq_buffer_curr[sample_idx * DAQ_NUM_CH + 5]<<DAQ_SAMPLE_BITSIHFT;
-  sample.timestamp = daq_get_sampling_start_timestamp()+DAQ_SAMPLE_TIME_100KSPS*sample_idx;
+  sample.timestamp = daq_get_sampling_start_timestamp()+prv_daq_sample_time_us*sample_idx;
   return sample;
 }
 
@@ -339,7 +486,7 @@ t_daq_sample_raw daq_volt_raw_get_average(uint32_t num_samples){
   avg_sample.ch6 = sum_array[5] / num_samples;
 
   //calculate timestamp.
-  avg_sample.timestamp = daq_get_sampling_start_timestamp() + (num_samples/2)*DAQ_SAMPLE_TIME_100KSPS;
+  avg_sample.timestamp = daq_get_sampling_start_timestamp() + (num_samples/2)*prv_daq_sample_time_us;
 
 
   t2 = usec_get_timestamp();
@@ -387,7 +534,7 @@ t_daq_sample_raw daq_curr_raw_get_average(uint32_t num_samples){
   avg_sample.ch6 = sum_array[5] / num_samples;
 
   //calculate timestamp.
-  avg_sample.timestamp = daq_get_sampling_start_timestamp() + (num_samples/2)*DAQ_SAMPLE_TIME_100KSPS;
+  avg_sample.timestamp = daq_get_sampling_start_timestamp() + (num_samples/2)*prv_daq_sample_time_us;
 
 
   t2 = usec_get_timestamp();
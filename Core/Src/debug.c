@@ -7,49 +7,274 @@
 #include <stdarg.h>
 #include "usart.h"
 #include "UserGPIO.h"
+#include "micro_sec.h"
 
-void dbg(DebugLevel level, const char* format, ...) {
-  static char buffer[DEBUG_BUFFER_SIZE];
-  uint32_t msg_len_cnt;
+/**
+ * @brief one deferred debug message. Arguments are stored as raw 32bit words,
+ * types are recovered from the format string when formatting.
+ */
+typedef struct {
+    const char* format;
+    uint32_t timestamp;
+    uint8_t level;
+    uint8_t n_words;
+    volatile uint8_t ready;   //set last by producer, cleared by consumer
+    uint32_t args[DEBUG_MAX_ARG_WORDS];
+} dbg_record_t;
+
+_Static_assert((DEBUG_RING_SIZE & (DEBUG_RING_SIZE - 1)) == 0, "DEBUG_RING_SIZE must be power of 2");
+
+static dbg_record_t prv_dbg_ring[DEBUG_RING_SIZE];
+//free running indices. head is reserved by producers (main and ISRs), tail is moved by dbg_handler() only
+static volatile uint32_t prv_dbg_head = 0;
+static volatile uint32_t prv_dbg_tail = 0;
+
+volatile uint32_t g_dbg_dropped_count = 0;
+static uint32_t prv_dbg_dropped_reported = 0;
+
+//DMA source buffer. Only touched when UART is ready
+static char prv_dbg_buffer[DEBUG_BUFFER_SIZE];
+
+
+/**
+ * @brief finds the next conversion in printf format string
+ * @param p pointer to '%'
+ * @param spec_len returns length of the conversion spec (including '%')
+ * @param n_star returns number of '*' width/precision args
+ * @param is_long_long returns 1 for ll/j length modifier
+ * @return conversion character
+ */
+static char prv_dbg_parse_spec(const char* p, uint8_t* spec_len, uint8_t* n_star, uint8_t* is_long_long){
+  const char* s = p + 1;
+  *n_star = 0;
+  *is_long_long = 0;
+  //flags, width, precision
+  while(*s != 0 && strchr("-+ #0123456789.*", *s) != NULL){
+    if(*s == '*') (*n_star)++;
+    s++;
+  }
+  //length modifiers
+  while(*s != 0 && strchr("hlLqjzt", *s) != NULL){
+    if((*s == 'l' && *(s+1) == 'l') || *s == 'j' || *s == 'q'){
+      *is_long_long = 1;
+    }
+    s++;
+  }
+  *spec_len = (uint8_t)(s - p + (*s != 0 ? 1 : 0));
+  return *s;
+}
+
+/**
+ * @brief copies arguments into record words, as described by format string
+ * @return number of words used
+ */
+static uint8_t prv_dbg_pack_args(const char* format, va_list args, uint32_t* words){
+  uint8_t n = 0;
+  uint8_t spec_len, n_star, is_ll;
+  const char* p = format;
+
+  while(*p != 0){
+    if(*p != '%'){
+      p++;
+      continue;
+    }
+    char conv = prv_dbg_parse_spec(p, &spec_len, &n_star, &is_ll);
+    p += spec_len;
+    if(conv == '%' || conv == 0) continue;
+
+    //width/precision given as arguments
+    for(uint8_t i = 0; i < n_star; i++){
+      if(n >= DEBUG_MAX_ARG_WORDS) return n;
+      words[n++] = (uint32_t)va_arg(args, int);
+    }
+
+    if(strchr("fFeEgGaA", conv) != NULL){
+      if(n + 2 > DEBUG_MAX_ARG_WORDS) return n;
+      double d = va_arg(args, double);
+      memcpy(&words[n], &d, sizeof(d));
+      n += 2;
+    }
+    else if(is_ll && strchr("diuxXo", conv) != NULL){
+      if(n + 2 > DEBUG_MAX_ARG_WORDS) return n;
+      uint64_t v = va_arg(args, unsigned long long);
+      memcpy(&words[n], &v, sizeof(v));
+      n += 2;
+    }
+    else if(conv == 's' || conv == 'p'){
+      if(n >= DEBUG_MAX_ARG_WORDS) return n;
+      words[n++] = (uint32_t)(uintptr_t)va_arg(args, void*);
+    }
+    else{
+      //int, char and everything that fits in 32 bits on this MCU
+      if(n >= DEBUG_MAX_ARG_WORDS) return n;
+      words[n++] = (uint32_t)va_arg(args, unsigned int);
+    }
+  }
+  return n;
+}
+
+/**
+ * @brief store a debug message for deferred sending. Don't call directly, use dbg() macro.
+ * Safe to call from interrupts. Never blocks, drops message if ring is full.
+ */
+void dbg_push(DebugLevel level, const char* format, ...){
+  uint32_t head;
+  //reserve slot (lock-free, producers may interrupt each other)
+  do{
+    head = prv_dbg_head;
+    if(head - prv_dbg_tail >= DEBUG_RING_SIZE){
+      __atomic_fetch_add(&g_dbg_dropped_count, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  } while(!__atomic_compare_exchange_n(&prv_dbg_head, &head, head + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  dbg_record_t* rec = &prv_dbg_ring[head & (DEBUG_RING_SIZE - 1)];
   va_list args;
   va_start(args, format);
+  rec->format = format;
+  rec->timestamp = usec_get_timestamp();
+  rec->level = (uint8_t)level;
+  rec->n_words = prv_dbg_pack_args(format, args, rec->args);
+  va_end(args);
 
-  // Wait for the UART to be ready to transmit.
-  while(HAL_UART_GetState(&hlpuart1) != HAL_UART_STATE_READY);
-  msg_len_cnt = 0;
-  switch (level) {
-    case Error:
-#if DEBUG_LEVEL >= DBG_ERROR
-      strncpy(buffer, DBG_MSG_ERROR, sizeof(buffer));
-      vsnprintf(buffer + strlen(DBG_MSG_ERROR), sizeof(buffer) - strlen(DBG_MSG_ERROR), format, args);
-      msg_len_cnt = 0;
-      while(buffer[msg_len_cnt] != 0) msg_len_cnt++;
-      break;
-#endif
-    case Warning:
-#if DEBUG_LEVEL >= DBG_WARNING
-      strncpy(buffer, DBG_MSG_WARNING, sizeof(buffer));
-        vsnprintf(buffer + strlen(DBG_MSG_WARNING), sizeof(buffer) - strlen(DBG_MSG_WARNING), format, args);
-        // Add your function to send buffer out to hardware here.
-      msg_len_cnt = 0;
-      while(buffer[msg_len_cnt] != 0) msg_len_cnt++;
-      break;
-#endif
-    case Debug:
-#if DEBUG_LEVEL >= DBG_ALL
-      strncpy(buffer, DBG_MSG_DEBUG, sizeof(buffer));
-        vsnprintf(buffer + strlen(DBG_MSG_DEBUG), sizeof(buffer) - strlen(DBG_MSG_DEBUG), format, args);
-        // Add your function to send buffer out to hardware here.
-      msg_len_cnt = 0;
-      while(buffer[msg_len_cnt] != 0) msg_len_cnt++;
-      break;
-#endif
-    default:
-      break;
-  }
-
-  //start uart transmission
-  HAL_UART_Transmit_DMA(DEBUG_UART_HANDLE, (uint8_t *)(buffer), msg_len_cnt);
+  __atomic_store_n(&rec->ready, 1, __ATOMIC_RELEASE);
+}
 
-  va_end(args);
+/**
+ * @brief formats one record into buf
+ * @return number of chars needed (like snprintf)
+ */
+static int prv_dbg_format_record(char* buf, int size, const dbg_record_t* rec){
+  static const char* level_str[] = {DBG_MSG_ERROR, DBG_MSG_WARNING, DBG_MSG_DEBUG};
+  char spec[16];
+  uint8_t spec_len, n_star, is_ll;
+  uint8_t w = 0;
+  int len;
+
+  len = snprintf(buf, size, "%s[%lu] ", level_str[rec->level], (unsigned long)rec->timestamp);
+
+  const char* p = rec->format;
+  while(*p != 0){
+    //copy literal text
+    const char* lit = p;
+    while(*p != 0 && *p != '%') p++;
+    if(p > lit){
+      if(len < size) snprintf(buf + len, size - len, "%.*s", (int)(p - lit), lit);
+      len += p - lit;
+    }
+    if(*p == 0) break;
+
+    char conv = prv_dbg_parse_spec(p, &spec_len, &n_star, &is_ll);
+    if(conv == 0) break;
+    if(conv == '%'){
+      if(len < size - 1) buf[len] = '%';
+      len++;
+      p += spec_len;
+      continue;
+    }
+    if(spec_len >= sizeof(spec)){
+      p += spec_len;
+      continue;
+    }
+    memcpy(spec, p, spec_len);
+    spec[spec_len] = 0;
+    p += spec_len;
+
+    char* out = (len < size) ? buf + len : NULL;
+    int out_size = (len < size) ? size - len : 0;
+    uint8_t is_wide = strchr("fFeEgGaA", conv) != NULL || (is_ll && strchr("diuxXo", conv) != NULL);
+    uint8_t needed = n_star + (is_wide ? 2 : 1);
+    if(w + needed > rec->n_words){
+      //argument did not fit into record
+      len += snprintf(out, out_size, "?");
+      continue;
+    }
+
+    int star[2] = {0, 0};
+    for(uint8_t i = 0; i < n_star && i < 2; i++){
+      star[i] = (int)rec->args[w++];
+    }
+
+    if(strchr("fFeEgGaA", conv) != NULL){
+      double d;
+      memcpy(&d, &rec->args[w], sizeof(d));
+      w += 2;
+      if(n_star == 2) len += snprintf(out, out_size, spec, star[0], star[1], d);
+      else if(n_star == 1) len += snprintf(out, out_size, spec, star[0], d);
+      else len += snprintf(out, out_size, spec, d);
+    }
+    else if(is_wide){
+      uint64_t v;
+      memcpy(&v, &rec->args[w], sizeof(v));
+      w += 2;
+      if(n_star == 2) len += snprintf(out, out_size, spec, star[0], star[1], v);
+      else if(n_star == 1) len += snprintf(out, out_size, spec, star[0], v);
+      else len += snprintf(out, out_size, spec, v);
+    }
+    else if(conv == 's' || conv == 'p'){
+      void* ptr = (void*)(uintptr_t)rec->args[w++];
+      if(conv == 's' && ptr == NULL) ptr = "(null)";
+      if(n_star == 2) len += snprintf(out, out_size, spec, star[0], star[1], ptr);
+      else if(n_star == 1) len += snprintf(out, out_size, spec, star[0], ptr);
+      else len += snprintf(out, out_size, spec, ptr);
+    }
+    else{
+      unsigned int v = rec->args[w++];
+      if(n_star == 2) len += snprintf(out, out_size, spec, star[0], star[1], v);
+      else if(n_star == 1) len += snprintf(out, out_size, spec, star[0], v);
+      else len += snprintf(out, out_size, spec, v);
+    }
+  }
+  return len;
+}
+
+/**
+ * @brief formats pending records and starts DMA transfer. Call from main loop in idle time.
+ * Returns immediately if UART is still busy or there is nothing to send.
+ */
+void dbg_handler(void){
+  if(HAL_UART_GetState(DEBUG_UART_HANDLE) != HAL_UART_STATE_READY) return;
+
+  int len = 0;
+  uint32_t dropped = g_dbg_dropped_count;
+  if(dropped != prv_dbg_dropped_reported){
+    len = snprintf(prv_dbg_buffer, sizeof(prv_dbg_buffer), DBG_MSG_WARNING "%lu dbg messages dropped\r\n",
+                   (unsigned long)(dropped - prv_dbg_dropped_reported));
+    prv_dbg_dropped_reported = dropped;
+  }
+
+  //pack as many records as fit into one DMA transfer
+  while(prv_dbg_tail != prv_dbg_head){
+    dbg_record_t* rec = &prv_dbg_ring[prv_dbg_tail & (DEBUG_RING_SIZE - 1)];
+    if(!__atomic_load_n(&rec->ready, __ATOMIC_ACQUIRE)) break;  //reserved but still being written
+
+    int rec_len = prv_dbg_format_record(prv_dbg_buffer + len, sizeof(prv_dbg_buffer) - len, rec);
+    if(len + rec_len >= (int)sizeof(prv_dbg_buffer)){
+      if(len > 0) break;  //send what we have, this one goes next time
+      len = sizeof(prv_dbg_buffer) - 1;  //single message longer than buffer, send truncated
+    }
+    else{
+      len += rec_len;
+    }
+    rec->ready = 0;
+    __atomic_store_n(&prv_dbg_tail, prv_dbg_tail + 1, __ATOMIC_RELEASE);
+  }
+
+  if(len > 0){
+    HAL_UART_Transmit_DMA(DEBUG_UART_HANDLE, (uint8_t *)prv_dbg_buffer, len);
+  }
+}
+
+/**
+ * @brief sends out all pending records in blocking mode
+ */
+void dbg_flush(void){
+  while(1){
+    while(HAL_UART_GetState(DEBUG_UART_HANDLE) != HAL_UART_STATE_READY);
+    if(prv_dbg_tail == prv_dbg_head && g_dbg_dropped_count == prv_dbg_dropped_reported) break;
+    uint32_t tail_before = prv_dbg_tail;
+    dbg_handler();
+    //record reserved but never finished (interrupted producer that won't return). give up
+    if(prv_dbg_tail == tail_before && HAL_UART_GetState(DEBUG_UART_HANDLE) == HAL_UART_STATE_READY) break;
+  }
 }
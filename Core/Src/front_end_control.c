@@ -109,6 +109,11 @@ const fec_channel_param_t fec_ch_params[FEC_NUM_CHANNELS] = {
 
 uint8_t prv_fec_shunt_state[FEC_NUM_CHANNELS];
 
+//staged force voltage (precomputed before exec time, applied with fec_apply_staged_force_voltage)
+static uint8_t prv_fec_staged_channel = 0;
+static uint32_t prv_fec_staged_pwm = 0;
+static uint8_t prv_fec_staged_valid = 0;
+
 
 
 /********* function implementation *********/
@@ -457,6 +462,49 @@ void fec_set_force_voltage(uint8_t channel, float voltage){
 
 
 
+/**
+ * @brief precomputes PWM value for force voltage, but doesn't set it yet.
+ * Apply with fec_apply_staged_force_voltage() at exact time (only a register write).
+ * @param channel Channel. 0 for all channels
+ * @param voltage voltage in V
+ * @return 0 if OK, -1 if voltage out of range (nothing will be applied)
+ */
+int8_t fec_stage_force_voltage(uint8_t channel, float voltage){
+  //DUT cell has negative terminal offset, compensate for this
+  voltage += FEC_CELL_NEG_OFFSET;
+
+  //invalid channel number check
+  assert_param(channel <= FEC_NUM_CHANNELS);
+  //voltage request check
+  if(voltage > FEC_MCU_VOLTAGE || voltage < -FEC_CELL_NEG_OFFSET){
+    //voltage request out of range
+    dbg(Error, "FEC: force voltage request out of range\n");
+    prv_fec_staged_valid = 0;
+    return -1;
+  }
+  prv_fec_staged_channel = channel;
+  prv_fec_staged_pwm = prv_get_pwm_value(voltage);
+  prv_fec_staged_valid = 1;
+  return 0;
+}
+
+/**
+ * @brief sets staged force voltage. Safe to call from interrupt.
+ */
+void fec_apply_staged_force_voltage(void){
+  if(!prv_fec_staged_valid){
+    return;
+  }
+  prv_fec_staged_valid = 0;
+  for(uint8_t i = 0; i < FEC_NUM_CHANNELS; i++){
+    if(prv_fec_staged_channel == 0 || prv_fec_staged_channel == i + 1){
+      __HAL_TIM_SET_COMPARE(prv_get_pwm_timer_handle(fec_ch_params[i].pwm_timer),
+                            fec_ch_params[i].pwm_tim_channel,
+                            prv_fec_staged_pwm);
+    }
+  }
+}
+
 /**
  * @brief returns the timer handle for the given timer.
  * This is needed because timer handles are not considered constant at compile time
@@ -22,6 +22,18 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim){
   }
 }
 
+//timer output compare callback
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim){
+  //usec timer compare (exact time function call)
+  if(htim->Instance == TIM2 && htim->Channel == USEC_COMPARE_ACTIVE_CHANNEL){
+    prv_usec_compare_callback();
+  }
+  //LED pulse edge (timer driven flash)
+  else if(htim->Instance == TIM2 && htim->Channel == LEDCTRL_PULSE_ACTIVE_CHANNEL){
+    prv_ledctrl_pulse_callback();
+  }
+}
+
 //adc conversion complete callback
 void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc){
   if(hadc->Instance == DAQ_VOLT_ADC){
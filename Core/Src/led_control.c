@@ -2,6 +2,7 @@
 // Created by Matej Planinšek on 19/07/2023.
 //
 #include "led_control.h"
+#include "led_wave.h"
 
 // coefficient to set current for requested illumination. Can be set by user through CLI as illlum - current point
 float prv_ledctrl_illum_to_curr_coeff = 1.0f;
@@ -15,6 +16,37 @@ float prv_ledctrl_LowHigh_threshold = 0.01f;
 
 //currently set current
 float prv_ledctrl_current_now_notempcomp = 0.0f;
+//currently set illumination, 0 if LED is set by current (temperature compensation uses the one that is set)
+static float prv_ledctrl_illum_now = 0.0f;
+
+//staged setting (precomputed before exec time, applied with ledctrl_apply_staged)
+static uint32_t prv_ledctrl_staged_raw = 0;
+static float prv_ledctrl_staged_current = 0.0f;
+static float prv_ledctrl_staged_illum = 0.0f;
+
+//illumination to DAC lookup table (see led_control.h)
+static uint16_t prv_ledctrl_lut[LEDCTRL_LUT_NUM_TEMP][LEDCTRL_LUT_NUM_ILLUM];
+static float prv_ledctrl_lut_illum_max = 1.0f;
+static float prv_ledctrl_lut_inv_illum_max = 1.0f;
+static uint32_t prv_ledctrl_lut_raw_max = LEDCTRL_DAC_MAX_RAW;   //DAC value at LED_CURRENT_MAX
+//temperature point index << 16 | fraction (LEDCTRL_LUT_FRAC_BITS), one word so interrupts read a consistent pair
+static volatile uint32_t prv_ledctrl_lut_temp_pos = 0;
+
+static void prv_ledctrl_lut_build(void);
+static void prv_ledctrl_lut_set_temp(float temp);
+
+//intra-pulse droop model (see led_control.h), off by default
+static float prv_ledctrl_droop_per_sun = 0.0f;
+static float prv_ledctrl_droop_tau_us = LEDCTRL_DROOP_DEF_TAU_US;
+
+//timer driven pulse
+static ledctrl_pulse_edge_t prv_ledctrl_pulse_edges[LEDCTRL_PULSE_MAX_EDGES];
+static uint8_t prv_ledctrl_pulse_num = 0;
+static volatile uint8_t prv_ledctrl_pulse_idx = 0;    //edge that is armed
+static volatile uint8_t prv_ledctrl_pulse_active = 0;
+static uint8_t prv_ledctrl_pulse_staged = 0;
+static volatile uint32_t prv_ledctrl_pulse_t0 = 0;
+static volatile uint8_t prv_ledctrl_pulse_late = 0;   //edges that were armed too late and forced
 
 
 /**
@@ -27,6 +59,31 @@ void ledctrl_init(void){
   HAL_DAC_Start(LEDCTRL_DAC_HANDLE, LEDCTRL_DAC_CH);
   //DAC is now outputing 0V
 
+  //pulse compare channel: no pin output, only OC2REF for TRGO. Kept low until a pulse is armed
+  TIM_OC_InitTypeDef sConfigOC = {0};
+  sConfigOC.OCMode = TIM_OCMODE_FORCED_INACTIVE;
+  sConfigOC.Pulse = 0;
+  sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+  sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+  HAL_TIM_OC_ConfigChannel(LEDCTRL_PULSE_TIM_HANDLE, &sConfigOC, LEDCTRL_PULSE_CHANNEL);
+  __HAL_TIM_DISABLE_IT(LEDCTRL_PULSE_TIM_HANDLE, LEDCTRL_PULSE_IT);
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_OC2REF;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  HAL_TIMEx_MasterConfigSynchronization(LEDCTRL_PULSE_TIM_HANDLE, &sMasterConfig);
+
+  prv_ledctrl_lut_build();
+  prv_ledctrl_lut_set_temp(ledctrl_get_temperature());
+}
+
+/**
+ * @brief selects what loads DAC output register: DAC_TRIGGER_NONE (write) or LEDCTRL pulse timer
+ */
+static void prv_ledctrl_set_dac_trigger(uint32_t trigger){
+  //trigger is changed with channel disabled. Output is pulled down meanwhile (LED off for a moment)
+  __HAL_DAC_DISABLE(LEDCTRL_DAC_HANDLE, LEDCTRL_DAC_CH);
+  MODIFY_REG((LEDCTRL_DAC_HANDLE)->Instance->CR, DAC_CR_TSEL1 | DAC_CR_TEN1, trigger);
+  __HAL_DAC_ENABLE(LEDCTRL_DAC_HANDLE, LEDCTRL_DAC_CH);
 }
 
 /**
@@ -75,6 +132,97 @@ uint32_t ledctrl_get_raw_from_current(float current){
 }
 
 
+/**
+ * @brief DAC code (not rounded) for current, not clamped to max current or DAC range. No special case for 0, no printing.
+ */
+static float prv_ledctrl_code_from_current(float current){
+  if(current < 0.0f){
+    current = 0.0f;
+  }
+  return (((current * LEDCTRL_CURRENT_GAIN) + LEDCTRL_ZERO_CURRENT_CTRL) / LEDCTRL_PULLDOWN_FACTOR / LEDCTRL_VREF) * LEDCTRL_DAC_MAX_RAW;
+}
+
+/**
+ * @brief current multiplier that gives the same illumination at temp as at LED_REF_TEMP
+ */
+static float prv_ledctrl_temp_factor(float temp){
+  return 1.0f + ((temp - LED_REF_TEMP) * (-LED_PER_DEG_TEMP_COEFF));
+}
+
+/**
+ * @brief Builds illumination to DAC table from calibration, for all temperature points. Takes a few ms.
+ */
+static void prv_ledctrl_lut_build(void){
+  //illumination at max current, LUT does not need to go beyond (polynomial is close to linear)
+  prv_ledctrl_lut_illum_max = (prv_ledctrl_illum_to_curr_coeff > 0.0f) ?
+                              LEDCTRL_LUT_ILLUM_MARGIN * LED_CURRENT_MAX / prv_ledctrl_illum_to_curr_coeff : 1.0f;
+  prv_ledctrl_lut_inv_illum_max = 1.0f / prv_ledctrl_lut_illum_max;
+  for(uint32_t t = 0; t < LEDCTRL_LUT_NUM_TEMP; t++){
+    float factor = prv_ledctrl_temp_factor(LEDCTRL_LUT_TEMP_MIN + t * LEDCTRL_LUT_TEMP_STEP);
+    for(uint32_t i = 0; i < LEDCTRL_LUT_NUM_ILLUM; i++){
+      float u = (float)i / (LEDCTRL_LUT_NUM_ILLUM - 1);
+      float curr = ledctrl_illumination_to_current(u * u * prv_ledctrl_lut_illum_max) * factor;
+      float entry = prv_ledctrl_code_from_current(curr) * (1 << LEDCTRL_LUT_CODE_FRAC_BITS);
+      prv_ledctrl_lut[t][i] = (entry < 0xFFFF) ? (uint16_t)entry : 0xFFFF;
+    }
+  }
+  prv_ledctrl_lut_raw_max = ledctrl_get_raw_from_current(LED_CURRENT_MAX);
+}
+
+/**
+ * @brief selects temperature points and weight used by ledctrl_get_raw_from_illum(). Clamped to table range.
+ */
+static void prv_ledctrl_lut_set_temp(float temp){
+  float pos = (temp - LEDCTRL_LUT_TEMP_MIN) / LEDCTRL_LUT_TEMP_STEP;
+  if(pos < 0.0f){
+    pos = 0.0f;
+  }
+  uint32_t idx = (uint32_t)pos;
+  uint32_t frac = (uint32_t)((pos - (float)idx) * (1 << LEDCTRL_LUT_FRAC_BITS));
+  if(idx >= LEDCTRL_LUT_NUM_TEMP - 1){
+    idx = LEDCTRL_LUT_NUM_TEMP - 2;
+    frac = 1 << LEDCTRL_LUT_FRAC_BITS;
+  }
+  prv_ledctrl_lut_temp_pos = (idx << 16) | frac;
+}
+
+static inline uint32_t prv_ledctrl_lerp(uint32_t a, uint32_t b, uint32_t frac){
+  return (a * ((1U << LEDCTRL_LUT_FRAC_BITS) - frac) + b * frac) >> LEDCTRL_LUT_FRAC_BITS;
+}
+
+/**
+ * @brief DAC value for illumination at current LED temperature, from lookup table (integer interpolation).
+ * Same as ledctrl_get_raw_from_current(ledctrl_compensate_current_for_temp(ledctrl_illumination_to_current(illum)))
+ * within a DAC step, but with constant runtime and no printing. Safe to call from interrupt.
+ * @param illum illumination in suns, 0 or less turns LED off
+ * @return raw DAC value
+ */
+uint32_t ledctrl_get_raw_from_illum(float illum){
+  //0 means 100% off, not LEDCTRL_ZERO_CURRENT_CTRL
+  if(!(illum > 0.0f)){
+    return 0;
+  }
+  uint32_t temp_pos = prv_ledctrl_lut_temp_pos;
+  uint32_t t_idx = temp_pos >> 16;
+  uint32_t t_frac = temp_pos & 0xFFFF;
+  uint32_t idx = LEDCTRL_LUT_NUM_ILLUM - 2;
+  uint32_t frac = 1 << LEDCTRL_LUT_FRAC_BITS;
+  if(illum < prv_ledctrl_lut_illum_max){
+    //quadratic grid
+    uint32_t pos = (uint32_t)(sqrtf(illum * prv_ledctrl_lut_inv_illum_max) * (float)((LEDCTRL_LUT_NUM_ILLUM - 1) << LEDCTRL_LUT_FRAC_BITS));
+    idx = pos >> LEDCTRL_LUT_FRAC_BITS;
+    frac = pos & ((1 << LEDCTRL_LUT_FRAC_BITS) - 1);
+    if(idx >= LEDCTRL_LUT_NUM_ILLUM - 1){
+      idx = LEDCTRL_LUT_NUM_ILLUM - 2;
+      frac = 1 << LEDCTRL_LUT_FRAC_BITS;
+    }
+  }
+  uint32_t lo = prv_ledctrl_lerp(prv_ledctrl_lut[t_idx][idx], prv_ledctrl_lut[t_idx + 1][idx], t_frac);
+  uint32_t hi = prv_ledctrl_lerp(prv_ledctrl_lut[t_idx][idx + 1], prv_ledctrl_lut[t_idx + 1][idx + 1], t_frac);
+  uint32_t raw = prv_ledctrl_lerp(lo, hi, frac) >> LEDCTRL_LUT_CODE_FRAC_BITS;
+  return (raw > prv_ledctrl_lut_raw_max) ? prv_ledctrl_lut_raw_max : raw;
+}
+
 /**
  * @brief Set LED current. This function will calculate raw DAC value and set it. Compensated for LED temperature.
  * Sets LED current, but is compensated for temperature, so that same current value produces same illumination at different temperatures.
@@ -83,6 +231,7 @@ uint32_t ledctrl_get_raw_from_current(float current){
  */
 void ledctrl_set_current_tempcomp(float current){
 //  mainser_printf("SETLEDCURR:%f\r\n", current);
+  prv_ledctrl_illum_now = 0;
   //no need to calculate if 0 requested. Set to 0, not LEDCTRL_ZERO_CURRENT_CTRL to get 100% turn off
   if(current == 0){
     ledctrl_set_dac_raw(0);
@@ -97,22 +246,243 @@ void ledctrl_set_current_tempcomp(float current){
   ledctrl_set_dac_raw(dac_raw_val);
 }
 
+/**
+ * @brief Precompute DAC value for LED current (temperature compensated), but don't set it yet.
+ * Apply with ledctrl_apply_staged() at exact time (only a register write).
+ * @param current current in A
+ */
+void ledctrl_stage_current(float current){
+  prv_ledctrl_staged_current = current;
+  prv_ledctrl_staged_illum = 0;
+  //0 means 100% off, not LEDCTRL_ZERO_CURRENT_CTRL
+  if(current == 0){
+    prv_ledctrl_staged_raw = 0;
+    return;
+  }
+  prv_ledctrl_staged_raw = ledctrl_get_raw_from_current(ledctrl_compensate_current_for_temp(current));
+}
+
+/**
+ * @brief Precompute DAC value for LED illumination. Apply with ledctrl_apply_staged()
+ * @param illum illumination in suns
+ */
+void ledctrl_stage_illum(float illum){
+  prv_ledctrl_staged_current = 0;
+  prv_ledctrl_staged_illum = illum;
+  prv_ledctrl_staged_raw = ledctrl_get_raw_from_illum(illum);
+}
+
+/**
+ * @brief Set staged LED current. Safe to call from interrupt.
+ */
+void ledctrl_apply_staged(void){
+  ledctrl_set_dac_raw(prv_ledctrl_staged_raw);
+  prv_ledctrl_current_now_notempcomp = prv_ledctrl_staged_current;
+  prv_ledctrl_illum_now = prv_ledctrl_staged_illum;
+}
+
+static void prv_ledctrl_pulse_oc_mode(uint32_t mode){
+  //channel 2 mode bits are 8 bits above channel 1
+  MODIFY_REG((LEDCTRL_PULSE_TIM_HANDLE)->Instance->CCMR1, TIM_CCMR1_OC2M, mode << 8U);
+}
+
+/**
+ * @brief prepares DAC, DAQ and compare for edge prv_ledctrl_pulse_idx. Interrupts must be disabled (or in interrupt).
+ * @return 0 if armed, -1 if edge time already passed (edge was forced immediately)
+ */
+static int8_t prv_ledctrl_pulse_arm(void){
+  const ledctrl_pulse_edge_t *edge = &prv_ledctrl_pulse_edges[prv_ledctrl_pulse_idx];
+  uint32_t t_edge = prv_ledctrl_pulse_t0 + edge->offset_us;
+  //DAC holds this until the edge
+  ledctrl_set_dac_raw(edge->dac_raw);
+  if(edge->adc_start){
+    daq_start_sampling_on_trigger();
+  }
+  //OC2REF low, goes high on match. Compare is moved to the past before mode is set, so a set flag
+  //means the match happened with mode already active (edge was made)
+  prv_ledctrl_pulse_oc_mode(TIM_OCMODE_FORCED_INACTIVE);
+  __HAL_TIM_SET_COMPARE(LEDCTRL_PULSE_TIM_HANDLE, LEDCTRL_PULSE_CHANNEL, __HAL_TIM_GET_COUNTER(LEDCTRL_PULSE_TIM_HANDLE) - 1);
+  prv_ledctrl_pulse_oc_mode(TIM_OCMODE_ACTIVE);
+  __HAL_TIM_CLEAR_FLAG(LEDCTRL_PULSE_TIM_HANDLE, LEDCTRL_PULSE_FLAG);
+  __HAL_TIM_SET_COMPARE(LEDCTRL_PULSE_TIM_HANDLE, LEDCTRL_PULSE_CHANNEL, t_edge);
+  //match is on exact counter value. If counter is already past it, make the edge now
+  if((int32_t)(__HAL_TIM_GET_COUNTER(LEDCTRL_PULSE_TIM_HANDLE) - t_edge) >= 0 &&
+     !__HAL_TIM_GET_FLAG(LEDCTRL_PULSE_TIM_HANDLE, LEDCTRL_PULSE_FLAG)){
+    prv_ledctrl_pulse_oc_mode(TIM_OCMODE_FORCED_ACTIVE);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief edge prv_ledctrl_pulse_idx happened: arms the next one or ends the pulse
+ */
+static void prv_ledctrl_pulse_next(void){
+  while(1){
+    if(prv_ledctrl_pulse_edges[prv_ledctrl_pulse_idx].adc_start){
+      daq_release_trigger();
+    }
+    prv_ledctrl_pulse_idx++;
+    if(prv_ledctrl_pulse_idx >= prv_ledctrl_pulse_num){
+      __HAL_TIM_DISABLE_IT(LEDCTRL_PULSE_TIM_HANDLE, LEDCTRL_PULSE_IT);
+      prv_ledctrl_pulse_oc_mode(TIM_OCMODE_FORCED_INACTIVE);
+      prv_ledctrl_pulse_active = 0;
+      return;
+    }
+    if(prv_ledctrl_pulse_arm() == 0){
+      return;
+    }
+    prv_ledctrl_pulse_late++;
+  }
+}
+
+/**
+ * @brief Prepares a timer driven LED pulse. DAC is switched to timer trigger until ledctrl_pulse_finish().
+ * Edges closer than LEDCTRL_PULSE_MIN_GAP_US are moved later. Call daq_prepare_for_sampling() before if an edge starts sampling.
+ * @param edges in time order, first offset is 0. DAC values are precomputed (ledctrl_get_raw_from_current)
+ */
+void ledctrl_pulse_stage(const ledctrl_pulse_edge_t *edges, uint8_t num_edges){
+  if(num_edges > LEDCTRL_PULSE_MAX_EDGES){
+    dbg(Error, "LED pulse: too many edges\n");
+    num_edges = LEDCTRL_PULSE_MAX_EDGES;
+  }
+  for(uint8_t i = 0; i < num_edges; i++){
+    prv_ledctrl_pulse_edges[i] = edges[i];
+    if(i > 0 && prv_ledctrl_pulse_edges[i].offset_us < prv_ledctrl_pulse_edges[i - 1].offset_us + LEDCTRL_PULSE_MIN_GAP_US){
+      prv_ledctrl_pulse_edges[i].offset_us = prv_ledctrl_pulse_edges[i - 1].offset_us + LEDCTRL_PULSE_MIN_GAP_US;
+      dbg(Warning, "LED pulse: edges closer than %u us, moved\n", LEDCTRL_PULSE_MIN_GAP_US);
+    }
+  }
+  //pulse needs DAC trigger, waveform writes DAC directly
+  if(ledwave_is_playing()){
+    dbg(Warning, "LED pulse: waveform stopped\n");
+    ledwave_stop();
+  }
+  prv_ledctrl_pulse_num = num_edges;
+  prv_ledctrl_pulse_late = 0;
+  //pulse ends with LED off, no temperature compensation
+  prv_ledctrl_current_now_notempcomp = 0;
+  prv_ledctrl_illum_now = 0;
+  prv_ledctrl_set_dac_trigger(DAC_TRIGGER_T2_TRGO);
+  prv_ledctrl_pulse_staged = (num_edges > 0);
+}
+
+/**
+ * @brief Starts staged pulse, first edge is LEDCTRL_PULSE_LEAD_US from now. Safe to call from interrupt.
+ */
+void ledctrl_pulse_start(void){
+  ledctrl_pulse_start_at(usec_get_timestamp() + LEDCTRL_PULSE_LEAD_US);
+}
+
+/**
+ * @brief Starts staged pulse with first edge at given usec timestamp (32bit). Must be at least
+ * LEDCTRL_PULSE_LEAD_US in future, otherwise edges are late. Safe to call from interrupt.
+ */
+void ledctrl_pulse_start_at(uint32_t t0){
+  if(!prv_ledctrl_pulse_staged){
+    return;
+  }
+  prv_ledctrl_pulse_staged = 0;
+  __disable_irq();
+  prv_ledctrl_pulse_active = 1;
+  prv_ledctrl_pulse_idx = 0;
+  prv_ledctrl_pulse_t0 = t0;
+  __HAL_TIM_ENABLE_IT(LEDCTRL_PULSE_TIM_HANDLE, LEDCTRL_PULSE_IT);
+  if(prv_ledctrl_pulse_arm() != 0){
+    prv_ledctrl_pulse_late++;
+    prv_ledctrl_pulse_next();
+  }
+  __enable_irq();
+}
+
+/**
+ * @brief returns 1 when last edge of pulse happened (or no pulse is running)
+ */
+uint8_t ledctrl_pulse_is_done(void){
+  return !prv_ledctrl_pulse_active;
+}
+
+/**
+ * @brief returns usec timestamp (32bit) of first edge of last pulse
+ */
+uint32_t ledctrl_pulse_get_start(void){
+  return prv_ledctrl_pulse_t0;
+}
+
+/**
+ * @brief Waits for pulse to end and switches DAC back to direct writes. Reports edges that were late.
+ */
+void ledctrl_pulse_finish(void){
+  while(prv_ledctrl_pulse_active);
+  prv_ledctrl_pulse_staged = 0;
+  prv_ledctrl_set_dac_trigger(DAC_TRIGGER_NONE);
+  if(prv_ledctrl_pulse_late){
+    dbg(Warning, "LED pulse: %u edges late\n", prv_ledctrl_pulse_late);
+  }
+}
+
+/**
+ * @brief Makes last edge of running pulse (LED off) right now, edges before it that did not happen yet are skipped.
+ * Ends pulse early (adaptive flash). Finish with ledctrl_pulse_finish() as usual.
+ * @return usec timestamp (32bit) of the last edge
+ */
+uint32_t ledctrl_pulse_end_now(void){
+  __disable_irq();
+  if(!prv_ledctrl_pulse_active){
+    __enable_irq();
+    return usec_get_timestamp();
+  }
+  prv_ledctrl_pulse_idx = prv_ledctrl_pulse_num - 1;
+  prv_ledctrl_pulse_edges[prv_ledctrl_pulse_idx].offset_us = usec_get_timestamp() - prv_ledctrl_pulse_t0;
+  uint32_t t_end = prv_ledctrl_pulse_t0 + prv_ledctrl_pulse_edges[prv_ledctrl_pulse_idx].offset_us;
+  //edge is now, so it is usually forced. That is intended, not late
+  if(prv_ledctrl_pulse_arm() != 0){
+    prv_ledctrl_pulse_next();
+  }
+  __enable_irq();
+  return t_end;
+}
+
+/**
+ * @brief call this from output compare callback (pulse channel)
+ */
+void prv_ledctrl_pulse_callback(void){
+  if(prv_ledctrl_pulse_active){
+    prv_ledctrl_pulse_next();
+  }
+}
+
 /**
  * @brief Set LED illumination.
  * Do not use if timing is critical.
  * @param current current in A
  */
 void ledctrl_set_illum(float illum){
+  ledctrl_print_illum(illum, usec_get_timestamp_64());
+  ledctrl_set_illum_noprint(illum);
+}
+
+/**
+ * @brief Set LED illumination without reporting to main serial.
+ * Safe to call from interrupt (used for exact-time scheduled cmds).
+ * @param illum illumination in suns
+ */
+void ledctrl_set_illum_noprint(float illum){
+  //LUT is temperature compensated, handler redoes it when temperature changes
+  ledctrl_set_dac_raw(ledctrl_get_raw_from_illum(illum));
+  prv_ledctrl_current_now_notempcomp = 0;
+  prv_ledctrl_illum_now = (illum > 0.0f) ? illum : 0.0f;
+}
+
+/**
+ * @brief report illumination setting to main serial
+ * @param illum illumination in suns
+ * @param timestamp time when illumination was set
+ */
+void ledctrl_print_illum(float illum, uint64_t timestamp){
   mainser_printf("SETLEDILLUM:\r\n");
-  prv_meas_print_timestamp(usec_get_timestamp_64());
+  prv_meas_print_timestamp(timestamp);
   mainser_printf("ILLUM:%f\r\n", illum);
-  if(illum == 0){
-    ledctrl_set_dac_raw(0);
-    prv_ledctrl_current_now_notempcomp = 0;
-    return;
-  }
-  // temperature compensation is done in ledctrl_set_current_tempcomp
-  ledctrl_set_current_tempcomp(ledctrl_illumination_to_current(illum));
 }
 
 /**
@@ -157,9 +527,7 @@ float ledctrl_get_temperature(void){
 }
 
 float ledctrl_compensate_current_for_temp(float current){
-  float ledtemp = ledctrl_get_temperature();
-  float tempdiff = ledtemp - LED_REF_TEMP;
-  return current * (1.0f + (tempdiff * (-LED_PER_DEG_TEMP_COEFF)));
+  return current * prv_ledctrl_temp_factor(ledctrl_get_temperature());
 }
 
 
@@ -192,6 +560,7 @@ void ledctrl_calibrate_illum_curr(float illum, float current, float a, float b,
   prv_ledctrl_nonlin_poly_bL = b;
   prv_ledctrl_nonlin_poly_cL = c;
   prv_ledctrl_LowHigh_threshold = illum/100;
+  prv_ledctrl_lut_build();
   mainser_printf("[A] per [sun]: %f, Non-linearity correction polynomial: %.2ex^2 +%.2ex +%.2e\r\n", prv_ledctrl_illum_to_curr_coeff,a,b,c);
   dbg(Warning, "prv_ledctrl_illum_to_curr_coeff set to: %f, Non-linearity correction polynomial: %.2ex^2 +%.2ex +%.2e\r\n", prv_ledctrl_illum_to_curr_coeff,a,b,c);
 }
@@ -206,15 +575,70 @@ void ledctrl_calibrate_illum_curr_low(float a, float b, float c){
   prv_ledctrl_nonlin_poly_aL = a;
   prv_ledctrl_nonlin_poly_bL = b;
   prv_ledctrl_nonlin_poly_cL = c;
+  prv_ledctrl_lut_build();
   mainser_printf("[A] per [sun]: %f, Non-linearity Low Light corr. poly.: %.2ex^2 +%.2ex +%.2e\r\n", prv_ledctrl_illum_to_curr_coeff,a,b,c);
   dbg(Warning, "prv_ledctrl_illum_to_curr_coeff set to: %f, Non-linearity Low Light corr. poly.: %.2ex^2 +%.2ex +%.2e\r\n", prv_ledctrl_illum_to_curr_coeff,a,b,c);
 }
 
 /**
- * @brief If LED is on, compensates the LED current for temperature. If LED is off, does nothing.
+ * @brief Sets intra-pulse droop model, used by pre-emphasized flashes (ledwave_add_flash()).
+ * @param droop_per_sun settled relative light drop per sun, 0 disables pre-emphasis
+ * @param tau_us thermal time constant of LED junction
+ */
+void ledctrl_set_droop_model(float droop_per_sun, float tau_us){
+  if(droop_per_sun < 0.0f || !(tau_us > 0.0f)){
+    dbg(Error, "LEDCTRL: invalid droop model\n");
+    return;
+  }
+  prv_ledctrl_droop_per_sun = droop_per_sun;
+  prv_ledctrl_droop_tau_us = tau_us;
+}
+
+float ledctrl_get_droop_per_sun(void){
+  return prv_ledctrl_droop_per_sun;
+}
+
+float ledctrl_get_droop_tau_us(void){
+  return prv_ledctrl_droop_tau_us;
+}
+
+/**
+ * @brief illumination to set t_us after LED on so that light output is illum, limited to LEDCTRL_DROOP_MAX_GAIN x illum
+ */
+float ledctrl_droop_precomp(float illum, float t_us){
+  if(!(illum > 0.0f) || prv_ledctrl_droop_per_sun == 0.0f){
+    return illum;
+  }
+  float rel = 1.0f - prv_ledctrl_droop_per_sun * illum * (1.0f - expf(-t_us / prv_ledctrl_droop_tau_us));
+  if(rel < 1.0f / LEDCTRL_DROOP_MAX_GAIN){
+    rel = 1.0f / LEDCTRL_DROOP_MAX_GAIN;
+  }
+  return illum / rel;
+}
+
+/**
+ * @brief Prints droop model to main serial
+ */
+void ledctrl_print_droop_model(void){
+  mainser_printf("LEDDROOP:\r\n");
+  mainser_printf("DROOP[1/sun]:%f\r\n", prv_ledctrl_droop_per_sun);
+  mainser_printf("TAU[us]:%f\r\n", prv_ledctrl_droop_tau_us);
+}
+
+/**
+ * @brief Updates LUT temperature. If LED is on, compensates the LED current for temperature. If LED is off, does nothing.
  * Call periodically.
  * Compensates only if LED is set by ledctrl_set_current_tempcomp or ledctrl_set_illum
  */
 void ledctrl_handler(void){
+  prv_ledctrl_lut_set_temp(ledctrl_get_temperature());
+  //DAC belongs to pulse or waveform until it is finished
+  if(prv_ledctrl_pulse_active || prv_ledctrl_pulse_staged || ledwave_is_playing()){
+    return;
+  }
+  if(prv_ledctrl_illum_now > 0.0f){
+    ledctrl_set_dac_raw(ledctrl_get_raw_from_illum(prv_ledctrl_illum_now));
+    return;
+  }
   ledctrl_set_current_tempcomp(prv_ledctrl_current_now_notempcomp);
 }
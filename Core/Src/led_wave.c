@@ -0,0 +1,272 @@
+//
+// led_wave.c
+//
+// See led_wave.h for how the waveform is played.
+
+#include "led_wave.h"
+#include <math.h>
+#include "led_control.h"
+#include "main_serial.h"
+#include "debug.h"
+
+static uint16_t prv_ledwave_table[LEDWAVE_MAX_POINTS];
+static uint32_t prv_ledwave_num = 0;
+static float prv_ledwave_end_illum = 0;   //illumination of last point
+static uint8_t prv_ledwave_playing = 0;
+static uint8_t prv_ledwave_loop = 0;
+static volatile uint64_t prv_ledwave_start_timestamp = 0;
+
+
+/**
+ * @brief number of points for segment, 0 if it does not fit the table or waveform is playing
+ */
+static uint32_t prv_ledwave_segment_points(uint32_t dur_us){
+  uint32_t n = dur_us / LEDWAVE_POINT_TIME_US;
+  if(prv_ledwave_playing){
+    dbg(Error, "LEDWAVE: can't change waveform while playing\n");
+    return 0;
+  }
+  if(n == 0 || prv_ledwave_num + n > LEDWAVE_MAX_POINTS){
+    dbg(Error, "LEDWAVE: segment does not fit\n");
+    return 0;
+  }
+  return n;
+}
+
+/**
+ * @brief removes all segments
+ */
+void ledwave_clear(void){
+  if(prv_ledwave_playing){
+    dbg(Error, "LEDWAVE: can't change waveform while playing\n");
+    return;
+  }
+  prv_ledwave_num = 0;
+  prv_ledwave_end_illum = 0;
+}
+
+/**
+ * @brief appends constant illumination
+ * @return 0 on success, -1 if it does not fit (nothing added)
+ */
+int8_t ledwave_add_step(float illum, uint32_t dur_us){
+  uint32_t n = prv_ledwave_segment_points(dur_us);
+  if(n == 0){
+    return -1;
+  }
+  uint16_t raw = ledctrl_get_raw_from_illum(illum);
+  for(uint32_t k = 0; k < n; k++){
+    prv_ledwave_table[prv_ledwave_num++] = raw;
+  }
+  prv_ledwave_end_illum = illum;
+  return 0;
+}
+
+/**
+ * @brief appends flash of illum, pre-emphasized for LED droop (ledctrl_droop_precomp(), t from segment start at the
+ * middle of each point) so light output stays flat. Same as ledwave_add_step() with droop model off.
+ * Model is evaluated every LEDWAVE_FLASH_KNOT_POINTS points, DAC codes in between are interpolated (fast enough to stage).
+ * @return 0 on success, -1 if it does not fit (nothing added)
+ */
+int8_t ledwave_add_flash(float illum, uint32_t dur_us){
+  uint32_t n = prv_ledwave_segment_points(dur_us);
+  if(n == 0){
+    return -1;
+  }
+  int32_t prev = (int32_t)ledctrl_get_raw_from_illum(ledctrl_droop_precomp(illum, 0.5f * LEDWAVE_POINT_TIME_US));
+  for(uint32_t k0 = 0; k0 < n; k0 += LEDWAVE_FLASH_KNOT_POINTS){
+    float t_next_us = ((float)(k0 + LEDWAVE_FLASH_KNOT_POINTS) + 0.5f) * (float)LEDWAVE_POINT_TIME_US;
+    int32_t next = (int32_t)ledctrl_get_raw_from_illum(ledctrl_droop_precomp(illum, t_next_us));
+    for(uint32_t k = k0; k < k0 + LEDWAVE_FLASH_KNOT_POINTS && k < n; k++){
+      prv_ledwave_table[prv_ledwave_num++] = (uint16_t)(prev + (next - prev) * (int32_t)(k - k0) / LEDWAVE_FLASH_KNOT_POINTS);
+    }
+    prev = next;
+  }
+  prv_ledwave_end_illum = illum;
+  return 0;
+}
+
+/**
+ * @brief appends linear ramp from illumination at the end of table (0 if empty) to illum
+ * @return 0 on success, -1 if it does not fit (nothing added)
+ */
+int8_t ledwave_add_ramp(float illum, uint32_t dur_us){
+  uint32_t n = prv_ledwave_segment_points(dur_us);
+  if(n == 0){
+    return -1;
+  }
+  float start = prv_ledwave_end_illum;
+  for(uint32_t k = 1; k <= n; k++){
+    prv_ledwave_table[prv_ledwave_num++] = ledctrl_get_raw_from_illum(start + (illum - start) * (float)k / (float)n);
+  }
+  prv_ledwave_end_illum = illum;
+  return 0;
+}
+
+/**
+ * @brief appends sine offset + amplitude * sin(2 pi f t), t from 0 at segment start. Negative values are 0
+ * @return 0 on success, -1 if it does not fit (nothing added)
+ */
+int8_t ledwave_add_sine(float offset, float amplitude, float freq_hz, uint32_t dur_us){
+  uint32_t n = prv_ledwave_segment_points(dur_us);
+  if(n == 0){
+    return -1;
+  }
+  float illum = offset;
+  for(uint32_t k = 0; k < n; k++){
+    float t = (float)(k * LEDWAVE_POINT_TIME_US) * 1e-6f;
+    illum = offset + amplitude * sinf(2.0f * (float)M_PI * freq_hz * t);
+    prv_ledwave_table[prv_ledwave_num++] = ledctrl_get_raw_from_illum(illum);
+  }
+  prv_ledwave_end_illum = (illum > 0.0f) ? illum : 0.0f;
+  return 0;
+}
+
+/**
+ * @brief appends exactly num_cycles periods of offset + amplitude * sin in num_points points, so a looped
+ * table has no phase step. Point n is at phase 2 pi num_cycles n / num_points. Negative values are 0
+ * @return 0 on success, -1 if it does not fit (nothing added)
+ */
+int8_t ledwave_add_sine_cycles(float offset, float amplitude, uint32_t num_points, uint32_t num_cycles){
+  uint32_t n = prv_ledwave_segment_points(num_points * LEDWAVE_POINT_TIME_US);
+  if(n == 0){
+    return -1;
+  }
+  float illum = offset;
+  for(uint32_t k = 0; k < n; k++){
+    //integer phase index keeps the table exact over many cycles
+    illum = offset + amplitude * sinf(2.0f * (float)M_PI * (float)((k * num_cycles) % n) / (float)n);
+    prv_ledwave_table[prv_ledwave_num++] = ledctrl_get_raw_from_illum(illum);
+  }
+  prv_ledwave_end_illum = (illum > 0.0f) ? illum : 0.0f;
+  return 0;
+}
+
+/**
+ * @brief appends PWM train: illum_high for duty percent of each period, illum_low for the rest
+ * @return 0 on success, -1 if it does not fit (nothing added)
+ */
+int8_t ledwave_add_pwm(float illum_high, float illum_low, uint32_t period_us, float duty, uint32_t dur_us){
+  if(period_us < LEDWAVE_POINT_TIME_US){
+    dbg(Error, "LEDWAVE: PWM period shorter than point time\n");
+    return -1;
+  }
+  uint32_t n = prv_ledwave_segment_points(dur_us);
+  if(n == 0){
+    return -1;
+  }
+  uint16_t raw_high = ledctrl_get_raw_from_illum(illum_high);
+  uint16_t raw_low = ledctrl_get_raw_from_illum(illum_low);
+  uint32_t on_us = (uint32_t)((float)period_us * duty / 100.0f);
+  uint8_t high = 0;
+  for(uint32_t k = 0; k < n; k++){
+    high = ((k * LEDWAVE_POINT_TIME_US) % period_us) < on_us;
+    prv_ledwave_table[prv_ledwave_num++] = high ? raw_high : raw_low;
+  }
+  prv_ledwave_end_illum = high ? illum_high : illum_low;
+  return 0;
+}
+
+uint32_t ledwave_get_num_points(void){
+  return prv_ledwave_num;
+}
+
+/**
+ * @brief index of the point written on the next sample timer update (while playing)
+ */
+uint32_t ledwave_get_next_point(void){
+  if(prv_ledwave_num == 0){
+    return 0;
+  }
+  //DMA counts down remaining transfers, reloaded to prv_ledwave_num in circular mode
+  return (prv_ledwave_num - __HAL_DMA_GET_COUNTER(LEDWAVE_DMA_HANDLE)) % prv_ledwave_num;
+}
+
+/**
+ * @brief Prepares playback: sample timer is stopped and set just before update (as daq_prepare_for_sampling()
+ * does), DMA is started. Playback starts with the timer: ledwave_start() or daq_start_sampling().
+ * Call daq_prepare_for_sampling() before this if the waveform is sampled.
+ * @param loop 1 to repeat the table until ledwave_stop()
+ * @return 0 on success, -1 if table is empty or DAC is used by LED pulse
+ */
+int8_t ledwave_arm(uint8_t loop){
+  DMA_HandleTypeDef *hdma = LEDWAVE_DMA_HANDLE;
+  if(prv_ledwave_num == 0){
+    dbg(Error, "LEDWAVE: no waveform\n");
+    return -1;
+  }
+  if(!ledctrl_pulse_is_done()){
+    dbg(Error, "LEDWAVE: LED pulse running\n");
+    return -1;
+  }
+  if(prv_ledwave_playing){
+    ledwave_stop();
+  }
+  HAL_TIM_Base_Stop_IT(DAQ_SAMPLE_TIMER_HANDLE);
+  __HAL_TIM_SET_COUNTER(DAQ_SAMPLE_TIMER_HANDLE, DAQ_SAMPLE_TIMER_PERIOD_100KSPS - 1);
+  //DMA of last normal playback is done but not released
+  if(hdma->State != HAL_DMA_STATE_READY){
+    HAL_DMA_Abort(hdma);
+  }
+  //circular mode can only be changed while channel is disabled
+  hdma->Init.Mode = loop ? DMA_CIRCULAR : DMA_NORMAL;
+  MODIFY_REG(hdma->Instance->CCR, DMA_CCR_CIRC, loop ? DMA_CCR_CIRC : 0);
+  //DAC output follows data register writes (no trigger), first point is written on first update
+  HAL_DMA_Start(hdma, (uint32_t)prv_ledwave_table, (uint32_t)LEDWAVE_DAC_REG, prv_ledwave_num);
+  __HAL_TIM_ENABLE_DMA(DAQ_SAMPLE_TIMER_HANDLE, TIM_DMA_UPDATE);
+  prv_ledwave_loop = loop;
+  prv_ledwave_playing = 1;
+  return 0;
+}
+
+/**
+ * @brief starts sample timer, first point is set about one timer tick later. Only if not sampled
+ * (daq_start_sampling() starts the timer then). Safe to call from interrupt.
+ */
+void ledwave_start(void){
+  prv_ledwave_start_timestamp = usec_get_timestamp_64();
+  HAL_TIM_Base_Start_IT(DAQ_SAMPLE_TIMER_HANDLE);
+}
+
+uint64_t ledwave_get_start_timestamp(void){
+  return prv_ledwave_start_timestamp;
+}
+
+/**
+ * @brief 1 from ledwave_arm() until last point is played (looped: until ledwave_stop())
+ */
+uint8_t ledwave_is_playing(void){
+  return prv_ledwave_playing;
+}
+
+/**
+ * @brief stops playback, LED is set to illumination of last point. Sample timer keeps running (sampling)
+ */
+void ledwave_stop(void){
+  if(!prv_ledwave_playing){
+    return;
+  }
+  __HAL_TIM_DISABLE_DMA(DAQ_SAMPLE_TIMER_HANDLE, TIM_DMA_UPDATE);
+  HAL_DMA_Abort(LEDWAVE_DMA_HANDLE);
+  prv_ledwave_playing = 0;
+  ledctrl_set_illum_noprint(prv_ledwave_end_illum);
+}
+
+/**
+ * @brief ends playback when last point was played. Call periodically.
+ */
+void ledwave_handler(void){
+  if(prv_ledwave_playing && !prv_ledwave_loop && __HAL_DMA_GET_COUNTER(LEDWAVE_DMA_HANDLE) == 0){
+    ledwave_stop();
+  }
+}
+
+/**
+ * @brief prints waveform length and playback state to main serial
+ */
+void ledwave_print_status(void){
+  mainser_printf("WAVE_STATE:%s\r\n", prv_ledwave_playing ? (prv_ledwave_loop ? "LOOP" : "PLAYING") : "IDLE");
+  mainser_printf("WAVE_POINTS:%lu\r\n", prv_ledwave_num);
+  mainser_printf("WAVE_DURATION[us]:%lu\r\n", prv_ledwave_num * LEDWAVE_POINT_TIME_US);
+  mainser_printf("WAVE_END_ILLUM:%f\r\n", prv_ledwave_end_illum);
+}
@@ -85,6 +85,23 @@ static lwshell_t shell;
         (lwobj)->buff_ptr = 0;                                                                                         \
     } while (0)
 
+#if LWSHELL_CFG_USE_STATIC_COMMANDS
+/**
+ * \brief           FNV-1a hash of command name
+ * \param[in]       name: Zero terminated command name
+ * \return          Hash value
+ */
+static uint32_t
+prv_hash_name(const char* name) {
+    uint32_t h = 2166136261UL;
+    while (*name != '\0') {
+        h ^= (uint8_t)*name++;
+        h *= 16777619UL;
+    }
+    return h;
+}
+#endif /* LWSHELL_CFG_USE_STATIC_COMMANDS */
+
 /**
  * \brief           Parse input string
  * \param[in]       lwobj: LwSHELL instance
@@ -94,6 +111,8 @@ prv_parse_input(lwshell_t* lwobj) {
     size_t s_len;
     char* str;
 
+    lwobj->cmd_result = 0;
+
     /* Check string length and compare with buffer pointer */
     s_len = strlen(lwobj->buff);
     if (s_len != lwobj->buff_ptr) {
@@ -176,8 +195,23 @@ prv_parse_input(lwshell_t* lwobj) {
 #endif /* LWSHELL_CFG_USE_DYNAMIC_COMMANDS */
 
 #if LWSHELL_CFG_USE_STATIC_COMMANDS
-            /* Process all static commands */
-            if (c == NULL && lwobj->static_cmds != NULL && lwobj->static_cmds_cnt > 0) {
+            /* Find static command by name hash (open addressing, linear probing) */
+            if (c == NULL && lwobj->static_cmds != NULL && lwobj->static_cmds_hashed) {
+                uint32_t h = prv_hash_name(lwobj->argv[0]);
+                for (size_t n = 0; n < LWSHELL_CFG_STATIC_CMDS_HASH_SIZE; ++n) {
+                    uint8_t idx = lwobj->static_cmds_hash[h & (LWSHELL_CFG_STATIC_CMDS_HASH_SIZE - 1)];
+                    if (idx == 0) {
+                        break;
+                    }
+                    if (strcmp(lwobj->static_cmds[idx - 1].name, lwobj->argv[0]) == 0) {
+                        c = &lwobj->static_cmds[idx - 1];
+                        break;
+                    }
+                    ++h;
+                }
+            }
+            /* Process all static commands (hash index not built) */
+            if (c == NULL && lwobj->static_cmds != NULL && !lwobj->static_cmds_hashed && lwobj->static_cmds_cnt > 0) {
                 for (size_t i = 0; i < lwobj->static_cmds_cnt; ++i) {
                     if (arg_len == strlen(lwobj->static_cmds[i].name)
                         && strncmp(lwobj->static_cmds[i].name, lwobj->argv[0], arg_len) == 0) {
@@ -196,7 +230,7 @@ prv_parse_input(lwshell_t* lwobj) {
                     LWSHELL_OUTPUT(lwobj, c->desc);
                     LWSHELL_OUTPUT(lwobj, "\r\n");
                 } else {
-                    c->fn(lwobj->argc, lwobj->argv);
+                    lwobj->cmd_result = c->fn(lwobj->argc, lwobj->argv);
                 }
 #if LWSHELL_CFG_USE_LIST_CMD
             } else if (strncmp(lwobj->argv[0], "help", 7) == 0) {
@@ -220,6 +254,7 @@ prv_parse_input(lwshell_t* lwobj) {
 #endif /* LWSHELL_CFG_USE_LIST_CMD */
             } else {
                 LWSHELL_OUTPUT(lwobj, "Unknown command\r\n");
+                lwobj->cmd_result = -1;
             }
         }
     }
@@ -303,6 +338,20 @@ lwshell_register_static_cmds_ex(lwshell_t* lwobj, const lwshell_cmd_t* cmds, siz
     lwobj = LWSHELL_GET_LWOBJ(lwobj);
     lwobj->static_cmds = cmds;
     lwobj->static_cmds_cnt = cmds_len;
+
+    /* Build hash index. Keep at least one free slot so lookup of unknown name terminates */
+    memset(lwobj->static_cmds_hash, 0x00, sizeof(lwobj->static_cmds_hash));
+    lwobj->static_cmds_hashed = 0;
+    if (cmds_len < LWSHELL_CFG_STATIC_CMDS_HASH_SIZE && cmds_len < UINT8_MAX) {
+        for (size_t i = 0; i < cmds_len; ++i) {
+            uint32_t h = prv_hash_name(cmds[i].name);
+            while (lwobj->static_cmds_hash[h & (LWSHELL_CFG_STATIC_CMDS_HASH_SIZE - 1)] != 0) {
+                ++h;
+            }
+            lwobj->static_cmds_hash[h & (LWSHELL_CFG_STATIC_CMDS_HASH_SIZE - 1)] = (uint8_t)(i + 1);
+        }
+        lwobj->static_cmds_hashed = 1;
+    }
     return lwshellOK;
 }
 
@@ -30,12 +30,15 @@
 #include "front_end_control.h"
 #include "debug.h"
 #include "led_control.h"
+#include "led_wave.h"
 #include "micro_sec.h"
 #include "daq.h"
 #include "measurements.h"
 #include "main_serial.h"
 #include "lwshell/lwshell.h"
 #include "cmd_line_support.h"
+#include "seq_vm.h"
+#include "task_sched.h"
 #include "ds18b20.h"
 #include "UserGPIO.h"
 /* USER CODE END Includes */
@@ -58,7 +61,6 @@
 /* Private variables ---------------------------------------------------------*/
 
 /* USER CODE BEGIN PV */
-uint32_t temptime = 0;
 uint32_t ledtemptime = 0;
 
 /* USER CODE END PV */
@@ -66,6 +68,7 @@ uint32_t ledtemptime = 0;
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 /* USER CODE BEGIN PFP */
+static void prv_main_temperature_task(void);
 
 /* USER CODE END PFP */
 
@@ -138,6 +141,12 @@ int main(void)
 
   dbg(Warning, "CLI initialized!\r\n");
 
+  //background tasks, run from main loop between scheduled cmds
+  tasksch_register("temp", prv_main_temperature_task, 1000000, LEDCTRL_TEMP_READ_TIME_US);
+  tasksch_register("mppt", mppt, 0, MPPT_DURATION);  //mppt keeps its own period, returns immediately when off
+  tasksch_register("dbg", dbg_handler, 0, DEBUG_HANDLER_MIN_IDLE_US);
+  tasksch_register("wave", ledwave_handler, 1000, 100);  //ends one-shot LED waveform playback
+
   //turn on active LED
   //HAL_GPIO_WritePin(DBG_LED_1_GPIO_Port, DBG_LED_1_Pin, GPIO_PIN_SET);
   L1On();
@@ -208,33 +217,29 @@ int main(void)
 
     dbg(Warning, "Starting main loop!\r\n");
 
-    int64_t time_to_cmd=0, t1;
+    uint64_t time_to_cmd;
 
     while(1) {
-      if (mainser_available()) {
-        char c = mainser_read();
-        lwshell_input(&c, 1);
+      if (cmdsched_batch_is_receiving()) {
+        //binary block of scheduled cmds, bypass CLI
+        cmdsched_batch_handler();
       }
-
-      if ((HAL_GetTick()-temptime > 1000) && (time_to_cmd > LEDCTRL_TEMP_READ_TIME_US)){
-        temptime = HAL_GetTick();
-        t1 = usec_get_timestamp_64();
-        ds18b20_handler();	//Takes about 6ms
-        ledctrl_handler();	//Takes about 70us and only makes sense if temperature has just been measured
-        if(LEDCTRL_PERIODIC_TEMP_REPORT_MAINSER){
-          mainser_printf("\r\n");
-          ledctrl_print_temperature_mainser();
-        }
-        time_to_cmd -= usec_get_timestamp_64() - t1;  //There should never be any problems with over/uderflow,
-                                                      //because time_to_cmd should always be much larger
-                                                      //than the time needed for the above tasks
+      //don't start CLI cmds while scheduled cmd is staged and waiting for its exec time
+      else if (mainser_available() && !cmdsched_is_armed()) {
+        char c = mainser_read();
+        cmdsprt_input(c);
       }
 
-      if (time_to_cmd > MPPT_DURATION)
+      time_to_cmd = cmdsched_handler();
+      //on-device sequence puts its cmds in the queue, wake up for whichever comes first
+      uint64_t time_to_seq = seqvm_handler();
+      if (time_to_seq < time_to_cmd)
       {
-        mppt(); //if mppt is not (manually) switched on, it will immediately return
+        time_to_cmd = time_to_seq;
       }
-      time_to_cmd = cmdsched_handler();
+
+      //background tasks (temperature, mppt, debug output) only run if they finish before the next cmd
+      tasksch_run(time_to_cmd);
     }
 
 //    HAL_Delay(30000);
@@ -297,6 +302,17 @@ void SystemClock_Config(void)
 }
 
 /* USER CODE BEGIN 4 */
+/**
+ * @brief reads LED temperature and updates LED compensation. Takes about 6 ms.
+ */
+static void prv_main_temperature_task(void){
+  ds18b20_handler();
+  ledctrl_handler();  //Takes about 70us and only makes sense if temperature has just been measured
+  if(LEDCTRL_PERIODIC_TEMP_REPORT_MAINSER){
+    mainser_printf("\r\n");
+    ledctrl_print_temperature_mainser();
+  }
+}
 
 /* USER CODE END 4 */
 
@@ -327,7 +343,7 @@ void assert_failed(uint8_t *file, uint32_t line)
 {
   /* USER CODE BEGIN 6 */
   dbg(Error, "Assert failed!!! file %s on line %d\r\n", file, line);
-  HAL_Delay(100);
+  dbg_flush();
   //dissable all interrupts
   __disable_irq();
   while(1)
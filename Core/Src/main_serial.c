@@ -1,5 +1,6 @@
 #include "main_serial.h"
 #include "UserGPIO.h"
+#include <string.h>
 
 
 volatile uint8_t mainser_rx_buffer[RX_BUFFER_SIZE];
@@ -12,6 +13,11 @@ volatile uint32_t mainser_tx_write_index = 0;
 //buffer for formatted out mainser_printf
 char mainser_printf_buffer[MAINSER_PRINTF_BUF_LEN];
 
+//request id of the response being sent, prefixed to every line
+static uint32_t prv_mainser_resp_id = MAINSER_NO_RESP_ID;
+//last char sent ended a line
+static uint8_t prv_mainser_line_start = 1;
+
 /**
  * @brief Initialize main serial communication.
  *
@@ -132,6 +138,50 @@ uint32_t mainser_tx_space(void) {
   return diff;
 }
 
+/**
+ * @brief writes data to tx buffer, waits for space. Data longer than tx buffer is written in parts.
+ */
+static void prv_mainser_write_blocking(const char* data, uint32_t len){
+  while(len > 0){
+    uint32_t part = (len > TX_BUFFER_SIZE / 2) ? TX_BUFFER_SIZE / 2 : len;
+    // WARNING: this blocks code until there is space
+    while(mainser_write_multi((uint8_t*)data, part) == 0){
+      //wait for space
+    }
+    data += part;
+    len -= part;
+  }
+}
+
+/**
+ * @brief sends data, prefixes each line with response id if it is set. Empty lines are not prefixed.
+ */
+static void prv_mainser_put(const char* data, uint32_t len){
+  if(len == 0){
+    return;
+  }
+  if(prv_mainser_resp_id == MAINSER_NO_RESP_ID){
+    prv_mainser_write_blocking(data, len);
+    prv_mainser_line_start = (data[len - 1] == '\n');
+    return;
+  }
+  char prefix[16];
+  uint32_t prefix_len = snprintf(prefix, sizeof(prefix), "#%lu:", prv_mainser_resp_id);
+  while(len > 0){
+    //one line (including \n) or the rest of data
+    const char* nl = memchr(data, '\n', len);
+    uint32_t part = (nl != NULL) ? (uint32_t)(nl - data) + 1 : len;
+    uint8_t empty = (data[0] == '\n') || (part == 2 && data[0] == '\r');
+    if(prv_mainser_line_start && !empty){
+      prv_mainser_write_blocking(prefix, prefix_len);
+    }
+    prv_mainser_write_blocking(data, part);
+    prv_mainser_line_start = (data[part - 1] == '\n');
+    data += part;
+    len -= part;
+  }
+}
+
 /**
  * @brief Print formatted output to the main serial transmitter.
  *
@@ -156,11 +206,7 @@ void mainser_printf(const char* format, ...){
     dbg(Error, "mainser_printf: msg_len_cnt > TX_BUFFER_SIZE");
     return;
   }
-  //wait for space in tx buffer
-  // WARNING: this blocks code until there is space
-  while(mainser_write_multi( (uint8_t*)mainser_printf_buffer, msg_len_cnt) == 0){
-    //wait for space
-  }
+  prv_mainser_put(mainser_printf_buffer, msg_len_cnt);
   D1Off();
 }
 
@@ -170,19 +216,31 @@ void mainser_printf(const char* format, ...){
  * @param str string pointer
  */
 void mainser_send_string(const char* str){
-  uint32_t n = 0;
-  // send bytes up to null termination
-  while(str[n] != 0){
-    // wait for space in tx buffer
-    while(mainser_write(str[n])==0);
-    n++;
-  }
+  prv_mainser_put(str, strlen(str));
 }
 
+static uint32_t prv_mainser_baudrate = MAINSER_DEFAULT_BAUD;
+
 void mainser_set_baudrate(uint32_t baudrate){
+  prv_mainser_baudrate = baudrate;
   LL_USART_Disable(MAINSER_UART);
   LL_USART_SetBaudRate(MAINSER_UART, SystemCoreClock, LL_USART_GetPrescaler(MAINSER_UART),LL_USART_OVERSAMPLING_8, baudrate);
   LL_USART_Enable(MAINSER_UART);
   mainser_printf("SETBAUD:OK\r\n");
   dbg(Warning, "mainser_set_baudrate: baudrate set to %lu\r\n", baudrate);
 }
+
+uint32_t mainser_get_baudrate(void){
+  return prv_mainser_baudrate;
+}
+
+/**
+ * @brief sets request id that is prefixed to following lines (MAINSER_NO_RESP_ID: no prefix)
+ */
+void mainser_set_resp_id(uint32_t id){
+  prv_mainser_resp_id = id;
+}
+
+uint32_t mainser_get_resp_id(void){
+  return prv_mainser_resp_id;
+}
@@ -3,7 +3,9 @@
 //
 #include "measurements.h"
 #include "UserGPIO.h"
+#include "led_wave.h"
 #include <math.h>
+#include <string.h>
 
 /**
  * @brief measures num_samples on channel, sends data to UART
@@ -1508,6 +1510,55 @@ void prv_meas_print_data_ident_flashmeasure_dump(void){
   mainser_printf("FLASHMEAS_DUMP:\r\n");
 }
 
+/**
+ * @brief prints data identification flash measure burst (averaged dump)
+ */
+void prv_meas_print_data_ident_flashmeasure_burst(void){
+  mainser_printf("FLASHMEAS_BURST:\r\n");
+}
+
+/**
+ * @brief prints data identification flash measure equivalent-time capture
+ */
+void prv_meas_print_data_ident_flashmeasure_ets(void){
+  mainser_printf("FLASHMEAS_ETS:\r\n");
+}
+
+/**
+ * @brief prints data identification LED waveform playback
+ */
+void prv_meas_print_data_ident_wave(void){
+  mainser_printf("WAVEPLAY:\r\n");
+}
+
+/**
+ * @brief prints data identification adaptive flash measure
+ */
+void prv_meas_print_data_ident_flashmeasure_adaptive(void){
+  mainser_printf("FLASHMEAS_ADAPT:\r\n");
+}
+
+/**
+ * @brief prints data identification Suns-Voc
+ */
+void prv_meas_print_data_ident_sunsvoc(void){
+  mainser_printf("SUNSVOC:\r\n");
+}
+
+/**
+ * @brief prints data identification droop compensated flash measure dump
+ */
+void prv_meas_print_data_ident_flashmeasure_flat(void){
+  mainser_printf("FLASHMEAS_FLAT:\r\n");
+}
+
+/**
+ * @brief prints data identification LED droop calibration
+ */
+void prv_meas_print_data_ident_led_droop_cal(void){
+  mainser_printf("LEDDROOP_CAL:\r\n");
+}
+
 /**
  * @brief Measure IV characteristic of DUT. Prints results to main serial
  * @param channel channel to measure
@@ -1679,6 +1730,18 @@ void meas_iv_sample_and_dump(uint8_t channel, uint32_t num_samples){
   prv_meas_dump_from_buffer_human_readable_iv(channel, num_samples);
 }
 
+//flash measurement state between stage, trigger and finish
+static uint32_t prv_meas_flash_num_samples = 0;
+
+static void prv_meas_flash_dump_stage(float illum, uint32_t flash_dur_us, uint32_t border_us, uint32_t delay_ticks);
+
+/**
+ * @brief DAC value for flash illumination (temperature compensated)
+ */
+static uint32_t prv_meas_flash_dac_raw(float illum){
+  return ledctrl_get_raw_from_illum(illum);
+}
+
 /**
  * @brief Does a flash measurement: LED on, wait to settle, measure DUT voltage, LED off. Should take max a couple of ms
  * Warning: take care that sampling does not take longer than flash duration
@@ -1689,29 +1752,52 @@ void meas_iv_sample_and_dump(uint8_t channel, uint32_t num_samples){
  * @param numavg number of samples to take and average
  */
 void meas_flashmeasure_singlesample(uint8_t channel, float illum, uint32_t flash_dur_us, uint32_t measure_at_us, uint32_t numavg){
-  float curr_set;
-  uint32_t ton, tmeas, toff;
-  //get current for specified illumination
-  curr_set = ledctrl_illumination_to_current(illum);
-  //compensate current for temperature
-  curr_set = ledctrl_compensate_current_for_temp(curr_set);
+  meas_flashmeasure_singlesample_stage(illum, flash_dur_us, measure_at_us, numavg);
+  meas_flashmeasure_singlesample_trigger();
+  meas_flashmeasure_singlesample_finish(channel, numavg);
+}
+
+/**
+ * @brief first part of flash measurement (can be done ahead of time): calculates LED DAC value, prepares DAQ
+ * and timer driven LED pulse (LED on, sampling start and LED off are timer edges)
+ * @param illum illumination in suns
+ * @param flash_dur_us duration of flash in us
+ * @param measure_at_us time in us to measure after flash start
+ * @param numavg number of samples to take and average
+ */
+void meas_flashmeasure_singlesample_stage(float illum, uint32_t flash_dur_us, uint32_t measure_at_us, uint32_t numavg){
+  ledctrl_pulse_edge_t edges[3];
+  uint8_t n = 0;
+  uint32_t on_raw = prv_meas_flash_dac_raw(illum);
+  //LED on
+  edges[n++] = (ledctrl_pulse_edge_t){0, on_raw, measure_at_us == 0};
+  //measure while LED on
+  if(measure_at_us > 0 && measure_at_us < flash_dur_us){
+    edges[n++] = (ledctrl_pulse_edge_t){measure_at_us, on_raw, 1};
+  }
+  //LED off (measure after flash if asked so)
+  edges[n++] = (ledctrl_pulse_edge_t){flash_dur_us, 0, measure_at_us == flash_dur_us};
+  if(measure_at_us > flash_dur_us){
+    edges[n++] = (ledctrl_pulse_edge_t){measure_at_us, 0, 1};
+  }
   //prepare for sampling
   daq_prepare_for_sampling(numavg);
-  //set current. LED is now on
-  ledctrl_set_current_tempcomp(curr_set);
-  //save LED on time
-  ton = usec_get_timestamp();
-  //calculate at what time to measure and turn-off time
-  tmeas = ton + measure_at_us;
-  toff = ton + flash_dur_us;
-  //wait for measurement time
-  while(usec_get_timestamp() < tmeas);
-  //measure
-  daq_start_sampling();
-  //wait off time
-  while(usec_get_timestamp() < toff);
-  //turn off LED. LED is now off
-  ledctrl_set_current_tempcomp(0.0f);
+  ledctrl_pulse_stage(edges, n);
+}
+
+/**
+ * @brief flash start: LED pulse starts LEDCTRL_PULSE_LEAD_US later. Register writes only, safe to call from interrupt
+ */
+void meas_flashmeasure_singlesample_trigger(void){
+  ledctrl_pulse_start();
+}
+
+/**
+ * @brief rest of flash measurement after trigger: wait for LED off, report
+ */
+void meas_flashmeasure_singlesample_finish(uint8_t channel, uint32_t numavg){
+  //wait for LED off edge
+  ledctrl_pulse_finish();
 
   //check if sampling is finished
   if(!daq_is_sampling_done()){
@@ -1742,39 +1828,1047 @@ void meas_flashmeasure_singlesample(uint8_t channel, float illum, uint32_t flash
  * @param measure_at_us time in us to measure after flash start
  */
 void meas_flashmeasure_dumpbuffer(uint8_t channel, float illum, uint32_t flash_dur_us){
-  float curr_set;
-  uint32_t ton, toff, tmeas_start, num_samples;
-  //get current for specified illumination
-  curr_set = ledctrl_illumination_to_current(illum);
-  //compensate current for temperature
-  curr_set = ledctrl_compensate_current_for_temp(curr_set);
+  meas_flashmeasure_dumpbuffer_stage(illum, flash_dur_us);
+  meas_flashmeasure_dumpbuffer_trigger();
+  meas_flashmeasure_dumpbuffer_finish(channel);
+}
+
+/**
+ * @brief first part of flash dump measurement (can be done ahead of time): calculates LED DAC value, prepares DAQ
+ * and timer driven LED pulse (sampling start, LED on and LED off are timer edges)
+ * @param illum illumination in suns
+ * @param flash_dur_us duration of flash in us
+ */
+void meas_flashmeasure_dumpbuffer_stage(float illum, uint32_t flash_dur_us){
+  prv_meas_flash_dump_stage(illum, flash_dur_us, MEAS_FLASH_DUMP_SAMPLEBORDER_US, 0);
+}
+
+/**
+ * @brief start of flash dump measurement: sampling starts LEDCTRL_PULSE_LEAD_US later. Safe to call from interrupt
+ */
+void meas_flashmeasure_dumpbuffer_trigger(void){
+  ledctrl_pulse_start();
+}
+
+/**
+ * @brief rest of flash dump measurement after trigger: wait for LED off and sampling end, dump
+ */
+void meas_flashmeasure_dumpbuffer_finish(uint8_t channel){
+  //wait for LED off edge
+  ledctrl_pulse_finish();
+  //wait for sampling to finish
+  while(!daq_is_sampling_done());
+
+  //dump data
+  prv_meas_print_data_ident_flashmeasure_dump();
+  prv_meas_dump_from_buffer_human_readable_volt(channel, prv_meas_flash_num_samples);
+}
+
+
+//flash burst sum, sample-aligned to flash edges (edges are timer driven, so sample n is always at the same time).
+//With equivalent-time phases, sample n of phase p is at index n * phases + p
+static uint32_t prv_meas_flash_sum[MEAS_FLASH_BURST_BUFF_SIZE];
+static uint64_t prv_meas_flash_burst_timestamp = 0;
+static uint8_t prv_meas_flash_burst_staged = 0;
+
+//staged burst
+static struct {
+    uint8_t channel;
+    float illum;
+    uint32_t flash_dur_us;
+    uint32_t border_us;     //sampling before LED on and after LED off
+    uint32_t num_phases;    //1: normal burst
+    uint32_t num_flashes;   //per phase
+    uint32_t period_us;
+} prv_meas_flash_burst;
+
+/**
+ * @brief stages one flash dump: sampling from border_us before LED on to border_us after LED off
+ * @param delay_ticks first sample is this many sample timer ticks after sampling start edge
+ */
+static void prv_meas_flash_dump_stage(float illum, uint32_t flash_dur_us, uint32_t border_us, uint32_t delay_ticks){
+  ledctrl_pulse_edge_t edges[3] = {
+      {0, 0, 1},
+      {border_us, prv_meas_flash_dac_raw(illum), 0},
+      {border_us + flash_dur_us, 0, 0},
+  };
   //calculate number of samples
-  num_samples = (flash_dur_us+(2*MEAS_FLASH_DUMP_SAMPLEBORDER_US)) / DAQ_SAMPLE_TIME_100KSPS;
+  prv_meas_flash_num_samples = (flash_dur_us + 2 * border_us) / DAQ_SAMPLE_TIME_100KSPS;
   //prepare for sampling
+  daq_prepare_for_sampling(prv_meas_flash_num_samples);
+  daq_set_start_delay(delay_ticks);
+  ledctrl_pulse_stage(edges, 3);
+}
+
+/**
+ * @brief sample timer delay of equivalent-time phase
+ */
+static uint32_t prv_meas_flash_phase_ticks(uint32_t phase){
+  return phase * (DAQ_SAMPLE_TIMER_PERIOD_100KSPS + 1) / prv_meas_flash_burst.num_phases;
+}
+
+/**
+ * @brief adds voltage buffer of last flash to burst sum. Only channel (or all with 0) is summed
+ */
+static void prv_meas_flash_burst_accumulate(uint8_t channel, uint32_t phase){
+  uint32_t num_ch = (channel == 0) ? DAQ_NUM_CH : 1;
+  for(uint32_t n = 0; n < prv_meas_flash_num_samples; n++){
+    const volatile uint16_t *smp = &g_daq_buffer_volt[n * DAQ_NUM_CH];
+    uint32_t idx = (n * prv_meas_flash_burst.num_phases + phase) * num_ch;
+    if(channel == 0){
+      for(uint8_t ch = 0; ch < DAQ_NUM_CH; ch++){
+        prv_meas_flash_sum[idx + ch] += smp[ch];
+      }
+    }
+    else{
+      prv_meas_flash_sum[idx] += smp[channel - 1];
+    }
+  }
+}
+
+/**
+ * @brief average of summed raw values, with fractional bits in the place of DAQ_SAMPLE_BITSIHFT
+ */
+static uint16_t prv_meas_flash_burst_avg(uint32_t idx, uint32_t num_flashes){
+  return (uint16_t)((((uint64_t)prv_meas_flash_sum[idx] << DAQ_SAMPLE_BITSIHFT) + num_flashes / 2) / num_flashes);
+}
+
+/**
+ * @brief checks parameters of staged burst, clears sum and stages first flash
+ */
+static int8_t prv_meas_flash_burst_stage(void){
+  prv_meas_flash_burst_staged = 0;
+  uint8_t channel = prv_meas_flash_burst.channel;
+  uint32_t window = prv_meas_flash_burst.flash_dur_us + 2 * prv_meas_flash_burst.border_us;
+  uint32_t num_ch = (channel == 0) ? DAQ_NUM_CH : 1;
+  uint32_t phases = prv_meas_flash_burst.num_phases;
+  if(phases == 0 || phases > MEAS_FLASH_ETS_MAX_PHASES){
+    dbg(Error, "MEAS: flash burst phases out of range\r\n");
+    return -1;
+  }
+  if(channel > DAQ_NUM_CH || prv_meas_flash_burst.num_flashes == 0 ||
+     (window / DAQ_SAMPLE_TIME_100KSPS) * phases * num_ch > MEAS_FLASH_BURST_BUFF_SIZE){
+    dbg(Error, "MEAS: flash burst too long for sum buffer\r\n");
+    return -1;
+  }
+  //DAQ always samples all channels
+  if((window / DAQ_SAMPLE_TIME_100KSPS) * DAQ_NUM_CH > DAQ_BUFF_SIZE){
+    dbg(Error, "MEAS: flash burst too long for DAQ buffer\r\n");
+    return -1;
+  }
+  if(prv_meas_flash_burst.num_flashes * phases > 1 && prv_meas_flash_burst.period_us < window + MEAS_FLASH_BURST_MIN_DARK_US){
+    dbg(Error, "MEAS: flash burst period too short\r\n");
+    return -1;
+  }
+  memset(prv_meas_flash_sum, 0, sizeof(prv_meas_flash_sum));
+  prv_meas_flash_dump_stage(prv_meas_flash_burst.illum, prv_meas_flash_burst.flash_dur_us, prv_meas_flash_burst.border_us, 0);
+  prv_meas_flash_burst_staged = 1;
+  return 0;
+}
+
+/**
+ * @brief Burst of flash measurements: num_flashes flashes every period_us, voltage trace of each is summed on device
+ * and one averaged dump is returned (noise down by sqrt(num_flashes)). Timing of each flash is as for -DUMP
+ * (sampling starts MEAS_FLASH_DUMP_SAMPLEBORDER_US before LED on). Blocking for (num_flashes-1) x period_us.
+ * @param channel channel to measure, 0 for all
+ * @param illum illumination in suns
+ * @param flash_dur_us duration of flash in us
+ * @param num_flashes number of flashes
+ * @param period_us time between flash starts
+ * @return 0 if ok, -1 if parameters are not possible
+ */
+int8_t meas_flashmeasure_burst(uint8_t channel, float illum, uint32_t flash_dur_us, uint32_t num_flashes, uint32_t period_us){
+  if(meas_flashmeasure_burst_stage(channel, illum, flash_dur_us, num_flashes, period_us) != 0){
+    return -1;
+  }
+  meas_flashmeasure_dumpbuffer_trigger();
+  meas_flashmeasure_burst_finish();
+  return 0;
+}
+
+/**
+ * @brief first part of flash burst (can be done ahead of time): checks parameters, clears sum, stages first flash
+ * @return 0 if ok, -1 if parameters are not possible (nothing staged)
+ */
+int8_t meas_flashmeasure_burst_stage(uint8_t channel, float illum, uint32_t flash_dur_us, uint32_t num_flashes, uint32_t period_us){
+  prv_meas_flash_burst.channel = channel;
+  prv_meas_flash_burst.illum = illum;
+  prv_meas_flash_burst.flash_dur_us = flash_dur_us;
+  prv_meas_flash_burst.border_us = MEAS_FLASH_DUMP_SAMPLEBORDER_US;
+  prv_meas_flash_burst.num_phases = 1;
+  prv_meas_flash_burst.num_flashes = num_flashes;
+  prv_meas_flash_burst.period_us = period_us;
+  return prv_meas_flash_burst_stage();
+}
+
+/**
+ * @brief Equivalent-time (stroboscopic) flash capture: num_phases x num_flashes flashes every period_us. Sampling of
+ * flash k is delayed by a fraction k/num_phases of sample time (sample timer start value), traces are interleaved
+ * into one waveform with sample time DAQ_SAMPLE_TIME_100KSPS / num_phases. Each phase is averaged over num_flashes.
+ * Sampling is MEAS_FLASH_ETS_BORDER_US before LED on and after LED off.
+ * @param channel channel to measure, 0 for all
+ * @param illum illumination in suns
+ * @param flash_dur_us duration of flash in us
+ * @param num_phases sampling phases per sample time
+ * @param num_flashes flashes per phase
+ * @param period_us time between flash starts
+ * @return 0 if ok, -1 if parameters are not possible
+ */
+int8_t meas_flashmeasure_ets(uint8_t channel, float illum, uint32_t flash_dur_us, uint32_t num_phases, uint32_t num_flashes, uint32_t period_us){
+  if(meas_flashmeasure_ets_stage(channel, illum, flash_dur_us, num_phases, num_flashes, period_us) != 0){
+    return -1;
+  }
+  meas_flashmeasure_dumpbuffer_trigger();
+  meas_flashmeasure_burst_finish();
+  return 0;
+}
+
+/**
+ * @brief first part of equivalent-time capture (can be done ahead of time). Finish with meas_flashmeasure_burst_finish()
+ * @return 0 if ok, -1 if parameters are not possible (nothing staged)
+ */
+int8_t meas_flashmeasure_ets_stage(uint8_t channel, float illum, uint32_t flash_dur_us, uint32_t num_phases, uint32_t num_flashes, uint32_t period_us){
+  prv_meas_flash_burst.channel = channel;
+  prv_meas_flash_burst.illum = illum;
+  prv_meas_flash_burst.flash_dur_us = flash_dur_us;
+  prv_meas_flash_burst.border_us = MEAS_FLASH_ETS_BORDER_US;
+  prv_meas_flash_burst.num_phases = num_phases;
+  prv_meas_flash_burst.num_flashes = num_flashes;
+  prv_meas_flash_burst.period_us = period_us;
+  return prv_meas_flash_burst_stage();
+}
+
+/**
+ * @brief rest of flash burst after first flash trigger: remaining flashes, averaged dump
+ */
+void meas_flashmeasure_burst_finish(void){
+  //stage failed (reported there)
+  if(!prv_meas_flash_burst_staged){
+    return;
+  }
+  prv_meas_flash_burst_staged = 0;
+  uint8_t channel = prv_meas_flash_burst.channel;
+  uint32_t phases = prv_meas_flash_burst.num_phases;
+  uint32_t num_flashes = prv_meas_flash_burst.num_flashes;
+  uint32_t total = phases * num_flashes;
+  uint32_t t0 = ledctrl_pulse_get_start();
+  uint32_t late = 0;
+  //phases in turn, so slow drifts are spread over all of them
+  for(uint32_t k = 0; k < total; k++){
+    uint32_t phase = k % phases;
+    if(k > 0){
+      //flash k starts exactly k periods after the first one
+      uint32_t tk = t0 + k * prv_meas_flash_burst.period_us;
+      prv_meas_flash_dump_stage(prv_meas_flash_burst.illum, prv_meas_flash_burst.flash_dur_us, prv_meas_flash_burst.border_us,
+                                prv_meas_flash_phase_ticks(phase));
+      if((int32_t)(tk - usec_get_timestamp()) < LEDCTRL_PULSE_LEAD_US){
+        late++;
+      }
+      ledctrl_pulse_start_at(tk);
+    }
+    ledctrl_pulse_finish();
+    while(!daq_is_sampling_done());
+    if(k == 0){
+      prv_meas_flash_burst_timestamp = daq_get_sampling_start_timestamp();
+    }
+    prv_meas_flash_burst_accumulate(channel, phase);
+  }
+  if(late){
+    dbg(Warning, "MEAS: %lu burst flashes late\r\n", late);
+  }
+
+  //averaged dump, same format as flash dump
+  if(phases > 1){
+    prv_meas_print_data_ident_flashmeasure_ets();
+    mainser_printf("PHASES:%lu\r\n", phases);
+  }
+  else{
+    prv_meas_print_data_ident_flashmeasure_burst();
+  }
+  mainser_printf("FLASHES:%lu\r\n", num_flashes);
+  prv_meas_print_data_ident_dump_text_volt();
+  prv_meas_print_timestamp(prv_meas_flash_burst_timestamp);
+  mainser_printf("TS[us]:%f\r\n", (float)DAQ_SAMPLE_TIME_100KSPS / (float)phases);
+  prv_meas_print_ch_ident(channel,0);
+  uint32_t idx = 0;
+  for(uint32_t n = 0; n < prv_meas_flash_num_samples * phases; n++){
+    t_daq_sample_raw avg = {0};
+    if(channel == 0){
+      avg.ch1 = prv_meas_flash_burst_avg(idx++, num_flashes);
+      avg.ch2 = prv_meas_flash_burst_avg(idx++, num_flashes);
+      avg.ch3 = prv_meas_flash_burst_avg(idx++, num_flashes);
+      avg.ch4 = prv_meas_flash_burst_avg(idx++, num_flashes);
+      avg.ch5 = prv_meas_flash_burst_avg(idx++, num_flashes);
+      avg.ch6 = prv_meas_flash_burst_avg(idx++, num_flashes);
+    }
+    else{
+      uint16_t v = prv_meas_flash_burst_avg(idx++, num_flashes);
+      avg.ch1 = avg.ch2 = avg.ch3 = avg.ch4 = avg.ch5 = avg.ch6 = v;
+    }
+    mainser_printf("[%lu]", n);
+    prv_meas_print_sample(daq_raw_to_volt(avg), channel);
+  }
+  prv_meas_print_dump_end();
+}
+
+
+/**
+ * @brief average of raw samples [first, first + num) of buffer (g_daq_buffer_volt or g_daq_buffer_curr)
+ */
+static t_daq_sample_raw prv_meas_raw_window_avg(const volatile uint16_t *buff, uint32_t first, uint32_t num){
+  uint32_t sum[DAQ_NUM_CH] = {0};
+  for(uint32_t n = first; n < first + num; n++){
+    for(uint8_t ch = 0; ch < DAQ_NUM_CH; ch++){
+      sum[ch] += buff[n * DAQ_NUM_CH + ch];
+    }
+  }
+  t_daq_sample_raw avg;
+  avg.ch1 = (sum[0] << DAQ_SAMPLE_BITSIHFT) / num;
+  avg.ch2 = (sum[1] << DAQ_SAMPLE_BITSIHFT) / num;
+  avg.ch3 = (sum[2] << DAQ_SAMPLE_BITSIHFT) / num;
+  avg.ch4 = (sum[3] << DAQ_SAMPLE_BITSIHFT) / num;
+  avg.ch5 = (sum[4] << DAQ_SAMPLE_BITSIHFT) / num;
+  avg.ch6 = (sum[5] << DAQ_SAMPLE_BITSIHFT) / num;
+  avg.timestamp = 0;
+  return avg;
+}
+
+/**
+ * @brief average of voltage samples [first, first + num), can be used while sampling is running
+ */
+static t_daq_sample_convd prv_meas_volt_window_avg(uint32_t first, uint32_t num){
+  return daq_raw_to_volt(prv_meas_raw_window_avg(g_daq_buffer_volt, first, num));
+}
+
+/**
+ * @brief average of current samples [first, first + num), can be used while sampling is running
+ */
+static t_daq_sample_convd prv_meas_curr_window_avg(uint32_t first, uint32_t num){
+  return daq_raw_to_curr(prv_meas_raw_window_avg(g_daq_buffer_curr, first, num));
+}
+
+/**
+ * @brief 1 if all measured channels (channel, or all with 0) changed less than tol_v between windows
+ */
+static uint8_t prv_meas_flash_adapt_settled(t_daq_sample_convd prev, t_daq_sample_convd now, uint8_t channel, float tol_v){
+  for(uint8_t ch = 1; ch <= DAQ_NUM_CH; ch++){
+    if(channel != 0 && ch != channel){
+      continue;
+    }
+    if(fabsf(daq_get_from_sample_convd_by_index(now, ch) - daq_get_from_sample_convd_by_index(prev, ch)) >= tol_v){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Adaptive flash measurement: LED is switched on and Voc is watched while sampling. When averages of two
+ * consecutive windows (MEAS_FLASH_ADAPT_WINDOW_SAMPLES each) differ less than tol_v on all measured channels,
+ * LED is switched off right away, so the cell gets only the light it needs to settle. If Voc does not settle,
+ * flash ends after max_dur_us. Reports settled Voc (last window), time to settle and dose (illum x LED on time).
+ * @param channel channel to watch and report, 0 for all
+ * @param illum illumination in suns
+ * @param max_dur_us longest flash
+ * @param tol_v settling tolerance in V
+ * @return 0 if ok, -1 if max_dur_us is not possible
+ */
+int8_t meas_flashmeasure_adaptive(uint8_t channel, float illum, uint32_t max_dur_us, float tol_v){
+  if(meas_flashmeasure_adaptive_stage(illum, max_dur_us) != 0){
+    return -1;
+  }
+  meas_flashmeasure_singlesample_trigger();
+  meas_flashmeasure_adaptive_finish(channel, illum, tol_v);
+  return 0;
+}
+
+/**
+ * @brief first part of adaptive flash (can be done ahead of time): LED on and sampling start on the same edge,
+ * LED off at max_dur_us unless ended earlier. Trigger with meas_flashmeasure_singlesample_trigger()
+ * @return 0 if ok, -1 if max_dur_us does not fit DAQ buffer (nothing staged)
+ */
+int8_t meas_flashmeasure_adaptive_stage(float illum, uint32_t max_dur_us){
+  uint32_t num_samples = max_dur_us / DAQ_SAMPLE_TIME_100KSPS;
+  if(num_samples < 2 * MEAS_FLASH_ADAPT_WINDOW_SAMPLES || num_samples * DAQ_NUM_CH > DAQ_BUFF_SIZE){
+    dbg(Error, "MEAS: adaptive flash duration out of range\r\n");
+    prv_meas_flash_num_samples = 0;
+    return -1;
+  }
+  ledctrl_pulse_edge_t edges[2] = {
+      {0, prv_meas_flash_dac_raw(illum), 1},
+      {max_dur_us, 0, 0},
+  };
+  prv_meas_flash_num_samples = num_samples;
   daq_prepare_for_sampling(num_samples);
-  //start sampling
+  ledctrl_pulse_stage(edges, 2);
+  return 0;
+}
+
+/**
+ * @brief rest of adaptive flash after trigger: watches Voc, ends flash when settled, reports
+ */
+void meas_flashmeasure_adaptive_finish(uint8_t channel, float illum, float tol_v){
+  //stage failed (reported there)
+  if(prv_meas_flash_num_samples == 0){
+    return;
+  }
+  t_daq_sample_convd prev = {0};
+  t_daq_sample_convd now = {0};
+  uint32_t next = 0;    //first sample of next window
+  uint32_t last = 0;    //first sample of window in now
+  uint8_t settled = 0;
+  uint32_t t_off = 0;
+
+  //windows are checked as soon as DMA has filled them. LED off edge at max_dur_us ends the loop otherwise
+  while(!ledctrl_pulse_is_done()){
+    if(daq_get_num_samples_taken() < next + MEAS_FLASH_ADAPT_WINDOW_SAMPLES){
+      continue;
+    }
+    now = prv_meas_volt_window_avg(next, MEAS_FLASH_ADAPT_WINDOW_SAMPLES);
+    last = next;
+    if(next > 0 && prv_meas_flash_adapt_settled(prev, now, channel, tol_v)){
+      t_off = ledctrl_pulse_end_now();
+      settled = 1;
+      break;
+    }
+    prev = now;
+    next += MEAS_FLASH_ADAPT_WINDOW_SAMPLES;
+  }
+  ledctrl_pulse_finish();
+  if(!settled){
+    t_off = ledctrl_pulse_get_start() + prv_meas_flash_num_samples * DAQ_SAMPLE_TIME_100KSPS;
+  }
+  //samples after LED off are not needed
+  daq_stop_sampling();
+  uint32_t on_us = t_off - ledctrl_pulse_get_start();
+  //last complete window is the result (not settled: next window may have filled after the loop ended)
+  if(!settled && next + MEAS_FLASH_ADAPT_WINDOW_SAMPLES <= daq_get_num_samples_taken()){
+    now = prv_meas_volt_window_avg(next, MEAS_FLASH_ADAPT_WINDOW_SAMPLES);
+    last = next;
+  }
+  now.timestamp = daq_get_sampling_start_timestamp() + (last + MEAS_FLASH_ADAPT_WINDOW_SAMPLES / 2) * DAQ_SAMPLE_TIME_100KSPS;
+  prv_meas_flash_num_samples = 0;
+
+  meas_check_out_of_rng_volt(now, channel);
+  prv_meas_print_data_ident_flashmeasure_adaptive();
+  prv_meas_print_ch_ident(channel,0);
+  prv_meas_print_timestamp(now.timestamp);
+  prv_meas_print_sample(now, channel);
+  mainser_printf("SETTLED:%u\r\n", settled);
+  mainser_printf("SETTLE_TIME[us]:%lu\r\n", on_us);
+  mainser_printf("DOSE[sun*us]:%f\r\n", illum * (float)on_us);
+}
+
+
+static uint8_t prv_meas_wave_staged = 0;
+
+/**
+ * @brief Plays LED waveform (see led_wave.h). With dump, voltage is sampled for one pass of the table
+ * (sample n is taken on the timer update that sets point n) and dumped.
+ * @param channel channel to dump, 0 for all
+ * @param loop 1 to repeat waveform until wavestop
+ * @param dump 1 to sample and dump
+ * @return 0 if ok, -1 if there is no waveform or LED is busy
+ */
+int8_t meas_wave_play(uint8_t channel, uint8_t loop, uint8_t dump){
+  if(meas_wave_play_stage(loop, dump) != 0){
+    return -1;
+  }
+  meas_wave_play_trigger(dump);
+  meas_wave_play_finish(channel, loop, dump);
+  return 0;
+}
+
+/**
+ * @brief first part of waveform playback (can be done ahead of time): prepares DAQ and waveform DMA
+ * @return 0 if ok, -1 if there is no waveform or LED is busy (nothing staged)
+ */
+int8_t meas_wave_play_stage(uint8_t loop, uint8_t dump){
+  prv_meas_wave_staged = 0;
+  if(dump){
+    daq_prepare_for_sampling(ledwave_get_num_points());
+  }
+  if(ledwave_arm(loop) != 0){
+    return -1;
+  }
+  prv_meas_wave_staged = 1;
+  return 0;
+}
+
+/**
+ * @brief starts sample timer, waveform (and sampling) starts with it. Safe to call from interrupt
+ */
+void meas_wave_play_trigger(uint8_t dump){
+  if(!prv_meas_wave_staged){
+    return;
+  }
+  if(dump){
+    daq_start_sampling();
+  }
+  else{
+    ledwave_start();
+  }
+}
+
+/**
+ * @brief rest of waveform playback after trigger: report start, or wait for pass and dump
+ */
+void meas_wave_play_finish(uint8_t channel, uint8_t loop, uint8_t dump){
+  //stage failed (reported there)
+  if(!prv_meas_wave_staged){
+    return;
+  }
+  prv_meas_wave_staged = 0;
+  prv_meas_print_data_ident_wave();
+  mainser_printf("POINTS:%lu\r\n", ledwave_get_num_points());
+  mainser_printf("LOOP:%u\r\n", loop);
+  if(!dump){
+    prv_meas_print_timestamp(ledwave_get_start_timestamp());
+    return;
+  }
+  while(!daq_is_sampling_done());
+  prv_meas_dump_from_buffer_human_readable_volt(channel, ledwave_get_num_points());
+}
+
+
+/**
+ * @brief sample time divider, table length and number of periods in table for lock-in at freq.
+ * Table holds whole periods (as many as fit), so the actual frequency is num_cycles / (num_points x sample time).
+ * @return actual frequency in Hz
+ */
+static float prv_meas_lockin_plan(float freq, uint32_t *div, uint32_t *num_points, uint32_t *num_cycles){
+  float fs = 1000000.0f / DAQ_SAMPLE_TIME_100KSPS;
+  //slowest sample rate that still fits one period in the table
+  uint32_t d = (uint32_t)ceilf(fs / (freq * LEDWAVE_MAX_POINTS));
+  if(d < 1){
+    d = 1;
+  }
+  if(d > DAQ_SAMPLE_DIV_MAX){
+    d = DAQ_SAMPLE_DIV_MAX;
+  }
+  float pts_per_period = fs / ((float)d * freq);
+  uint32_t k = (uint32_t)((float)LEDWAVE_MAX_POINTS / pts_per_period);
+  if(k < 1){
+    k = 1;
+  }
+  uint32_t n = (uint32_t)lroundf((float)k * pts_per_period);
+  if(n > LEDWAVE_MAX_POINTS){
+    n = LEDWAVE_MAX_POINTS;
+  }
+  *div = d;
+  *num_points = n;
+  *num_cycles = k;
+  return (float)k * fs / ((float)d * (float)n);
+}
+
+/**
+ * @brief waits for a sample timer update and reads, in the same sample period after ADC scan is done,
+ * index of next waveform point and number of samples taken. Update interrupt must be disabled.
+ */
+static void prv_meas_lockin_snapshot(uint32_t *next_point, uint32_t *taken){
+  uint8_t late;
+  do{
+    __HAL_TIM_CLEAR_FLAG(DAQ_SAMPLE_TIMER_HANDLE, TIM_FLAG_UPDATE);
+    while(!__HAL_TIM_GET_FLAG(DAQ_SAMPLE_TIMER_HANDLE, TIM_FLAG_UPDATE));
+    __HAL_TIM_CLEAR_FLAG(DAQ_SAMPLE_TIMER_HANDLE, TIM_FLAG_UPDATE);
+    __disable_irq();
+    while(__HAL_TIM_GET_COUNTER(DAQ_SAMPLE_TIMER_HANDLE) < MEAS_LOCKIN_SNAPSHOT_TICKS);
+    *next_point = ledwave_get_next_point();
+    *taken = daq_get_num_samples_taken();
+    //interrupted past next update, counters may not belong together
+    late = __HAL_TIM_GET_FLAG(DAQ_SAMPLE_TIMER_HANDLE, TIM_FLAG_UPDATE);
+    __enable_irq();
+  }while(late);
+}
+
+/**
+ * @brief conversion gain (units per raw LSB) of each channel, from the raw to volt/curr conversion
+ */
+static void prv_meas_lockin_gain(uint8_t curr, float *gain){
+  t_daq_sample_raw raw_zero = {0};
+  t_daq_sample_raw raw_full = {DAQ_MAX_ADC_VAL, DAQ_MAX_ADC_VAL, DAQ_MAX_ADC_VAL, DAQ_MAX_ADC_VAL, DAQ_MAX_ADC_VAL, DAQ_MAX_ADC_VAL, 0};
+  t_daq_sample_convd zero = curr ? daq_raw_to_curr(raw_zero) : daq_raw_to_volt(raw_zero);
+  t_daq_sample_convd full = curr ? daq_raw_to_curr(raw_full) : daq_raw_to_volt(raw_full);
+  for(uint8_t ch = 1; ch <= DAQ_NUM_CH; ch++){
+    gain[ch-1] = (daq_get_from_sample_convd_by_index(full, ch) - daq_get_from_sample_convd_by_index(zero, ch)) / DAQ_MAX_ADC_VAL;
+  }
+}
+
+/**
+ * @brief single bin DFT (lock-in) at bin num_cycles of the captured buffer, all channels:
+ * X = sum (x[n] - mean) exp(-j w n), w = 2 pi num_cycles / num_points.
+ * Reference phase is taken from the integer index (no accumulated error), mean is removed first so float sums stay small.
+ */
+static void prv_meas_lockin_demod(const volatile uint16_t *buff, uint32_t num_points, uint32_t num_cycles, float *re, float *im){
+  float mean[DAQ_NUM_CH] = {0};
+  for(uint32_t n = 0; n < num_points; n++){
+    for(uint8_t c = 0; c < DAQ_NUM_CH; c++){
+      mean[c] += (float)(buff[n * DAQ_NUM_CH + c] << DAQ_SAMPLE_BITSIHFT);
+    }
+  }
+  for(uint8_t c = 0; c < DAQ_NUM_CH; c++){
+    mean[c] /= (float)num_points;
+    re[c] = 0;
+    im[c] = 0;
+  }
+  for(uint32_t n = 0; n < num_points; n++){
+    float arg = 2.0f * (float)M_PI * (float)((n * num_cycles) % num_points) / (float)num_points;
+    float cosa = cosf(arg);
+    float sina = sinf(arg);
+    for(uint8_t c = 0; c < DAQ_NUM_CH; c++){
+      float x = (float)(buff[n * DAQ_NUM_CH + c] << DAQ_SAMPLE_BITSIHFT) - mean[c];
+      re[c] += x * cosa;
+      im[c] -= x * sina;
+    }
+  }
+}
+
+/**
+ * @brief waits time of num_periods periods at freq
+ */
+static void prv_meas_lockin_wait_periods(float freq, uint32_t num_periods){
+  uint64_t wait_us = (uint64_t)((float)num_periods * 1000000.0f / freq);
+  if(wait_us >= 1000){
+    HAL_Delay((uint32_t)(wait_us / 1000));
+  }
+  usec_delay((uint32_t)(wait_us % 1000));
+}
+
+/**
+ * @brief one frequency of lock-in sweep: LED plays bias + amp sin (looped), response is captured over the whole
+ * table and demodulated at modulation frequency. Transfer function relative to LED illumination (V/sun or uA/sun).
+ * Phase is corrected for the sample-and-hold of the DAC and for ADC channel scan delay.
+ * @return actual frequency, 0 if LED waveform could not be started
+ */
+static float prv_meas_lockin_point(float freq, uint8_t curr, float bias, float amp, uint32_t settle_periods,
+                                   uint32_t num_avg, float *mag, float *phase){
+  uint32_t div, num_points, num_cycles;
+  float f_act = prv_meas_lockin_plan(freq, &div, &num_points, &num_cycles);
+  float gain[DAQ_NUM_CH];
+  float sum_re[DAQ_NUM_CH] = {0};
+  float sum_im[DAQ_NUM_CH] = {0};
+  float re[DAQ_NUM_CH], im[DAQ_NUM_CH];
+
+  ledwave_stop();
+  daq_set_sample_divider(div);
+  ledwave_clear();
+  if(ledwave_add_sine_cycles(bias, amp, num_points, num_cycles) != 0 || ledwave_arm(1) != 0){
+    return 0;
+  }
+  ledwave_start();
+  prv_meas_lockin_gain(curr, gain);
+
+  float w = 2.0f * (float)M_PI * (float)num_cycles / (float)num_points;
+  //DAC holds each point for a sample time: fundamental is delayed by half a point and attenuated by sinc
+  float amp_eff = amp * sinf(w / 2.0f) / (w / 2.0f);
+  for(uint32_t a = 0; a < num_avg; a++){
+    prv_meas_lockin_wait_periods(f_act, (a == 0) ? settle_periods : 0);
+    daq_start_sampling_running(num_points);
+    uint32_t next_point, taken;
+    prv_meas_lockin_snapshot(&next_point, &taken);
+    while(!daq_is_sampling_done());
+    //sample 0 was taken on the update that wrote point i0
+    uint32_t i0 = (next_point + num_points - (taken % num_points)) % num_points;
+    prv_meas_lockin_demod(curr ? g_daq_buffer_curr : g_daq_buffer_volt, num_points, num_cycles, re, im);
+    for(uint8_t c = 0; c < DAQ_NUM_CH; c++){
+      //response phase = phase of X + pi/2 (sine reference) - phase of drive at sample 0, channel c is converted
+      //c+0.5 conversion times after the update
+      float t_c = ((float)c + 0.5f) * MEAS_LOCKIN_CH_CONV_TIME_US / (float)daq_get_sample_time_us();
+      float rot = (float)M_PI / 2.0f - w * (float)i0 + w / 2.0f - w * t_c;
+      float scale = 2.0f * gain[c] / ((float)num_points * amp_eff);
+      sum_re[c] += scale * (re[c] * cosf(rot) - im[c] * sinf(rot));
+      sum_im[c] += scale * (re[c] * sinf(rot) + im[c] * cosf(rot));
+    }
+  }
+  for(uint8_t c = 0; c < DAQ_NUM_CH; c++){
+    mag[c] = sqrtf(sum_re[c] * sum_re[c] + sum_im[c] * sum_im[c]) / (float)num_avg;
+    phase[c] = atan2f(sum_im[c], sum_re[c]) * 180.0f / (float)M_PI;
+  }
+  return f_act;
+}
+
+/**
+ * @brief Lock-in frequency sweep (IMVS with voltage, IMPS with current). LED is modulated with a small sine
+ * on top of bias (looped LED waveform, see led_wave.h), response is demodulated on the device at the modulation
+ * frequency (single bin DFT over whole periods) and only frequency, magnitude and phase are printed, one line per frequency.
+ * Frequencies are log spaced from f_start to f_stop and rounded so the table holds whole periods.
+ * Low frequencies use a slower sample rate (daq_set_sample_divider()). LED waveform table is overwritten,
+ * LED stays at bias. !!! Does not change current enable, shunts, force voltage or do any autoranging !!!
+ * @param channel channel to print, 0 for all
+ * @param curr 1 to demodulate current (IMPS), 0 voltage (IMVS)
+ * @param bias LED bias illumination
+ * @param amp modulation amplitude (illumination), at most bias
+ * @param f_start first frequency (Hz)
+ * @param f_stop last frequency (Hz)
+ * @param num_freq number of frequencies
+ * @param settle_periods modulation periods to wait at each frequency before capture
+ * @param num_avg captures averaged at each frequency
+ * @return 0 if ok, -1 on invalid parameters or if LED is busy
+ */
+int8_t meas_lockin_sweep(uint8_t channel, uint8_t curr, float bias, float amp, float f_start, float f_stop,
+                         uint32_t num_freq, uint32_t settle_periods, uint32_t num_avg){
+  float f_max = 1000000.0f / (DAQ_SAMPLE_TIME_100KSPS * MEAS_LOCKIN_MIN_POINTS_PER_PERIOD);
+  float mag[DAQ_NUM_CH], phase[DAQ_NUM_CH];
+  uint32_t t1, t2;
+  t1 = usec_get_timestamp();
+  dbg(Debug, "MEAS:meas_lockin_sweep()\r\n");
+
+  if(amp <= 0.0f || amp > bias){
+    dbg(Error, "MEAS: lock-in amplitude must be >0 and <= bias\n");
+    return -1;
+  }
+  if(f_start <= 0.0f || f_stop <= 0.0f || f_start > f_max || f_stop > f_max){
+    dbg(Error, "MEAS: lock-in frequency out of range\n");
+    return -1;
+  }
+  if(num_freq == 0 || num_freq > MEAS_LOCKIN_MAX_FREQS || num_avg == 0 || channel > DAQ_NUM_CH){
+    dbg(Error, "MEAS: invalid lock-in sweep params\n");
+    return -1;
+  }
+  if(!ledctrl_pulse_is_done()){
+    dbg(Error, "MEAS: LED pulse running\n");
+    return -1;
+  }
+
+  mainser_printf("LOCKIN:\r\n");
+  prv_meas_print_timestamp(usec_get_timestamp_64());
+  mainser_printf("BIAS[sun]:%f\r\n", bias);
+  mainser_printf("AMP[sun]:%f\r\n", amp);
+  prv_meas_print_ch_ident(channel, 0);
+  mainser_printf(curr ? "F[Hz]:MAG[uA/sun]:PHASE[deg]\r\n" : "F[Hz]:MAG[V/sun]:PHASE[deg]\r\n");
+
+  for(uint32_t i = 0; i < num_freq; i++){
+    float freq = (num_freq > 1) ? f_start * powf(f_stop / f_start, (float)i / (float)(num_freq - 1)) : f_start;
+    float f_act = prv_meas_lockin_point(freq, curr, bias, amp, settle_periods, num_avg, mag, phase);
+    if(f_act == 0.0f){
+      dbg(Error, "MEAS: lock-in LED waveform failed\n");
+      break;
+    }
+    mainser_printf("%f", f_act);
+    for(uint8_t ch = 1; ch <= DAQ_NUM_CH; ch++){
+      if(channel == 0 || channel == ch){
+        mainser_printf(":%f:%f", mag[ch-1], phase[ch-1]);
+      }
+    }
+    mainser_printf("\r\n");
+  }
+  mainser_printf("END_LOCKIN\r\n");
+
+  ledwave_stop();
+  daq_set_sample_divider(1);
+  ledctrl_set_illum_noprint(bias);
+
+  t2 = usec_get_timestamp();
+  dbg(Debug, "MEAS:meas_lockin_sweep() took: %lu usec\r\n", t2-t1);
+  return 0;
+}
+
+static uint8_t prv_meas_sunsvoc_staged = 0;
+static uint32_t prv_meas_sunsvoc_step_points = 0;
+
+/**
+ * @brief illumination of step i of num_steps, log spaced from illum_min to illum_max
+ */
+static float prv_meas_sunsvoc_illum(float illum_min, float illum_max, uint32_t i, uint32_t num_steps){
+  return illum_min * powf(illum_max / illum_min, (float)i / (float)(num_steps - 1));
+}
+
+/**
+ * @brief per channel values (x scale) as sample, for printing
+ */
+static t_daq_sample_convd prv_meas_sunsvoc_to_sample(const float *val, float scale){
+  t_daq_sample_convd sample;
+  sample.ch1 = val[0] * scale;
+  sample.ch2 = val[1] * scale;
+  sample.ch3 = val[2] * scale;
+  sample.ch4 = val[3] * scale;
+  sample.ch5 = val[4] * scale;
+  sample.ch6 = val[5] * scale;
+  sample.timestamp = 0;
+  return sample;
+}
+
+/**
+ * @brief Suns-Voc: LED steps through num_steps log spaced illuminations (illum_min to illum_max, LED waveform,
+ * hardware timed) while voltage is sampled. Settled voltage of every step (average of its second half) is printed
+ * with slope of Voc vs ln(illumination) and ideality factor from it (least squares).
+ * LED is off after the last step. LED waveform table is overwritten.
+ * !!! Does not change current enable, shunts, force voltage or do any autoranging !!! (current must be disabled for Voc)
+ * @param channel channel to print, 0 for all
+ * @param illum_min first (lowest) illumination
+ * @param illum_max last (highest) illumination
+ * @param num_steps number of steps
+ * @param step_us time of one step
+ * @return 0 if ok, -1 on invalid parameters or if LED is busy
+ */
+int8_t meas_sunsvoc(uint8_t channel, float illum_min, float illum_max, uint32_t num_steps, uint32_t step_us){
+  if(meas_sunsvoc_stage(illum_min, illum_max, num_steps, step_us) != 0){
+    return -1;
+  }
+  meas_sunsvoc_trigger();
+  meas_sunsvoc_finish(channel, illum_min, illum_max, num_steps);
+  return 0;
+}
+
+/**
+ * @brief first part of Suns-Voc (can be done ahead of time): builds staircase, prepares DAQ and waveform DMA.
+ * Whole staircase is sampled, sample rate is lowered if it does not fit the buffer at 100 ksps.
+ * @return 0 if ok, -1 on invalid parameters or if LED is busy (nothing staged)
+ */
+int8_t meas_sunsvoc_stage(float illum_min, float illum_max, uint32_t num_steps, uint32_t step_us){
+  prv_meas_sunsvoc_staged = 0;
+  if(illum_min <= 0.0f || illum_max <= illum_min || num_steps < 2 || num_steps > MEAS_SUNSVOC_MAX_STEPS){
+    dbg(Error, "MEAS: invalid sunsvoc params\n");
+    return -1;
+  }
+  //steps and one dark point at the end must fit the table
+  uint32_t step_points = step_us / DAQ_SAMPLE_TIME_100KSPS;
+  uint32_t div = (num_steps * step_points + 1 + LEDWAVE_MAX_POINTS - 1) / LEDWAVE_MAX_POINTS;
+  if(div < 1){
+    div = 1;
+  }
+  step_points /= div;
+  if(step_points < MEAS_SUNSVOC_MIN_STEP_POINTS){
+    dbg(Error, "MEAS: sunsvoc step too short\n");
+    return -1;
+  }
+
+  ledwave_stop();
+  daq_set_sample_divider(div);
+  ledwave_clear();
+  for(uint32_t i = 0; i < num_steps; i++){
+    ledwave_add_step(prv_meas_sunsvoc_illum(illum_min, illum_max, i, num_steps), step_points * LEDWAVE_POINT_TIME_US);
+  }
+  ledwave_add_step(0, LEDWAVE_POINT_TIME_US);
+  daq_prepare_for_sampling(ledwave_get_num_points());
+  if(ledwave_arm(0) != 0){
+    daq_set_sample_divider(1);
+    return -1;
+  }
+  prv_meas_sunsvoc_step_points = step_points;
+  prv_meas_sunsvoc_staged = 1;
+  return 0;
+}
+
+/**
+ * @brief starts staircase and sampling. Safe to call from interrupt
+ */
+void meas_sunsvoc_trigger(void){
+  if(!prv_meas_sunsvoc_staged){
+    return;
+  }
   daq_start_sampling();
-  //save start sampling time
-  tmeas_start = usec_get_timestamp();
-  //calculate LED on and off time
-  ton = tmeas_start+MEAS_FLASH_DUMP_SAMPLEBORDER_US;
-  toff = ton + flash_dur_us;
-  //wait for LED on
-  while(usec_get_timestamp() < ton);
-  //set current. LED is now on
-  ledctrl_set_current_tempcomp(curr_set);
-  //wait for LED off
-  while(usec_get_timestamp() < toff);
-  //turn off LED. LED is now off
-  ledctrl_set_current_tempcomp(0.0f);
-  //wait for sampling to finish
+}
+
+/**
+ * @brief rest of Suns-Voc after trigger: waits for staircase, extracts and prints settled Voc, slope and ideality
+ */
+void meas_sunsvoc_finish(uint8_t channel, float illum_min, float illum_max, uint32_t num_steps){
+  float sx = 0, sxx = 0;
+  float sy[DAQ_NUM_CH] = {0};
+  float sxy[DAQ_NUM_CH] = {0};
+  float slope[DAQ_NUM_CH];
+  t_daq_sample_convd voc;
+  //stage failed (reported there)
+  if(!prv_meas_sunsvoc_staged){
+    return;
+  }
+  prv_meas_sunsvoc_staged = 0;
   while(!daq_is_sampling_done());
+  ledwave_stop();
 
-  //dump data
-  prv_meas_print_data_ident_flashmeasure_dump();
-  prv_meas_dump_from_buffer_human_readable_volt(channel, num_samples);
+  prv_meas_print_data_ident_sunsvoc();
+  prv_meas_print_timestamp(daq_get_sampling_start_timestamp());
+  mainser_printf("STEP_TIME[us]:%lu\r\n", prv_meas_sunsvoc_step_points * daq_get_sample_time_us());
+  prv_meas_print_ch_ident(channel, 0);
+  mainser_printf("ILLUM[sun]:VOC[V]\r\n");
+  daq_set_sample_divider(1);
+
+  uint32_t settled = prv_meas_sunsvoc_step_points / 2;
+  for(uint32_t i = 0; i < num_steps; i++){
+    float illum = prv_meas_sunsvoc_illum(illum_min, illum_max, i, num_steps);
+    //second half of step
+    voc = prv_meas_volt_window_avg((i + 1) * prv_meas_sunsvoc_step_points - settled, settled);
+    mainser_printf("%f:", illum);
+    prv_meas_print_sample(voc, channel);
+    float x = logf(illum);
+    sx += x;
+    sxx += x * x;
+    for(uint8_t ch = 1; ch <= DAQ_NUM_CH; ch++){
+      float y = daq_get_from_sample_convd_by_index(voc, ch);
+      sy[ch-1] += y;
+      sxy[ch-1] += x * y;
+    }
+  }
+
+  //Voc = n kT/q ln(illum) + const
+  float vt = MEAS_SUNSVOC_BOLTZMANN_EV * (MEAS_SUNSVOC_DUT_TEMP_C + 273.15f);
+  for(uint8_t c = 0; c < DAQ_NUM_CH; c++){
+    slope[c] = (num_steps * sxy[c] - sx * sy[c]) / (num_steps * sxx - sx * sx);
+  }
+  mainser_printf("SLOPE[V]:");
+  prv_meas_print_sample(prv_meas_sunsvoc_to_sample(slope, 1.0f), channel);
+  mainser_printf("IDEALITY:");
+  prv_meas_print_sample(prv_meas_sunsvoc_to_sample(slope, 1.0f / vt), channel);
+  mainser_printf("END_SUNSVOC\r\n");
+}
+
+static uint8_t prv_meas_flash_flat_staged = 0;
+
+/**
+ * @brief stages pre-emphasized flash as LED waveform: border_us dark, flash, border_us dark, all sampled
+ * @return 0 if ok, -1 on invalid parameters, if it does not fit the table or LED is busy (nothing staged)
+ */
+static int8_t prv_meas_flash_flat_stage(float illum, uint32_t flash_dur_us, uint32_t border_us){
+  prv_meas_flash_flat_staged = 0;
+  if(!(illum > 0.0f) || flash_dur_us < LEDWAVE_POINT_TIME_US){
+    dbg(Error, "MEAS: invalid flat flash params\n");
+    return -1;
+  }
+  ledwave_stop();
+  ledwave_clear();
+  if(ledwave_add_step(0, border_us) != 0 || ledwave_add_flash(illum, flash_dur_us) != 0 || ledwave_add_step(0, border_us) != 0){
+    ledwave_clear();
+    return -1;
+  }
+  prv_meas_flash_num_samples = ledwave_get_num_points();
+  daq_prepare_for_sampling(prv_meas_flash_num_samples);
+  if(ledwave_arm(0) != 0){
+    return -1;
+  }
+  prv_meas_flash_flat_staged = 1;
+  return 0;
+}
+
+/**
+ * @brief Flat flash dump: like meas_flashmeasure_dumpbuffer(), but LED is driven by a waveform pre-emphasized with the
+ * droop model (ledctrl_set_droop_model()), so light output stays flat while the LED heats up. Sampling covers
+ * MEAS_FLASH_DUMP_SAMPLEBORDER_US before and after the flash. LED waveform table is overwritten.
+ * @param channel channel to dump, 0 for all
+ * @param illum illumination in suns
+ * @param flash_dur_us duration of flash in us
+ * @return 0 if ok, -1 on invalid parameters or if LED is busy
+ */
+int8_t meas_flashmeasure_flat(uint8_t channel, float illum, uint32_t flash_dur_us){
+  if(meas_flashmeasure_flat_stage(illum, flash_dur_us) != 0){
+    return -1;
+  }
+  meas_flashmeasure_flat_trigger();
+  meas_flashmeasure_flat_finish(channel);
+  return 0;
+}
+
+/**
+ * @brief first part of flat flash dump (can be done ahead of time): builds waveform, prepares DAQ and waveform DMA
+ * @return 0 if ok, -1 on invalid parameters or if LED is busy (nothing staged)
+ */
+int8_t meas_flashmeasure_flat_stage(float illum, uint32_t flash_dur_us){
+  return prv_meas_flash_flat_stage(illum, flash_dur_us, MEAS_FLASH_DUMP_SAMPLEBORDER_US);
+}
+
+/**
+ * @brief starts flat flash and sampling. Safe to call from interrupt
+ */
+void meas_flashmeasure_flat_trigger(void){
+  if(!prv_meas_flash_flat_staged){
+    return;
+  }
+  daq_start_sampling();
+}
+
+/**
+ * @brief rest of flat flash dump after trigger: waits for the waveform and sampling to end, dumps
+ */
+void meas_flashmeasure_flat_finish(uint8_t channel){
+  //stage failed (reported there)
+  if(!prv_meas_flash_flat_staged){
+    return;
+  }
+  prv_meas_flash_flat_staged = 0;
+  while(!daq_is_sampling_done());
+  ledwave_stop();
+
+  prv_meas_print_data_ident_flashmeasure_flat();
+  prv_meas_dump_from_buffer_human_readable_volt(channel, prv_meas_flash_num_samples);
 }
 
+/**
+ * @brief Calibrates LED droop model without a photodiode: DUT short circuit current follows the light output. A plain
+ * (not pre-emphasized) flash is sampled, dark current before the flash is subtracted and Isc = A + B exp(-t / tau) is
+ * fitted to three equal windows at equal spacing (skipping MEAS_LEDDROOP_SKIP_US of LED and DUT response). Their
+ * differences decay by r = exp(-spacing / tau), which gives tau, A and B. Relative droop B / (A + B) is scaled to
+ * droop per sun and set with ledctrl_set_droop_model().
+ * !!! Does not change current enable, shunts or force voltage !!! (enable current and force 0 V on channel before)
+ * @param channel DUT channel (1 - 6)
+ * @param illum flash illumination in suns, use the highest one of the test
+ * @param flash_dur_us flash duration, a few tau
+ * @return 0 if ok, -1 on invalid parameters, if LED is busy or no droop is found (model is not changed)
+ */
+int8_t meas_led_droop_calibrate(uint8_t channel, float illum, uint32_t flash_dur_us){
+  uint32_t border_n = MEAS_LEDDROOP_BORDER_US / DAQ_SAMPLE_TIME_100KSPS;
+  uint32_t skip_n = MEAS_LEDDROOP_SKIP_US / DAQ_SAMPLE_TIME_100KSPS;
+  uint32_t flash_n = flash_dur_us / DAQ_SAMPLE_TIME_100KSPS;
+  if(channel < 1 || channel > DAQ_NUM_CH){
+    dbg(Error, "MEAS: droop calibration needs one channel\n");
+    return -1;
+  }
+  if(flash_n < skip_n + 3 * MEAS_LEDDROOP_MIN_WINDOW_SAMPLES){
+    dbg(Error, "MEAS: droop calibration flash too short\n");
+    return -1;
+  }
+
+  //plain flash, model is off while it is built
+  float droop_old = ledctrl_get_droop_per_sun();
+  float tau_old = ledctrl_get_droop_tau_us();
+  ledctrl_set_droop_model(0.0f, tau_old);
+  int8_t staged = prv_meas_flash_flat_stage(illum, flash_dur_us, MEAS_LEDDROOP_BORDER_US);
+  ledctrl_set_droop_model(droop_old, tau_old);
+  if(staged != 0){
+    return -1;
+  }
+  prv_meas_flash_flat_staged = 0;
+  daq_start_sampling();
+  while(!daq_is_sampling_done());
+  ledwave_stop();
+
+  //windows relative to dark current
+  float dark = daq_get_from_sample_convd_by_index(prv_meas_curr_window_avg(0, border_n), channel);
+  uint32_t len = flash_n - skip_n;
+  uint32_t win = len / 4;
+  uint32_t gap = (len - win) / 2;
+  float y[3];
+  for(uint8_t i = 0; i < 3; i++){
+    y[i] = daq_get_from_sample_convd_by_index(prv_meas_curr_window_avg(border_n + skip_n + i * gap, win), channel) - dark;
+  }
+  //light must decay (either current sign), and slower in the second half
+  float r = (y[1] - y[2]) / (y[0] - y[1]);
+  if(!(fabsf(y[0]) > fabsf(y[1])) || !(r > 0.0f && r < 1.0f)){
+    dbg(Error, "MEAS: no LED droop found\n");
+    return -1;
+  }
+  float gap_us = (float)(gap * DAQ_SAMPLE_TIME_100KSPS);
+  float win_us = (float)(win * DAQ_SAMPLE_TIME_100KSPS);
+  float tau = -gap_us / logf(r);
+  //window average of exp(-t / tau) starting at t0 is g x exp(-t0 / tau)
+  float g = tau / win_us * (1.0f - expf(-win_us / tau));
+  float b_win = (y[0] - y[1]) / (1.0f - r);
+  float a = y[0] - b_win;
+  float b0 = b_win / g * expf((float)(skip_n * DAQ_SAMPLE_TIME_100KSPS) / tau);
+  float droop = b0 / (a + b0);
+  if(!(droop > 0.0f && droop < 1.0f)){
+    dbg(Error, "MEAS: LED droop fit failed\n");
+    return -1;
+  }
+  ledctrl_set_droop_model(droop / illum, tau);
+
+  prv_meas_print_data_ident_led_droop_cal();
+  prv_meas_print_timestamp(daq_get_sampling_start_timestamp());
+  mainser_printf("ILLUM[sun]:%f\r\n", illum);
+  mainser_printf("DROOP:%f\r\n", droop);
+  mainser_printf("DROOP[1/sun]:%f\r\n", droop / illum);
+  mainser_printf("TAU[us]:%f\r\n", tau);
+  return 0;
+}
 
 /**
  * @brief measures I and V for MPPT
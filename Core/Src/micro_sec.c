@@ -8,6 +8,12 @@
 //overflow counter global variable
 volatile uint32_t g_usec_overflow_count;
 
+//sum of timestamps removed by usec_reset_timestamp()
+static uint64_t prv_usec_reset_offset = 0;
+
+//function to call on compare match
+static void (*volatile prv_usec_compare_cb)(void) = NULL;
+
 
 /**
  * @brief initializes usec timer
@@ -17,6 +23,16 @@ void usec_init(void){
   g_usec_overflow_count = 0;
   //clear overflow interrupt flag (if not, callback called immediately)
   __HAL_TIM_CLEAR_IT(&MICRO_SEC_TIM_HANDLE ,TIM_IT_UPDATE);
+
+  //compare channel in frozen (timing) mode - no output, only interrupt on match
+  TIM_OC_InitTypeDef sConfigOC = {0};
+  sConfigOC.OCMode = TIM_OCMODE_TIMING;
+  sConfigOC.Pulse = 0;
+  sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+  sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+  HAL_TIM_OC_ConfigChannel(&MICRO_SEC_TIM_HANDLE, &sConfigOC, USEC_COMPARE_CHANNEL);
+  __HAL_TIM_DISABLE_IT(&MICRO_SEC_TIM_HANDLE, USEC_COMPARE_IT);
+
   HAL_TIM_Base_Start_IT(&MICRO_SEC_TIM_HANDLE);
 }
 
@@ -40,8 +56,11 @@ uint32_t usec_get_timestamp(void){
  */
 void usec_reset_timestamp(void){
   __disable_irq();
+  prv_usec_reset_offset += usec_get_timestamp_64();
   g_usec_overflow_count = 0;
   __HAL_TIM_SET_COUNTER(&MICRO_SEC_TIM_HANDLE, 0);
+  //overflow that happened before reset must not be counted
+  __HAL_TIM_CLEAR_FLAG(&MICRO_SEC_TIM_HANDLE, TIM_FLAG_UPDATE);
   __enable_irq();
 }
 
@@ -52,6 +71,65 @@ void prv_usec_overflow_callback(void){
   g_usec_overflow_count++;
 }
 
+/**
+ * @brief call this from output compare callback (compare channel)
+ */
+void prv_usec_compare_callback(void){
+  //one shot
+  __HAL_TIM_DISABLE_IT(&MICRO_SEC_TIM_HANDLE, USEC_COMPARE_IT);
+  void (*cb)(void) = prv_usec_compare_cb;
+  prv_usec_compare_cb = NULL;
+  if(cb != NULL){
+    cb();
+  }
+}
+
+/**
+ * @brief calls callback from timer interrupt when usec timestamp reaches given time.
+ * Only one compare can be armed at a time, arming again overrides previous one.
+ * If the time has already passed, callback is called immediately (from caller context).
+ * @param timestamp 64bit timestamp. Max USEC_COMPARE_MAX_AHEAD_US in future.
+ * @param callback function to call. Keep it short, runs in interrupt.
+ * @return 0 if armed (or called), -1 if timestamp is too far in future
+ */
+int8_t usec_compare_arm(uint64_t timestamp, void (*callback)(void)){
+  uint64_t now = usec_get_timestamp_64();
+  if(timestamp > now && timestamp - now > USEC_COMPARE_MAX_AHEAD_US){
+    return -1;
+  }
+
+  uint8_t late = 0;
+  __disable_irq();
+  prv_usec_compare_cb = callback;
+  __HAL_TIM_SET_COMPARE(&MICRO_SEC_TIM_HANDLE, USEC_COMPARE_CHANNEL, (uint32_t)timestamp);
+  __HAL_TIM_CLEAR_FLAG(&MICRO_SEC_TIM_HANDLE, USEC_COMPARE_FLAG);
+  __HAL_TIM_ENABLE_IT(&MICRO_SEC_TIM_HANDLE, USEC_COMPARE_IT);
+  //compare fires only on exact match. If counter is already past it, do it here
+  //(signed 32bit difference is fine because target is less than USEC_COMPARE_MAX_AHEAD_US away)
+  if((int32_t)(__HAL_TIM_GET_COUNTER(&MICRO_SEC_TIM_HANDLE) - (uint32_t)timestamp) >= 0){
+    __HAL_TIM_DISABLE_IT(&MICRO_SEC_TIM_HANDLE, USEC_COMPARE_IT);
+    __HAL_TIM_CLEAR_FLAG(&MICRO_SEC_TIM_HANDLE, USEC_COMPARE_FLAG);
+    prv_usec_compare_cb = NULL;
+    late = 1;
+  }
+  __enable_irq();
+
+  if(late && callback != NULL){
+    callback();
+  }
+  return 0;
+}
+
+/**
+ * @brief returns how much time was removed from timestamp by resets. timestamp + this is time since boot.
+ */
+uint64_t usec_get_reset_offset(void){
+  __disable_irq();
+  uint64_t offset = prv_usec_reset_offset;
+  __enable_irq();
+  return offset;
+}
+
 /**
  * @brief returns the number of usec timer overflows
  */
@@ -61,19 +139,26 @@ uint32_t usec_get_overflow_count(void){
 
 
 /**
- * @brief returns the current timestamp in 64bit format
- * @warning
+ * @brief 32bit timer counter (for usec_ts64_read)
  */
-uint64_t usec_get_timestamp_64(void){
-  //this section needs to happen without interrupts to make it thread safe
-  __disable_irq();
-  uint32_t timestamp_32 = __HAL_TIM_GET_COUNTER(&MICRO_SEC_TIM_HANDLE);
-  uint32_t ovf_cnt = g_usec_overflow_count;
-  __enable_irq();
+static uint32_t prv_usec_get_counter(void){
+  return __HAL_TIM_GET_COUNTER(&MICRO_SEC_TIM_HANDLE);
+}
+
+/**
+ * @brief nonzero if timer overflowed and update interrupt didn't run yet (for usec_ts64_read)
+ */
+static uint32_t prv_usec_get_update_pending(void){
+  return __HAL_TIM_GET_FLAG(&MICRO_SEC_TIM_HANDLE, TIM_FLAG_UPDATE);
+}
 
-  uint64_t timestamp = (uint64_t)ovf_cnt << 32;
-  timestamp |= (uint64_t)timestamp_32;
-  return timestamp;
+/**
+ * @brief returns the current timestamp in 64bit format. Lock-free, interrupts are not disabled.
+ * Safe to call from interrupts and with interrupts disabled (overflow that is not counted yet is detected
+ * from pending update flag).
+ */
+uint64_t usec_get_timestamp_64(void){
+  return usec_ts64_read(&g_usec_overflow_count, prv_usec_get_counter, prv_usec_get_update_pending);
 }
 
 
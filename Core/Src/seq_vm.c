@@ -0,0 +1,325 @@
+//
+// seq_vm.c
+//
+// See seq_vm.h for program format and instruction set.
+
+#include "seq_vm.h"
+#include <string.h>
+#include <math.h>
+#include "main_serial.h"
+#include "micro_sec.h"
+#include "daq.h"
+#include "debug.h"
+
+static uint8_t prv_seqvm_prog[SEQVM_PROG_SIZE];
+static uint32_t prv_seqvm_len = 0;
+static float prv_seqvm_vars[SEQVM_NUM_VARS];
+static uint32_t prv_seqvm_pc = 0;
+static uint64_t prv_seqvm_time = 0;   //sequence time cursor
+static uint8_t prv_seqvm_running = 0;
+
+//instruction lengths including opcode. CMD is 2 + params_len
+static const uint8_t prv_seqvm_op_len[seqvm_op_count] = {
+    [seqvm_op_end] = 1,
+    [seqvm_op_cmd] = 2,
+    [seqvm_op_wait] = 5,
+    [seqvm_op_sync] = 1,
+    [seqvm_op_set] = 6,
+    [seqvm_op_add] = 6,
+    [seqvm_op_mov] = 3,
+    [seqvm_op_sub] = 3,
+    [seqvm_op_abs] = 2,
+    [seqvm_op_measv] = 3,
+    [seqvm_op_measi] = 3,
+    [seqvm_op_jmp] = 3,
+    [seqvm_op_jlt] = 8,
+    [seqvm_op_jgt] = 8,
+    [seqvm_op_loop] = 4,
+    [seqvm_op_print] = 2,
+};
+
+
+static uint16_t prv_seqvm_u16(const uint8_t *p){
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t prv_seqvm_u32(const uint8_t *p){
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static float prv_seqvm_f32(const uint8_t *p){
+  float v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/**
+ * @brief length of instruction at pc, 0 if opcode is unknown or instruction is truncated
+ */
+static uint32_t prv_seqvm_insn_len(const uint8_t *prog, uint32_t len, uint32_t pc){
+  uint8_t op = prog[pc];
+  if(op >= seqvm_op_count){
+    return 0;
+  }
+  uint32_t insn_len = prv_seqvm_op_len[op];
+  if(op == seqvm_op_cmd){
+    if(pc + 2 > len){
+      return 0;
+    }
+    int16_t params_len = cmdsched_get_params_len((meas_funct_id)prog[pc + 1]);
+    if(params_len < 0){
+      return 0;
+    }
+    insn_len += params_len;
+  }
+  return (pc + insn_len <= len) ? insn_len : 0;
+}
+
+/**
+ * @brief checks operands of one instruction (var index, channel). Jump targets are checked separately.
+ */
+static uint8_t prv_seqvm_operands_ok(const uint8_t *insn){
+  switch(insn[0]){
+    case seqvm_op_set:
+    case seqvm_op_add:
+    case seqvm_op_abs:
+    case seqvm_op_jlt:
+    case seqvm_op_jgt:
+    case seqvm_op_loop:
+    case seqvm_op_print:
+      return insn[1] < SEQVM_NUM_VARS;
+    case seqvm_op_mov:
+    case seqvm_op_sub:
+      return insn[1] < SEQVM_NUM_VARS && insn[2] < SEQVM_NUM_VARS;
+    case seqvm_op_measv:
+    case seqvm_op_measi:
+      return insn[1] < SEQVM_NUM_VARS && insn[2] >= 1 && insn[2] <= DAQ_NUM_CH;
+    default:
+      return 1;
+  }
+}
+
+/**
+ * @brief jump target of instruction, -1 if it is not a jump
+ */
+static int32_t prv_seqvm_jump_target(const uint8_t *insn){
+  switch(insn[0]){
+    case seqvm_op_jmp:
+      return prv_seqvm_u16(&insn[1]);
+    case seqvm_op_jlt:
+    case seqvm_op_jgt:
+      return prv_seqvm_u16(&insn[6]);
+    case seqvm_op_loop:
+      return prv_seqvm_u16(&insn[2]);
+    default:
+      return -1;
+  }
+}
+
+/**
+ * @brief checks and stores program. Batch process function for seqload.
+ * @return NULL on success, fail reason otherwise
+ */
+const char* seqvm_load(const uint8_t *prog, uint32_t len){
+  //bitmap of instruction starts, for checking jump targets
+  static uint8_t insn_start[SEQVM_PROG_SIZE / 8];
+
+  if(prv_seqvm_running){
+    return "RUNNING";
+  }
+  if(len == 0 || len > SEQVM_PROG_SIZE){
+    return "FORMAT";
+  }
+  memset(insn_start, 0, sizeof(insn_start));
+  for(uint32_t pc = 0; pc < len; ){
+    uint32_t insn_len = prv_seqvm_insn_len(prog, len, pc);
+    if(insn_len == 0){
+      return "FORMAT";
+    }
+    if(!prv_seqvm_operands_ok(&prog[pc])){
+      return "OPERAND";
+    }
+    insn_start[pc / 8] |= 1 << (pc % 8);
+    pc += insn_len;
+  }
+  for(uint32_t pc = 0; pc < len; pc += prv_seqvm_insn_len(prog, len, pc)){
+    int32_t target = prv_seqvm_jump_target(&prog[pc]);
+    if(target >= 0 && (target >= (int32_t)len || !(insn_start[target / 8] & (1 << (target % 8))))){
+      return "JUMP";
+    }
+  }
+
+  memcpy(prv_seqvm_prog, prog, len);
+  prv_seqvm_len = len;
+  mainser_printf("SEQLOAD_OK:%lu\r\n", len);
+  return NULL;
+}
+
+/**
+ * @brief starts loaded program from the beginning. All variables are 0. Starts scheduler if not running.
+ * @return 0 on success, -1 if no program or already running
+ */
+int8_t seqvm_run(void){
+  if(prv_seqvm_len == 0 || prv_seqvm_running){
+    return -1;
+  }
+  cmdsched_start();
+  memset(prv_seqvm_vars, 0, sizeof(prv_seqvm_vars));
+  prv_seqvm_pc = 0;
+  prv_seqvm_time = usec_get_timestamp_64() + SEQVM_START_DELAY_US;
+  prv_seqvm_running = 1;
+  return 0;
+}
+
+/**
+ * @brief stops running program. Cmds it already put in scheduler queue still run (use schedcancel).
+ */
+void seqvm_stop(void){
+  prv_seqvm_running = 0;
+}
+
+uint8_t seqvm_is_running(void){
+  return prv_seqvm_running;
+}
+
+static void prv_seqvm_fail(const char *reason){
+  dbg(Error, "seq failed: %s at %lu\n", reason, prv_seqvm_pc);
+  mainser_printf("SEQ_FAIL:%s:%lu\r\n", reason, prv_seqvm_pc);
+  prv_seqvm_running = 0;
+}
+
+/**
+ * @brief runs program until it has to wait. Call from main loop.
+ * @return time until it has to be called again, UINT64_MAX if not running
+ */
+uint64_t seqvm_handler(void){
+  for(uint8_t step = 0; step < SEQVM_MAX_STEPS; step++){
+    if(!prv_seqvm_running){
+      return UINT64_MAX;
+    }
+    //don't delay staged cmd
+    if(cmdsched_is_armed()){
+      return 0;
+    }
+    if(prv_seqvm_pc >= prv_seqvm_len){
+      prv_seqvm_running = 0;
+      mainser_printf("SEQ_END\r\n");
+      return UINT64_MAX;
+    }
+
+    const uint8_t *insn = &prv_seqvm_prog[prv_seqvm_pc];
+    uint32_t next_pc = prv_seqvm_pc + prv_seqvm_insn_len(prv_seqvm_prog, prv_seqvm_len, prv_seqvm_pc);
+    uint64_t tnow = usec_get_timestamp_64();
+    //first operand is a var index for most instructions (checked when loaded)
+    float *v = &prv_seqvm_vars[0];
+    if(prv_seqvm_op_len[insn[0]] > 1){
+      v = &prv_seqvm_vars[insn[1] % SEQVM_NUM_VARS];
+    }
+
+    switch(insn[0]){
+      case seqvm_op_end:
+        prv_seqvm_running = 0;
+        mainser_printf("SEQ_END\r\n");
+        return UINT64_MAX;
+      case seqvm_op_cmd:
+        if(tnow + SEQVM_LEAD_US < prv_seqvm_time){
+          return prv_seqvm_time - SEQVM_LEAD_US - tnow;
+        }
+        switch(cmdsched_add(prv_seqvm_time, (meas_funct_id)insn[1], CMDSCHED_NO_TAG, &insn[2])){
+          case CMDSCHED_ADD_OK:
+            break;
+          case CMDSCHED_ADD_OVERLAP:
+            prv_seqvm_fail("OVERLAP");
+            return UINT64_MAX;
+          default:
+            prv_seqvm_fail("SCHED");
+            return UINT64_MAX;
+        }
+        break;
+      case seqvm_op_wait:
+        prv_seqvm_time += prv_seqvm_u32(&insn[1]);
+        break;
+      case seqvm_op_sync:
+        if(tnow > prv_seqvm_time){
+          prv_seqvm_time = tnow;
+        }
+        break;
+      case seqvm_op_set:
+        *v = prv_seqvm_f32(&insn[2]);
+        break;
+      case seqvm_op_add:
+        *v += prv_seqvm_f32(&insn[2]);
+        break;
+      case seqvm_op_mov:
+        *v = prv_seqvm_vars[insn[2]];
+        break;
+      case seqvm_op_sub:
+        *v -= prv_seqvm_vars[insn[2]];
+        break;
+      case seqvm_op_abs:
+        *v = fabsf(*v);
+        break;
+      case seqvm_op_measv:
+      case seqvm_op_measi:
+        if(tnow < prv_seqvm_time){
+          return prv_seqvm_time - tnow;
+        }
+        //cmds scheduled before (disablecurrent, setillum...) must run first
+        if(cmdsched_next_exec_time() <= prv_seqvm_time){
+          return 0;
+        }
+        if(insn[0] == seqvm_op_measv){
+          *v = daq_get_from_sample_convd_by_index(daq_single_shot_volt(meas_get_num_avg()), insn[2]);
+        }
+        else{
+          *v = daq_get_from_sample_convd_by_index(daq_single_shot_curr_no_autorng(meas_get_num_avg()), insn[2]);
+        }
+        break;
+      case seqvm_op_jmp:
+        next_pc = prv_seqvm_u16(&insn[1]);
+        break;
+      case seqvm_op_jlt:
+        if(*v < prv_seqvm_f32(&insn[2])){
+          next_pc = prv_seqvm_u16(&insn[6]);
+        }
+        break;
+      case seqvm_op_jgt:
+        if(*v > prv_seqvm_f32(&insn[2])){
+          next_pc = prv_seqvm_u16(&insn[6]);
+        }
+        break;
+      case seqvm_op_loop:
+        *v -= 1.0f;
+        if(*v > 0.0f){
+          next_pc = prv_seqvm_u16(&insn[2]);
+        }
+        break;
+      case seqvm_op_print:
+        mainser_printf("SEQ_VAR:%u:%f\r\n", insn[1], *v);
+        break;
+      default:
+        //can't happen, program is checked when loaded
+        prv_seqvm_fail("OPCODE");
+        return UINT64_MAX;
+    }
+    prv_seqvm_pc = next_pc;
+  }
+  return 0;
+}
+
+/**
+ * @brief prints state, pc, sequence time and variables to main serial
+ */
+void seqvm_print_status(void){
+  mainser_printf("SEQ_STATE:%s\r\n", prv_seqvm_running ? "RUNNING" : "IDLE");
+  mainser_printf("SEQ_LEN:%lu\r\n", prv_seqvm_len);
+  mainser_printf("SEQ_PC:%lu\r\n", prv_seqvm_pc);
+  mainser_printf("SEQ_TIME:%llu\r\n", prv_seqvm_time);
+  for(uint8_t i = 0; i < SEQVM_NUM_VARS; i++){
+    mainser_printf("SEQ_VAR:%u:%f\r\n", i, prv_seqvm_vars[i]);
+  }
+}
@@ -0,0 +1,99 @@
+//
+// task_sched.c
+//
+// See task_sched.h for how tasks are run.
+
+#include "task_sched.h"
+#include <string.h>
+#include "micro_sec.h"
+#include "main_serial.h"
+#include "debug.h"
+
+static tasksch_task_t prv_tasksch_tasks[TASKSCH_MAX_TASKS];
+static uint8_t prv_tasksch_num = 0;
+
+
+/**
+ * @brief adds a background task
+ * @param name static string, used in statistics
+ * @param period_us minimal time between starts. 0 to run whenever there is time
+ * @param budget_us worst case runtime. Task is started only if this much time is left until next deadline
+ * @return 0 on success, -1 if there is no room
+ */
+int8_t tasksch_register(const char *name, tasksch_fn fn, uint32_t period_us, uint32_t budget_us){
+  if(prv_tasksch_num >= TASKSCH_MAX_TASKS){
+    dbg(Error, "too many tasks, %s not registered\n", name);
+    return -1;
+  }
+  tasksch_task_t *task = &prv_tasksch_tasks[prv_tasksch_num++];
+  memset(task, 0, sizeof(*task));
+  task->name = name;
+  task->fn = fn;
+  task->period_us = period_us;
+  task->budget_us = budget_us;
+  return 0;
+}
+
+/**
+ * @brief runs due tasks that fit before the next deadline. Call from main loop.
+ * @param time_to_deadline time until next scheduled cmd (0xFFFFFFFFFFFFFFFF if none)
+ */
+void tasksch_run(uint64_t time_to_deadline){
+  uint64_t tnow = usec_get_timestamp_64();
+  uint64_t deadline = (time_to_deadline > UINT64_MAX - tnow) ? UINT64_MAX : tnow + time_to_deadline;
+
+  for(uint8_t i = 0; i < prv_tasksch_num; i++){
+    tasksch_task_t *task = &prv_tasksch_tasks[i];
+    //timestamp is reset when scheduler starts, so last_run can be in the future
+    if(task->last_run <= tnow && tnow - task->last_run < task->period_us){
+      continue;
+    }
+    if(tnow + task->budget_us >= deadline){
+      continue;
+    }
+    if(task->runs > 0 && task->last_run <= tnow){
+      uint64_t delay = tnow - task->last_run - task->period_us;
+      if(delay > task->max_delay_us){
+        task->max_delay_us = (delay > UINT32_MAX) ? UINT32_MAX : (uint32_t)delay;
+      }
+    }
+    task->fn();
+    uint64_t tend = usec_get_timestamp_64();
+    uint32_t took = (uint32_t)(tend - tnow);
+    task->last_run = tnow;
+    task->runs++;
+    task->sum_us += took;
+    if(took > task->max_us) task->max_us = took;
+    if(took > task->budget_us){
+      task->over_budget++;
+      dbg(Warning, "task %s over budget: %lu us\n", task->name, took);
+    }
+    tnow = tend;
+  }
+}
+
+/**
+ * @brief prints runtime statistics of all tasks to main serial.
+ * Line format: NAME:PERIOD_US:BUDGET_US:RUNS:MAX_US:AVG_US:OVER_BUDGET:MAX_DELAY_US
+ */
+void tasksch_print_stats(void){
+  mainser_printf("TASK_STATS:\r\n");
+  mainser_printf("NAME:PERIOD_US:BUDGET_US:RUNS:MAX_US:AVG_US:OVER_BUDGET:MAX_DELAY_US\r\n");
+  for(uint8_t i = 0; i < prv_tasksch_num; i++){
+    const tasksch_task_t *task = &prv_tasksch_tasks[i];
+    uint32_t avg = (task->runs > 0) ? (uint32_t)(task->sum_us / task->runs) : 0;
+    mainser_printf("%s:%lu:%lu:%lu:%lu:%lu:%lu:%lu\r\n", task->name, task->period_us, task->budget_us,
+                   task->runs, task->max_us, avg, task->over_budget, task->max_delay_us);
+  }
+}
+
+void tasksch_reset_stats(void){
+  for(uint8_t i = 0; i < prv_tasksch_num; i++){
+    tasksch_task_t *task = &prv_tasksch_tasks[i];
+    task->runs = 0;
+    task->over_budget = 0;
+    task->max_us = 0;
+    task->sum_us = 0;
+    task->max_delay_us = 0;
+  }
+}
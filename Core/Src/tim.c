@@ -28,6 +28,7 @@ TIM_HandleTypeDef htim1;
 TIM_HandleTypeDef htim2;
 TIM_HandleTypeDef htim4;
 TIM_HandleTypeDef htim20;
+DMA_HandleTypeDef hdma_tim20_up;
 
 /* TIM1 init function */
 void MX_TIM1_Init(void)
@@ -292,6 +293,24 @@ void HAL_TIM_Base_MspInit(TIM_HandleTypeDef* tim_baseHandle)
     /* TIM20 clock enable */
     __HAL_RCC_TIM20_CLK_ENABLE();
 
+    /* TIM20 DMA Init */
+    /* TIM20_UP Init */
+    hdma_tim20_up.Instance = DMA1_Channel4;
+    hdma_tim20_up.Init.Request = DMA_REQUEST_TIM20_UP;
+    hdma_tim20_up.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_tim20_up.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_tim20_up.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_tim20_up.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma_tim20_up.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    hdma_tim20_up.Init.Mode = DMA_NORMAL;
+    hdma_tim20_up.Init.Priority = DMA_PRIORITY_HIGH;
+    if (HAL_DMA_Init(&hdma_tim20_up) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(tim_baseHandle,hdma[TIM_DMA_ID_UPDATE],hdma_tim20_up);
+
     /* TIM20 interrupt Init */
     HAL_NVIC_SetPriority(TIM20_UP_IRQn, 0, 0);
     HAL_NVIC_EnableIRQ(TIM20_UP_IRQn);
@@ -414,6 +433,9 @@ void HAL_TIM_Base_MspDeInit(TIM_HandleTypeDef* tim_baseHandle)
     /* Peripheral clock disable */
     __HAL_RCC_TIM20_CLK_DISABLE();
 
+    /* TIM20 DMA DeInit */
+    HAL_DMA_DeInit(tim_baseHandle->hdma[TIM_DMA_ID_UPDATE]);
+
     /* TIM20 interrupt Deinit */
     HAL_NVIC_DisableIRQ(TIM20_UP_IRQn);
     HAL_NVIC_DisableIRQ(TIM20_TRG_COM_IRQn);
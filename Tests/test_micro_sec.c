@@ -0,0 +1,118 @@
+//
+// test_micro_sec.c
+//
+// Host test of lock-free 64bit usec timestamp (usec_ts64_read) around counter wrap.
+// Timer counter, overflow count and update flag are stubbed.
+// Build and run from repo root: gcc -std=c11 -Wall -ICore/Inc Tests/test_micro_sec.c -o test_micro_sec && ./test_micro_sec
+//
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "micro_sec_ts64.h"
+
+//stubbed timer state
+static volatile uint32_t prv_test_ovf_count;
+static uint32_t prv_test_counter;
+static uint32_t prv_test_pending;
+//if set, overflow interrupt "runs" right after counter is read (once)
+static uint8_t prv_test_isr_after_counter_read;
+static uint32_t prv_test_counter_reads;
+
+static int prv_test_failed = 0;
+
+static uint32_t prv_test_get_counter(void){
+  uint32_t cnt = prv_test_counter;
+  prv_test_counter_reads++;
+  if(prv_test_isr_after_counter_read){
+    prv_test_isr_after_counter_read = 0;
+    prv_test_ovf_count++;
+    prv_test_pending = 0;
+    //next read is after the wrap
+    prv_test_counter = 2;
+  }
+  return cnt;
+}
+
+static uint32_t prv_test_get_pending(void){
+  return prv_test_pending;
+}
+
+static void prv_test_set(uint32_t ovf_count, uint32_t counter, uint32_t pending){
+  prv_test_ovf_count = ovf_count;
+  prv_test_counter = counter;
+  prv_test_pending = pending;
+  prv_test_isr_after_counter_read = 0;
+  prv_test_counter_reads = 0;
+}
+
+static uint64_t prv_test_read(void){
+  return usec_ts64_read(&prv_test_ovf_count, prv_test_get_counter, prv_test_get_pending);
+}
+
+static void prv_test_expect(const char *name, uint64_t expected){
+  uint64_t got = prv_test_read();
+  if(got != expected){
+    printf("FAIL %s: expected 0x%016" PRIx64 ", got 0x%016" PRIx64 "\n", name, expected, got);
+    prv_test_failed = 1;
+  }
+  else{
+    printf("ok   %s\n", name);
+  }
+}
+
+#define TS(ovf, cnt) (((uint64_t)(ovf) << 32) | (uint32_t)(cnt))
+
+int main(void){
+  prv_test_set(5, 1000, 0);
+  prv_test_expect("no wrap", TS(5, 1000));
+
+  prv_test_set(5, 0xFFFFFFFFUL, 0);
+  prv_test_expect("just before wrap", TS(5, 0xFFFFFFFFUL));
+
+  //counter read before the wrap, flag set before it is read: must not count overflow twice
+  prv_test_set(5, 0xFFFFFFFEUL, 1);
+  prv_test_expect("before wrap, flag set after counter read", TS(5, 0xFFFFFFFEUL));
+
+  //interrupt pending (or interrupts disabled): overflow not counted yet
+  prv_test_set(5, 3, 1);
+  prv_test_expect("just after wrap, flag pending", TS(6, 3));
+
+  prv_test_set(6, 3, 0);
+  prv_test_expect("just after wrap, flag serviced", TS(6, 3));
+
+  //heuristic boundary: low half counts pending overflow, high half doesn't
+  prv_test_set(5, 0x7FFFFFFFUL, 1);
+  prv_test_expect("pending, counter at top of low half", TS(6, 0x7FFFFFFFUL));
+  prv_test_set(5, 0x80000000UL, 1);
+  prv_test_expect("pending, counter at bottom of high half", TS(5, 0x80000000UL));
+
+  //overflow interrupt runs between overflow count and counter read: retried
+  prv_test_set(5, 0xFFFFFFFFUL, 1);
+  prv_test_isr_after_counter_read = 1;
+  prv_test_expect("interrupt between reads", TS(6, 2));
+  if(prv_test_counter_reads != 2){
+    printf("FAIL interrupt between reads: expected 2 counter reads, got %" PRIu32 "\n", prv_test_counter_reads);
+    prv_test_failed = 1;
+  }
+
+  //sweep across the wrap with flag pending for a while, then serviced: must be monotonic
+  uint64_t prev = 0;
+  for(uint32_t i = 0; i < 40; i++){
+    uint32_t cnt = 0xFFFFFFF0UL + i;   //wraps at i = 16
+    uint8_t wrapped = i >= 16;
+    uint8_t serviced = i >= 24;
+    prv_test_set(wrapped && serviced ? 8 : 7, cnt, wrapped && !serviced);
+    uint64_t ts = prv_test_read();
+    if(ts != TS(7, 0xFFFFFFF0UL) + i || ts < prev){
+      printf("FAIL sweep step %" PRIu32 ": got 0x%016" PRIx64 "\n", i, ts);
+      prv_test_failed = 1;
+    }
+    prev = ts;
+  }
+  if(!prv_test_failed){
+    printf("ok   sweep across wrap\n");
+  }
+
+  printf(prv_test_failed ? "FAILED\n" : "PASSED\n");
+  return prv_test_failed;
+}